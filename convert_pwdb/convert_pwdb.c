@@ -78,7 +78,7 @@ new_folder(char const *name)
 	new->name = malloc(STRING_MEDIUM);
 	strncpy(new->name, name, STRING_MEDIUM);
 	new->parent = NULL;
-	PWLIST_INIT(&new->list);
+	memset(&new->list, 0, sizeof(new->list));
 	new->sublists = NULL;
 	debug("new_folder: %s", name);
 
@@ -88,14 +88,13 @@ new_folder(char const *name)
 static int 
 free_folder(folder_t *old)
 {
-	password_t *current, *next;
 	folder_t *curlist, *nlist;
 
 	if (!old)
 		return 0;
 
-	PWLIST_FOREACH_SAFE(current, &old->list, next)
-		free_pw(current);
+	while (old->list.n)
+		free_pw(old->list.ents[old->list.n - 1].pw);
 
 	for (curlist = old->sublists; curlist != NULL; curlist = nlist) {
 		nlist = curlist->next;
@@ -110,33 +109,13 @@ free_folder(folder_t *old)
 static password_t*
 new_pw()
 {
-	password_t *new;
-	new = malloc(sizeof(password_t));
-	new->id = 0;
-	new->name = malloc(STRING_MEDIUM);
-	new->host = malloc(STRING_MEDIUM);
-	new->user = malloc(STRING_MEDIUM);
-	new->passwd = malloc(STRING_SHORT);
-	new->launch = malloc(STRING_LONG);
-
-	memset(new->name, 0, STRING_MEDIUM);
-	memset(new->host, 0, STRING_MEDIUM);
-	memset(new->user, 0, STRING_MEDIUM);
-	memset(new->passwd, 0, STRING_SHORT);
-	memset(new->launch, 0, STRING_LONG);
-	
-	return new;
+	return pwstore_new();
 }
 
 void
 free_pw(password_t *old)
 {
-	free(old->name);
-	free(old->user);
-	free(old->host);
-	free(old->passwd);
-	free(old->launch);
-	free(old);
+	pwstore_free(old);
 }
 
 static void
@@ -147,7 +126,7 @@ add_pw_ptr(list, new)
 	assert(list);
 	assert(new);
 
-	PWLIST_INSERT_TAIL(&list->list, new);
+	pwstore_attach(list, new);
 }
 
 static void 
@@ -156,11 +135,11 @@ write_password_node(xmlNodePtr root, password_t *pw)
 	xmlNodePtr node;
 
 	node = xmlNewChild(root, NULL, (xmlChar const*)"PwItem", NULL);
-	xmlNewChild(node, NULL, (xmlChar const*)"name", (xmlChar*)pw->name);
-	xmlNewChild(node, NULL, (xmlChar const*)"host", (xmlChar*)pw->host);
-	xmlNewChild(node, NULL, (xmlChar const*)"user", (xmlChar*)pw->user);
-	xmlNewChild(node, NULL, (xmlChar const*)"passwd", (xmlChar*)pw->passwd);
-	xmlNewChild(node, NULL, (xmlChar const*)"launch", (xmlChar*)pw->launch);
+	xmlNewChild(node, NULL, (xmlChar const*)"name", (xmlChar*)PW_FIELD(pw, PW_NAME));
+	xmlNewChild(node, NULL, (xmlChar const*)"host", (xmlChar*)PW_FIELD(pw, PW_HOST));
+	xmlNewChild(node, NULL, (xmlChar const*)"user", (xmlChar*)PW_FIELD(pw, PW_USER));
+	xmlNewChild(node, NULL, (xmlChar const*)"passwd", (xmlChar*)PW_FIELD(pw, PW_PASSWD));
+	xmlNewChild(node, NULL, (xmlChar const*)"launch", (xmlChar*)PW_FIELD(pw, PW_LAUNCH));
 }
 
 static void
@@ -168,11 +147,12 @@ write_folder(xmlNodePtr parent, folder_t *list)
 {
 	xmlNodePtr node;
 	password_t* iter;
+	uint32_t i;
 
 	node = xmlNewChild(parent, NULL, (xmlChar const*)"PwList", NULL);
 	xmlSetProp(node, (xmlChar const*)"name", (xmlChar*)list->name);
 
-	PWLIST_FOREACH(iter, &list->list)
+	PWLIST_FOREACH(iter, &list->list, i)
 		write_password_node(node, iter);
 }
 
@@ -187,7 +167,7 @@ char	vers[5];
 		puts("write_new_doc: bad password data");
 		exit(-1);
 	}
-	snprintf(vers, sizeof(vers), "%d", FF_VERSION);
+	snprintf(vers, sizeof(vers), "%d", FF_XML_VERSION);
 	doc = xmlNewDoc((xmlChar const*)"1.0");
 
 	if (!export) {
@@ -197,7 +177,7 @@ char	vers[5];
 	} else {
 		root = xmlNewDocNode(doc, NULL, (xmlChar const*)"PWMan_Export", NULL);
 		xmlSetProp(root, (xmlChar const *) "version", (xmlChar *) vers);
-		write_password_node(root, PWLIST_FIRST(&list->list));
+		write_password_node(root, list->list.ents[0].pw);
 	}
 
 	xmlDocSetRootElement(doc, root);
@@ -219,19 +199,19 @@ read_pw_node(xmlNodePtr parent)
 			debug("read_pw_node: fucked node");
 		} else if( strcmp((char*)node->name, "name") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->name, text, STRING_MEDIUM);
+			if(text) pwstore_set(new, PW_NAME, text, 0);
 		} else if( strcmp((char*)node->name, "user") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->user, text, STRING_MEDIUM);
+			if(text) pwstore_set(new, PW_USER, text, 0);
 		} else if( strcmp((char*)node->name, "passwd") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->passwd, text, STRING_SHORT);
+			if(text) pwstore_set(new, PW_PASSWD, text, 0);
 		} else if( strcmp((char*)node->name, "host") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->host, text, STRING_MEDIUM);
+			if(text) pwstore_set(new, PW_HOST, text, 0);
 		} else if( strcmp((char*)node->name, "launch") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->launch, text, STRING_LONG);
+			if(text) pwstore_set(new, PW_LAUNCH, text, 0);
 		} else {
 			debug("read_pw_node: unrecognised node \"%s\"", node->name);
 		}
@@ -0,0 +1,362 @@
+/*
+ *  PWDB2BIN - Convert pwman XML databases to the binary format
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include	<stdlib.h>
+#include	<stdio.h>
+
+#include	<libxml/parser.h>
+
+#include	"pwman.h"
+#include	"pwdb.h"
+
+#define STR_LEN 255
+#define PWDB2BIN_PACKAGE "PWDB2BIN"
+#define PWDB2BIN_VERSION "0.1.0"
+
+static void		 show_version(void);
+static void		 show_usage(char *);
+static void		 get_options(int argc, char *argv[]);
+static folder_t		*new_folder(char const *name);
+static void		 free_folder(folder_t *old);
+static folder_t		*read_folder(xmlNodePtr node, folder_t *parent);
+static void		 read_password_node(xmlNodePtr node, folder_t *list);
+static folder_t		*parse_doc(xmlDocPtr doc);
+static xmlDocPtr	 get_data(void);
+static int		 put_data(folder_t *list);
+static char		*ask(char const *msg);
+
+static char	*gpg_id;
+static char	*infile;
+static char	*outfile;
+static int	 nlists, nentries;
+
+void
+debug(char const *fmt, ...)
+{
+#ifdef DEBUG
+va_list	ap;
+
+	fputs("PWDB2BIN Debug% ", stderr);
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+#endif
+}
+
+static folder_t *
+new_folder(name)
+	char const	*name;
+{
+folder_t	*new;
+
+	new = xcalloc(1, sizeof(*new));
+	new->id = ++nlists;
+	new->name = xstrdup(name);
+	return new;
+}
+
+static void
+free_folder(old)
+	folder_t	*old;
+{
+folder_iter_t	 it;
+folder_t	*list;
+
+	folder_iter_init(&it, old, FOLDER_LEAVE);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		free(list->name);
+		free(list);
+	}
+	pwstore_clear();
+}
+
+static void
+read_password_node(parent, list)
+	xmlNodePtr	 parent;
+	folder_t	*list;
+{
+password_t	*new;
+xmlNodePtr	 node;
+xmlChar		*text;
+int		 field;
+
+	new = pwstore_new();
+	PW_ENT(new)->id = ++nentries;
+
+	for (node = parent->children; node != NULL; node = node->next) {
+		if (node->type != XML_ELEMENT_NODE)
+			continue;
+
+		if (strcmp((char const *) node->name, "name") == 0)
+			field = PW_NAME;
+		else if (strcmp((char const *) node->name, "host") == 0)
+			field = PW_HOST;
+		else if (strcmp((char const *) node->name, "user") == 0)
+			field = PW_USER;
+		else if (strcmp((char const *) node->name, "passwd") == 0)
+			field = PW_PASSWD;
+		else if (strcmp((char const *) node->name, "launch") == 0)
+			field = PW_LAUNCH;
+		else {
+			debug("read_password_node: unrecognised node \"%s\"", node->name);
+			continue;
+		}
+
+		text = xmlNodeGetContent(node);
+		pwstore_set(new, field, (char const *) text, 0);
+		xmlFree(text);
+	}
+
+	pwstore_attach(list, new);
+}
+
+static folder_t *
+read_folder(parent, parent_list)
+	xmlNodePtr	 parent;
+	folder_t	*parent_list;
+{
+xmlNodePtr	 node;
+folder_t	*new, **tail;
+char		*name;
+
+	name = (char *) xmlGetProp(parent, (xmlChar const *) "name");
+	new = new_folder(name ? name : "");
+	xfree(name);
+	new->parent = parent_list;
+
+	tail = &new->sublists;
+	for (node = parent->children; node != NULL; node = node->next) {
+		if (node->type != XML_ELEMENT_NODE)
+			continue;
+
+		if (strcmp((char const *) node->name, "PwList") == 0) {
+			*tail = read_folder(node, new);
+			tail = &(*tail)->next;
+		} else if (strcmp((char const *) node->name, "PwItem") == 0)
+			read_password_node(node, new);
+	}
+
+	return new;
+}
+
+static folder_t *
+parse_doc(doc)
+	xmlDocPtr	doc;
+{
+xmlNodePtr	 root, node;
+char		*buf;
+int		 i;
+
+	if (!doc)
+		return NULL;
+
+	root = xmlDocGetRootElement(doc);
+	if (!root || strcmp((char const *) root->name, "PWMan_PasswordList") != 0)
+		return NULL;
+
+	if ((buf = (char *) xmlGetProp(root, (xmlChar const *) "version")) != NULL) {
+		i = atoi(buf);
+		free(buf);
+	} else
+		i = 0;
+
+	if (i < FF_XML_VERSION) {
+		fprintf(stderr, "%s: file is in an older format, use convert_pwdb first\n",
+			infile);
+		return NULL;
+	}
+
+	for (node = root->children; node != NULL; node = node->next)
+		if (node->type == XML_ELEMENT_NODE &&
+		    strcmp((char const *) node->name, "PwList") == 0)
+			return read_folder(node, NULL);
+
+	return NULL;
+}
+
+static xmlDocPtr
+get_data()
+{
+FILE		*fp;
+char		 cmd[STR_LEN * 2];
+char		*data = NULL;
+size_t		 len = 0, size = 0, n;
+xmlDocPtr	 doc;
+
+	snprintf(cmd, sizeof(cmd), "gpg -d %s", infile);
+	debug(cmd);
+	if ((fp = popen(cmd, "r")) == NULL)
+		return NULL;
+
+	do {
+		if (len == size) {
+			size = size ? size * 2 : BUFSIZ;
+			data = realloc(data, size);
+		}
+		n = fread(data + len, 1, size - len, fp);
+		len += n;
+	} while (n > 0);
+	pclose(fp);
+
+	if (len == 0) {
+		free(data);
+		return NULL;
+	}
+
+	doc = xmlParseMemory(data, (int) len);
+	bzero(data, len);
+	free(data);
+
+	return doc;
+}
+
+static int
+put_data(list)
+	folder_t	*list;
+{
+FILE	*fp;
+char	 cmd[STR_LEN * 3];
+int	 ret;
+
+	snprintf(cmd, sizeof(cmd), "gpg -e -r %s -o %s", gpg_id, outfile);
+	debug(cmd);
+	if ((fp = popen(cmd, "w")) == NULL)
+		return -1;
+
+	ret = pwdb_write(fp, list);
+
+	if (pclose(fp) != 0)
+		ret = -1;
+	return ret;
+}
+
+static char *
+ask(msg)
+	char const	*msg;
+{
+char	*input;
+
+	input = malloc(STR_LEN);
+
+	fputs(msg, stdout);
+	fputc('\t', stdout);
+	if (fgets(input, STR_LEN, stdin) == NULL)
+		exit(1);
+
+	input[strcspn(input, "\n")] = 0;
+	return input;
+}
+
+static void
+get_options(int argc, char *argv[])
+{
+int	i;
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
+			show_usage(argv[0]);
+			exit(1);
+		} else if (!strcmp(argv[i], "--version") || !strcmp(argv[i], "-v")) {
+			show_version();
+			exit(1);
+		}
+	}
+
+	if (argc > 1)
+		gpg_id = strdup(argv[1]);
+	else
+		gpg_id = ask("ID to encrypt new file to:");
+
+	if (argc > 2)
+		infile = strdup(argv[2]);
+	else
+		infile = ask("File in XML format:");
+
+	if (argc > 3)
+		outfile = strdup(argv[3]);
+	else
+		outfile = ask("File to write binary format to:");
+}
+
+int
+main(int argc, char *argv[])
+{
+xmlDocPtr	 doc;
+folder_t	*list;
+int		 ret = 0;
+
+	get_options(argc, argv);
+
+	doc = get_data();
+	list = parse_doc(doc);
+	if (doc)
+		xmlFreeDoc(doc);
+
+	if (!list) {
+		fprintf(stderr, "%s: bad password data\n", infile);
+		return 1;
+	}
+
+	if (put_data(list) != 0) {
+		fprintf(stderr, "%s: could not write new file\n", outfile);
+		ret = 1;
+	}
+
+	free_folder(list);
+	free(infile);
+	free(outfile);
+	free(gpg_id);
+
+	return ret;
+}
+
+static void
+show_version()
+{
+	puts(PWDB2BIN_PACKAGE " v " PWDB2BIN_VERSION);
+	puts("Copyright (c) 2014 Felicity Tarnell");
+	puts("This program is free software; you can redistribute it and/or modify");
+	puts("it under the terms of the GNU General Public License as published by");
+	puts("the Free Software Foundation; either version 2 of the License, or");
+	puts("(at your option) any later version.\n");
+
+	puts("This program is distributed in the hope that it will be useful,");
+	puts("but WITHOUT ANY WARRANTY; without even the implied warranty of");
+	puts("MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the");
+	puts("GNU General Public License for more details.\n");
+
+	puts("You should have received a copy of the GNU General Public License");
+	puts("along with this program; if not, write to the Free Software");
+	puts("Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.\n");
+}
+
+static void
+show_usage(char *argv_0)
+{
+	printf("Usage: %s [<gnupg_id> [<xmlfile> [<newfile>]]]\n", argv_0);
+	puts("Convert Password Database from the PWMan XML format to the binary format\n");
+	puts("  --help                 show usage");
+	puts("  --version              display version information");
+	puts("  <gnupg_id>             GnuPG ID to encrypt new password database to");
+	puts("  <xmlfile>              password database file in XML format");
+	puts("  <newfile>              password database file to write in binary format\n\n");
+}
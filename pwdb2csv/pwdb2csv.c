@@ -26,6 +26,7 @@
 #include	<libxml/parser.h>
 
 #include	"pwman.h"
+#include	"pwdb.h"
 
 #define STR_LEN 255
 #define PWDB2CSV_PACKAGE "PWDB2CSV"
@@ -36,12 +37,13 @@ static void show_usage(char*);
 
 static password_t*		 new_pw(void);
 static folder_t		*new_folder(char *name);
-static void		 free_pw(password_t *old);
 static void		 free_folder(folder_t *old);
 
 static folder_t		*parse_doc(xmlDocPtr doc);
-static char		*add_to_buf(char *buf, char const *new);
-static xmlDocPtr	 get_data(void);
+static folder_t		*parse_pwdb(char const *data, size_t len);
+static void		*pwdb_list(void *arg, void *parent, char const *name, int id);
+static void		 pwdb_entry(void *arg, void *list, int id, char const **fields);
+static char		*get_data(size_t *len);
 static int		 read_folder(xmlNodePtr parent, folder_t *parent_list);
 static void		 read_password_node(xmlNodePtr parent, folder_t *list);
 static void		 write_password_node(FILE *fp, password_t *pw);
@@ -82,7 +84,7 @@ new_folder(char *name)
 	new->name = malloc(STRING_MEDIUM);
 	strncpy(new->name, name, STRING_MEDIUM);
 	new->parent = NULL;
-	PWLIST_INIT(&new->list);
+	memset(&new->list, 0, sizeof(new->list));
 	new->sublists = NULL;
 	debug("new_folder: %s", name);
 
@@ -92,60 +94,23 @@ new_folder(char *name)
 static void
 free_folder(folder_t *old)
 {
-password_t	*current, *next;
-folder_t	*curlist, *nlist;
+folder_iter_t	 it;
+folder_t	*list;
 
 	debug("free_folder: free a password list");
-	if (old == NULL)
-		return;
-
-	PWLIST_FOREACH_SAFE(current, &old->list, next)
-		free_pw(current);
 
-	for (curlist = old->sublists; curlist != NULL; curlist = nlist){
-		nlist = curlist->next;
-		free_folder(curlist);
+	folder_iter_init(&it, old, FOLDER_LEAVE);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		free(list->name);
+		free(list);
 	}
-	
-	free(old->name);
-	free(old);
-	return;
+	pwstore_clear();
 }
 
 static password_t*
 new_pw()
 {
-	password_t *new;
-	new = malloc(sizeof(password_t));
-	new->id = 0;
-	new->name = malloc(STRING_MEDIUM);
-	new->host = malloc(STRING_MEDIUM);
-	new->user = malloc(STRING_MEDIUM);
-	new->passwd = malloc(STRING_SHORT);
-	new->launch = malloc(STRING_LONG);
-
-	memset(new->name, 0, STRING_MEDIUM);
-	memset(new->host, 0, STRING_MEDIUM);
-	memset(new->user, 0, STRING_MEDIUM);
-	memset(new->passwd, 0, STRING_SHORT);
-	memset(new->launch, 0, STRING_LONG);
-	
-	return new;
-}
-
-static void
-free_pw(password_t *old)
-{
-	debug("free_pw: free a password");
-	if (!old)
-		return;
-
-	free(old->name);
-	free(old->user);
-	free(old->host);
-	free(old->passwd);
-	free(old->launch);
-	free(old);
+	return pwstore_new();
 }
 
 static void
@@ -154,7 +119,7 @@ add_pw_ptr(folder_t *list, password_t *new)
 	assert(list);
 	assert(new);
 	
-	PWLIST_INSERT_TAIL(&list->list, new);
+	pwstore_attach(list, new);
 }
 
 static void
@@ -198,11 +163,11 @@ write_password_node(FILE *fp, password_t *pw)
 {
 char	*ename, *ehost, *euser, *epasswd, *elaunch;
 
-	ename = escape_string(pw->name);
-	ehost = escape_string(pw->host);
-	euser = escape_string(pw->user);
-	epasswd = escape_string(pw->passwd);
-	elaunch = escape_string(pw->launch);
+	ename = escape_string(PW_FIELD(pw, PW_NAME));
+	ehost = escape_string(PW_FIELD(pw, PW_HOST));
+	euser = escape_string(PW_FIELD(pw, PW_USER));
+	epasswd = escape_string(PW_FIELD(pw, PW_PASSWD));
+	elaunch = escape_string(PW_FIELD(pw, PW_LAUNCH));
 
 	fprintf(fp, "\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"\n", ename, ehost, euser,
 		epasswd, elaunch);
@@ -215,16 +180,18 @@ char	*ename, *ehost, *euser, *epasswd, *elaunch;
 }
 
 static int
-write_folder(FILE *fp, folder_t *list)
+write_folder(FILE *fp, folder_t *top)
 {
+folder_iter_t	 it;
 password_t*	 iter;
-folder_t	*pwliter;
-	
-	for (pwliter = list->sublists; pwliter != NULL; pwliter = pwliter->next)
-		write_folder(fp, pwliter);
+folder_t	*list;
+uint32_t	 i;
 
-	PWLIST_FOREACH(iter, &list->list)
-		write_password_node(fp, iter);
+	/* A list's sublists are written before its own entries */
+	folder_iter_init(&it, top, FOLDER_LEAVE);
+	while ((list = folder_iter_next(&it)) != NULL)
+		PWLIST_FOREACH(iter, &list->list, i)
+			write_password_node(fp, iter);
 
 	return 0;
 }
@@ -243,19 +210,19 @@ read_password_node(xmlNodePtr parent, folder_t *list)
 			debug("read_pw_node: fucked node");
 		} else if( strcmp((char*)node->name, "name") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->name, text, STRING_MEDIUM);
+			if(text) pwstore_set(new, PW_NAME, text, 0);
 		} else if( strcmp((char*)node->name, "user") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->user, text, STRING_MEDIUM);
+			if(text) pwstore_set(new, PW_USER, text, 0);
 		} else if( strcmp((char*)node->name, "passwd") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->passwd, text, STRING_SHORT);
+			if(text) pwstore_set(new, PW_PASSWD, text, 0);
 		} else if( strcmp((char*)node->name, "host") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->host, text, STRING_MEDIUM);
+			if(text) pwstore_set(new, PW_HOST, text, 0);
 		} else if( strcmp((char*)node->name, "launch") == 0){
 			text = (char*)xmlNodeGetContent(node);
-			if(text) strncpy(new->launch, text, STRING_LONG);
+			if(text) pwstore_set(new, PW_LAUNCH, text, 0);
 		} else {
 			debug("read_pw_node: unrecognised node \"%s\"", node->name);
 		}
@@ -322,7 +289,7 @@ int		 i;
 	else
 		i = 0;
 
-	if (i < FF_VERSION) {
+	if (i < FF_XML_VERSION) {
 		xmlFreeDoc(doc);
 		return NULL;
 	}
@@ -340,56 +307,89 @@ int		 i;
 	return list;
 }
 
-static char *
-add_to_buf(buf, new)
-	char		*buf;
-	char const	*new;
+static void *
+pwdb_list(arg, parent, name, id)
+	void		*arg, *parent;
+	char const	*name;
 {
-size_t	size;
+folder_t	*new;
 
-	if (new == NULL)
-		return buf;
+	new = new_folder((char *) name);
+	add_pw_sublist(parent ? parent : arg, new);
+	return new;
+}
 
-	if (buf == NULL) {
-		buf = malloc(strlen(new)+1);
-		strcpy(buf, new);
-		return buf;
-	}
+static void
+pwdb_entry(arg, list, id, fields)
+	void		*arg, *list;
+	char const	**fields;
+{
+password_t	*pw;
+
+	pw = pwstore_new();
+	PW_ENT(pw)->id = id;
+	pwstore_set(pw, PW_NAME, fields[PWDB_NAME], 0);
+	pwstore_set(pw, PW_HOST, fields[PWDB_HOST], 0);
+	pwstore_set(pw, PW_USER, fields[PWDB_USER], 0);
+	pwstore_set(pw, PW_PASSWD, fields[PWDB_PASSWD], 0);
+	pwstore_set(pw, PW_LAUNCH, fields[PWDB_LAUNCH], 0);
+
+	add_pw_ptr(list, pw);
+}
+
+static folder_t *
+parse_pwdb(data, len)
+	char const	*data;
+	size_t		 len;
+{
+static pwdb_ops_t const	 ops = { pwdb_list, pwdb_entry };
+pwdb_reader_t		*r;
+folder_t		*list;
+
+	list = new_folder("Main");
 
-	size = strlen(buf) + strlen(new) + 1;
-	buf = realloc(buf, size);
-	strcat(buf, new);
+	r = pwdb_reader_new(&ops, list);
+	if (pwdb_reader_feed(r, data, len) != 0 || pwdb_reader_finish(r) != 0) {
+		free_folder(list);
+		list = NULL;
+	}
+	pwdb_reader_free(r);
 
-	return buf;
+	return list;
 }
 
-static xmlDocPtr
-get_data()
+static char *
+get_data(len)
+	size_t	*len;
 {
 	FILE *fp;
 	char *cmd;
 	char *data;
-	char buf[STR_LEN];
-	xmlDocPtr doc;
+	size_t size, n;
 
 	data = NULL;
+	*len = size = 0;
 	cmd = malloc(STR_LEN);
 	snprintf(cmd, STR_LEN, "gpg -d %s", infile);
 	debug(cmd);
 	fp = popen(cmd, "r");
 
-	while( fgets(buf, STR_LEN, fp) != NULL ){
-		data = add_to_buf(data, buf);
-	}
+	/* The database may be binary, so don't treat it as a string */
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : BUFSIZ;
+			data = realloc(data, size);
+		}
+		n = fread(data + *len, 1, size - *len, fp);
+		*len += n;
+	} while (n > 0);
 	pclose(fp);
 
-	if(!data){
+	if (*len == 0) {
 		exit(-1);
 	}
 
-	doc = xmlParseMemory(data, (int) strlen(data));
-
-	return doc;
+	return data;
 }
 
 static void
@@ -457,13 +457,19 @@ get_options(int argc, char *argv[])
 int
 main(int argc, char *argv[])
 {
-xmlDocPtr	 doc;
+char		*data;
+size_t		 len;
 folder_t		*list;
 	
 	get_options(argc, argv);
 
-	doc = get_data();
-	list = parse_doc(doc);
+	data = get_data(&len);
+	if (len >= PWDB_MAGIC_LEN && memcmp(data, PWDB_MAGIC, PWDB_MAGIC_LEN) == 0)
+		list = parse_pwdb(data, len);
+	else
+		list = parse_doc(xmlParseMemory(data, (int) len));
+	free(data);
+
 	put_data(list);
 	free_folder(list);
 
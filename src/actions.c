@@ -25,6 +25,8 @@
 #include	"pwman.h"
 #include	"gnupg.h"
 #include	"actions.h"
+#include	"journal.h"
+#include	"trigram.h"
 
 static void	unmark_entries(void);
 static void	action_edit_pw(password_t *pw);
@@ -32,73 +34,103 @@ static void	_create_information_field(char const *name, InputField * field);
 
 static int	disp_h = 15, disp_w = 60;
 
+/*
+ * Store a string the UI gave us in pw, which keeps its own copy.
+ */
+static void
+action_free_str(s)
+	char	*s;
+{
+	if (s) {
+		bzero(s, strlen(s));
+		free(s);
+	}
+}
+
+static void
+action_set_field(pw, field, value)
+	password_t	*pw;
+	char		*value;
+{
+	pw_setfield(pw, field, value);
+	action_free_str(value);
+}
+
 void
 action_list_add_pw()
 {
 password_t     *pw;
+char	       *vals[PW_NFIELDS];
 
 InputField	fields[] = {
-	{"Name: ",		NULL, STRING},
-	{"Host: ",		NULL, STRING},
-	{"User: ",		NULL, STRING},
-	{"Password: ",		NULL, STRING, pwgen_ask},
-	{"Launch command: ",	NULL, STRING}
+	{"Name: ",		&vals[PW_NAME],		STRING},
+	{"Host: ",		&vals[PW_HOST],		STRING},
+	{"User: ",		&vals[PW_USER],		STRING},
+	{"Password: ",		&vals[PW_PASSWD],	STRING, pwgen_ask},
+	{"Launch command: ",	&vals[PW_LAUNCH],	STRING}
 };
 int		i;
 
-	pw = xcalloc(1, sizeof(*pw));
-	if ((pw->name = ui_ask_str(fields[0].name, NULL)) == NULL)
-		goto end;
-
-	if ((pw->host = ui_ask_str(fields[1].name, NULL)) == NULL)
-		goto end;
-
-	if ((pw->user = ui_ask_str(fields[2].name, NULL)) == NULL)
-		goto end;
-
-	if ((pw->passwd = ui_ask_str_with_autogen(fields[3].name, NULL,
-				     fields[3].autogen, CNTL('G'))) == NULL)
-		goto end;
-
-	if ((pw->launch = ui_ask_str(fields[4].name, NULL)) == NULL)
-		goto end;
+	bzero(vals, sizeof(vals));
+	for (i = 0; i < PW_NFIELDS; i++) {
+		if (i == PW_PASSWD)
+			vals[i] = ui_ask_str_with_autogen(fields[i].name, NULL,
+					fields[i].autogen, CNTL('G'));
+		else
+			vals[i] = ui_ask_str(fields[i].name, NULL);
 
-	fields[0].value = &pw->name;
-	fields[1].value = &pw->host;
-	fields[2].value = &pw->user;
-	fields[3].value = &pw->passwd;
-	fields[4].value = &pw->launch;
+		if (vals[i] == NULL)
+			goto end;
+	}
 
-	i = action_yes_no_dialog(fields, (sizeof(fields) / sizeof(InputField)), NULL, "Add this entry");
+	if (action_yes_no_dialog(fields, (sizeof(fields) / sizeof(InputField)),
+				 NULL, "Add this entry")) {
+		pw = pwstore_new();
+		for (i = 0; i < PW_NFIELDS; i++) {
+			action_set_field(pw, i, vals[i]);
+			vals[i] = NULL;
+		}
 
-	if (i) {
 		folder_add_pw(current_pw_sublist, pw);
 		ui_statusline_msg("New password added");
-	} else {
-		pw_delete(pw);
+	} else
 		ui_statusline_msg("New password cancelled");
-	}
 
 	uilist_refresh();
-	return;
 
 end:
-	pw_delete(pw);
+	for (i = 0; i < PW_NFIELDS; i++)
+		action_free_str(vals[i]);
 }
 
 static void
 action_edit_pw(pw)
 	password_t	*pw;
 {
+char	       *vals[PW_NFIELDS], *orig[PW_NFIELDS];
 InputField	fields[] = {
-	{"Name: ",		&pw->name,	STRING},
-	{"Host: ",		&pw->host,	STRING},
-	{"User: ",		&pw->user,	STRING},
-	{"Password: ",		&pw->passwd,	STRING, pwgen_ask},
-	{"Launch command: ",	&pw->launch,	STRING}
+	{"Name: ",		&vals[PW_NAME],		STRING},
+	{"Host: ",		&vals[PW_HOST],		STRING},
+	{"User: ",		&vals[PW_USER],		STRING},
+	{"Password: ",		&vals[PW_PASSWD],	STRING, pwgen_ask},
+	{"Launch command: ",	&vals[PW_LAUNCH],	STRING}
 };
+size_t		i;
 
+	for (i = 0; i < PW_NFIELDS; i++)
+		vals[i] = orig[i] = xstrdup(PW_FIELD(pw, i));
+
+	/* The dialog replaces the strings it changes with its own */
 	action_input_dialog(fields, (sizeof(fields) / sizeof(InputField)), "Edit password");
+	for (i = 0; i < PW_NFIELDS; i++) {
+		if (vals[i] != orig[i])
+			action_set_field(pw, i, vals[i]);
+		action_free_str(orig[i]);
+	}
+
+	trigram_add(pw);
+	filter_invalidate();
+	journal_put_entry(pw);
 }
 
 void
@@ -114,7 +146,7 @@ char           *new_name;
 	case PW_ITEM:
 		curpw = uilist_get_highlighted_item();
 		if (curpw) {
-			new_name = ui_ask_str("New name", curpw->name);
+			new_name = ui_ask_str("New name", PW_FIELD(curpw, PW_NAME));
 			if (strlen(new_name) > 0)
 				pw_rename(curpw, new_name);
 			free(new_name);
@@ -149,6 +181,7 @@ InputField	fields[] = {
 	{ "Password file: ",			&options->password_file,	STRING},
 	{ "Passphrase timeout (in minutes): ",	&options->passphrase_timeout,	INT},
 	{ "Copy command: ",			&options->copy_command,		STRING},
+	{ "Search threads (0 for one per CPU): ", &options->search_threads,	INT},
 };
 
 	if (options->safemode) {
@@ -415,14 +448,14 @@ void
 action_list_add_sublist()
 {
 char           *name;
-folder_t       *sublist, *iter;
+folder_t       *sublist;
 
-	name = ui_ask_str("Sublist name:", NULL);
-	for (iter = current_pw_sublist->sublists; iter != NULL; iter = iter->next) {
-		if (strcmp(iter->name, name) == 0) {
-			free(name);
-			return;
-		}
+	if ((name = ui_ask_str("Sublist name:", NULL)) == NULL)
+		return;
+
+	if (folder_find_sublist(current_pw_sublist, name) != NULL) {
+		free(name);
+		return;
 	}
 
 	sublist = folder_new(name);
@@ -513,7 +546,7 @@ char		str[STRING_LONG];
 		curpw = cursearch->entry;
 
 		if (curpw) {
-			snprintf(str, sizeof(str), "Really delete \"%s\"", curpw->name);
+			snprintf(str, sizeof(str), "Really delete \"%s\"", PW_FIELD(curpw, PW_NAME));
 			if ((i = ui_ask_yes_no(str, 0)) != 0) {
 				pw_delete(curpw);
 				ui_statusline_msg("Password deleted");
@@ -540,7 +573,7 @@ char		str[STRING_LONG];
 		curpw = uilist_get_highlighted_item();
 
 		if (curpw) {
-			snprintf(str, sizeof(str), "Really delete \"%s\"", curpw->name);
+			snprintf(str, sizeof(str), "Really delete \"%s\"", PW_FIELD(curpw, PW_NAME));
 			i = ui_ask_yes_no(str, 0);
 			if (i) {
 				pw_delete(curpw);
@@ -575,8 +608,9 @@ char		str[STRING_LONG];
 void
 action_list_move_item()
 {
-password_t     *curpw, *tmp;
+password_t     *curpw;
 folder_t       *curpwl, *list, *nextl;
+uint32_t	i;
 int		type;
 
 	if (search_results) {
@@ -602,9 +636,9 @@ int		type;
 
 		curpwl = sr->sublist;
 
-		for (sr = search_results; sr; sr = sr->next) {
+		for (sr = search_results; sr < search_results + nsearch_results; sr++) {
 			if (sr->entry) {
-				if (!sr->entry->marked)
+				if (!PW_ENT(sr->entry)->marked)
 					continue;
 
 				folder_detach_pw(sr->sublist, sr->entry);
@@ -637,9 +671,13 @@ int		type;
 		}
 	}
 
-	PWLIST_FOREACH_SAFE(curpw, &current_pw_sublist->list, tmp) {
-		if (!curpw->marked)
+	/* Moving an entry closes its gap, so look at the same slot again */
+	for (i = 0; i < current_pw_sublist->list.n;) {
+		curpw = current_pw_sublist->list.ents[i].pw;
+		if (!PW_ENT(curpw)->marked) {
+			i++;
 			continue;
+		}
 
 		folder_detach_pw(current_pw_sublist, curpw);
 		folder_add_pw(curpwl, curpw);
@@ -788,7 +826,7 @@ search_result_t *cursearch;
 	}
 
 	if (curpw) {
-		currentName = curpw->name;
+		currentName = PW_FIELD(curpw, PW_NAME);
 		depth = 1;
 	} else if (curpwl) {
 		currentName = curpwl->name;
@@ -842,7 +880,7 @@ char		msg[STRING_LONG];
 		debug("list_launch: is a pw");
 		curpw = uilist_get_highlighted_item();
 		if (curpw) {
-			if (!curpw->launch || !*curpw->launch) {
+			if (!*PW_FIELD(curpw, PW_LAUNCH)) {
 				ui_statusline_msg("Launch command not defined");
 				return;
 			}
@@ -929,7 +967,7 @@ search_result_t	*cursearch;
 
 	if (!curpw)
 		return;
-	if (copy_string(curpw->user) == 0)
+	if (copy_string(PW_FIELD(curpw, PW_USER)) == 0)
 		ui_statusline_msg("Username copied");
 	else
 		ui_statusline_msg("Failed to copy username");
@@ -958,7 +996,7 @@ search_result_t	*cursearch;
 	if (!curpw)
 		return;
 
-	if (copy_string(curpw->passwd) == 0)
+	if (copy_string(PW_FIELD(curpw, PW_PASSWD)) == 0)
 		ui_statusline_msg("Password copied");
 	else
 		ui_statusline_msg("Failed to copy password");
@@ -1005,7 +1043,7 @@ folder_t	*curpwl;
 	if (search_results) {
 	search_result_t	*sr = uilist_get_highlighted_searchresult();
 		if (sr->entry)
-			sr->entry->marked = !sr->entry->marked;
+			PW_ENT(sr->entry)->marked = !PW_ENT(sr->entry)->marked;
 		else
 			sr->sublist->marked = !sr->sublist->marked;
 		uilist_refresh();
@@ -1016,7 +1054,7 @@ folder_t	*curpwl;
 	case PW_ITEM:
 		if ((curpw = uilist_get_highlighted_item()) == NULL)
 			return;
-		curpw->marked = !curpw->marked;
+		PW_ENT(curpw)->marked = !PW_ENT(curpw)->marked;
 		break;
 
 	case PW_SUBLIST:
@@ -1035,21 +1073,21 @@ folder_t	*curpwl;
 void
 unmark_entries()
 {
-password_t	*pw;
 folder_t	*pwl;
+uint32_t	 i;
 
 	if (search_results) {
 	search_result_t	*sr;
-		for (sr = search_results; sr; sr = sr->next)
+		for (sr = search_results; sr < search_results + nsearch_results; sr++)
 			if (sr->entry)
-				sr->entry->marked = 0;
+				PW_ENT(sr->entry)->marked = 0;
 			else
 				sr->sublist->marked = 0;
 		return;
 	}
 
-	PWLIST_FOREACH(pw, &current_pw_sublist->list)
-		pw->marked = 0;
+	for (i = 0; i < current_pw_sublist->list.n; i++)
+		current_pw_sublist->list.ents[i].marked = 0;
 
 	for (pwl = current_pw_sublist->sublists; pwl; pwl = pwl->next)
 		pwl->marked = 0;
@@ -0,0 +1,475 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include	<sys/types.h>
+#include	<sys/socket.h>
+#include	<sys/stat.h>
+#include	<sys/time.h>
+#include	<sys/resource.h>
+#include	<sys/un.h>
+
+#include	<stdlib.h>
+#include	<unistd.h>
+#include	<fcntl.h>
+#include	<signal.h>
+#include	<limits.h>
+#include	<poll.h>
+#include	<errno.h>
+
+#include	"config.h"
+
+#if	defined(HAVE_SYS_MMAN_H) && defined(HAVE_MLOCKALL)
+# define USE_MLOCKALL
+# include <sys/mman.h>
+#endif
+
+#include	"pwman.h"
+#include	"gnupg.h"
+#include	"agent.h"
+
+/* What the database looked like when it was loaded */
+typedef struct agent_stamp {
+	struct stat	db, journal;
+} agent_stamp_t;
+
+/* A client that goes away early mustn't kill us */
+#ifndef	MSG_NOSIGNAL
+# define MSG_NOSIGNAL	0
+#endif
+
+static volatile sig_atomic_t	agent_stop;
+
+static int
+agent_address(sun)
+	struct sockaddr_un	*sun;
+{
+	bzero(sun, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+
+	if (!options->password_file)
+		return -1;
+
+	if ((size_t) snprintf(sun->sun_path, sizeof(sun->sun_path), "%s.agent",
+			      options->password_file) >= sizeof(sun->sun_path))
+		return -1;
+	return 0;
+}
+
+static int
+agent_connect(sun)
+	struct sockaddr_un	*sun;
+{
+int	fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *) sun, sizeof(*sun)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int
+agent_write(fd, buf, len)
+	void const	*buf;
+	size_t		 len;
+{
+char const	*p = buf;
+ssize_t		 n;
+
+	while (len > 0) {
+		if ((n = send(fd, p, len, MSG_NOSIGNAL)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Read until the other end shuts down, or max bytes have been read.
+ */
+static ssize_t
+agent_read(fd, buf, max)
+	char	*buf;
+	size_t	 max;
+{
+size_t	len = 0;
+ssize_t	n;
+
+	while (len < max) {
+		if ((n = read(fd, buf + len, max - len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	return len;
+}
+
+static void
+agent_set_timeout(fd)
+{
+struct timeval	tv;
+
+	tv.tv_sec = AGENT_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* Returns 1 if the other end of fd is our own user */
+static int
+agent_peer_ok(fd)
+{
+#if	defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || \
+	defined(__DragonFly__) || defined(__APPLE__)
+uid_t	uid;
+gid_t	gid;
+
+	if (getpeereid(fd, &uid, &gid) == -1)
+		return 0;
+	return uid == getuid();
+#elif	defined(SO_PEERCRED)
+struct ucred	cred;
+socklen_t	len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+		return 0;
+	return cred.uid == getuid();
+#else
+	/* Only the socket's permissions keep anyone else out */
+	return 1;
+#endif
+}
+
+/*
+ * Ask a running agent to run a command.  Returns the command's status, or -1
+ * if there's no agent to ask.
+ */
+int
+agent_query(argc, argv)
+	char	**argv;
+{
+struct sockaddr_un	 sun;
+struct stat		 st;
+char			*buf = NULL, *p, *end;
+size_t			 len = 0, size = 0, olen, elen;
+ssize_t			 n;
+int			 fd, i, status, ret = -1;
+
+	if (agent_address(&sun) == -1)
+		return -1;
+
+	/* Anyone else's agent could be lying about what's in the database */
+	if (lstat(sun.sun_path, &st) == -1 || !S_ISSOCK(st.st_mode) ||
+	    st.st_uid != getuid())
+		return -1;
+
+	if ((fd = agent_connect(&sun)) == -1)
+		return -1;
+
+	if (!agent_peer_ok(fd)) {
+		close(fd);
+		return -1;
+	}
+
+	agent_set_timeout(fd);
+
+	for (i = 0; i < argc; i++)
+		if (agent_write(fd, argv[i], strlen(argv[i]) + 1) == -1)
+			goto out;
+	shutdown(fd, SHUT_WR);
+
+	for (;;) {
+		if (len == size) {
+			size = size ? size * 2 : 4096;
+			buf = realloc(buf, size);
+		}
+
+		if ((n = agent_read(fd, buf + len, size - len)) <= 0)
+			break;
+		len += n;
+	}
+
+	if (n == -1 || (end = memchr(buf, '\n', len)) == NULL)
+		goto out;
+
+	/* The status line, then exactly the output and errors */
+	*end++ = '\0';
+	status = strtol(buf, &p, 10);
+	olen = strtoul(p, &p, 10);
+	elen = strtoul(p, &p, 10);
+	if (*p || olen + elen != len - (end - buf))
+		goto out;
+
+	fwrite(end, 1, olen, stdout);
+	fwrite(end + olen, 1, elen, stderr);
+	if (fflush(stdout) == EOF)
+		status = 1;
+	ret = status;
+
+out:
+	close(fd);
+	if (buf) {
+		bzero(buf, size);
+		free(buf);
+	}
+	return ret;
+}
+
+static void
+agent_stamp(st)
+	agent_stamp_t	*st;
+{
+char	jfile[PATH_MAX];
+
+	bzero(st, sizeof(*st));
+	snprintf(jfile, sizeof(jfile), "%s.journal", options->password_file);
+
+	if (stat(options->password_file, &st->db) == -1)
+		bzero(&st->db, sizeof(st->db));
+	if (stat(jfile, &st->journal) == -1)
+		bzero(&st->journal, sizeof(st->journal));
+}
+
+static int
+agent_same_file(a, b)
+	struct stat const	*a, *b;
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	       a->st_size == b->st_size && a->st_mtime == b->st_mtime;
+}
+
+/*
+ * Answer one request.  If the database has been saved since it was loaded,
+ * load it again first; the passphrase is still remembered, or the agent
+ * would already have exited.
+ */
+static void
+agent_serve(fd, loaded)
+	agent_stamp_t	*loaded;
+{
+agent_stamp_t	 now;
+char		*req, **argv = NULL, *obuf = NULL, *ebuf = NULL, head[64];
+size_t		 olen = 0, elen = 0, i;
+ssize_t		 len;
+FILE		*out, *err;
+int		 argc = 0, status = 1;
+
+	if (!agent_peer_ok(fd))
+		return;
+
+	agent_set_timeout(fd);
+
+	req = xmalloc(AGENT_MAX_REQUEST);
+	if ((len = agent_read(fd, req, AGENT_MAX_REQUEST)) <= 0 ||
+	    len == AGENT_MAX_REQUEST || req[len - 1] != '\0')
+		goto done;
+
+	for (i = 0; i < (size_t) len; i++)
+		if (req[i] == '\0')
+			argc++;
+
+	argv = xcalloc(argc + 1, sizeof(*argv));
+	for (i = 0, argc = 0; i < (size_t) len; i += strlen(req + i) + 1)
+		argv[argc++] = req + i;
+
+	if ((out = open_memstream(&obuf, &olen)) == NULL)
+		goto done;
+	if ((err = open_memstream(&ebuf, &elen)) == NULL) {
+		fclose(out);
+		goto done;
+	}
+
+	agent_stamp(&now);
+	if (!agent_same_file(&now.db, &loaded->db) ||
+	    !agent_same_file(&now.journal, &loaded->journal)) {
+		debug("agent_serve: database changed, loading it again");
+		folder_free_all();
+
+		if (folder_read_file() != 0) {
+			fprintf(err, "pwman: agent can't load %s again\n",
+				options->password_file);
+			agent_stop = 1;
+		} else {
+			*loaded = now;
+			status = pwman_run_command(out, err, argc, argv);
+		}
+	} else
+		status = pwman_run_command(out, err, argc, argv);
+
+	fclose(out);
+	fclose(err);
+
+	snprintf(head, sizeof(head), "%d %lu %lu\n", status,
+		 (unsigned long) olen, (unsigned long) elen);
+	if (agent_write(fd, head, strlen(head)) == 0 &&
+	    agent_write(fd, obuf, olen) == 0)
+		agent_write(fd, ebuf, elen);
+
+done:
+	if (obuf) {
+		bzero(obuf, olen);
+		free(obuf);
+	}
+	if (ebuf) {
+		bzero(ebuf, elen);
+		free(ebuf);
+	}
+	bzero(req, AGENT_MAX_REQUEST);
+	free(req);
+	free(argv);
+}
+
+static void
+agent_signal(sig)
+{
+	agent_stop = 1;
+}
+
+/*
+ * pwman --agent: load the database, then answer requests in the background
+ * until the passphrase times out or we're told to stop.
+ */
+void
+agent_run()
+{
+struct sockaddr_un	sun;
+struct rlimit		rl;
+struct pollfd		pfd;
+agent_stamp_t		loaded;
+mode_t			mask;
+time_t			left;
+int			s, fd, wait;
+
+	options->readonly = TRUE;
+	write_options = FALSE;
+
+	if (agent_address(&sun) == -1) {
+		fprintf(stderr, "pwman: no database, or its name is too long for a socket\n");
+		exit(1);
+	}
+
+	if ((fd = agent_connect(&sun)) != -1) {
+		fprintf(stderr, "pwman: an agent is already running for %s\n",
+			options->password_file);
+		exit(1);
+	}
+
+	if (access(options->password_file, F_OK) != 0) {
+		fprintf(stderr, "pwman: cannot open database %s\n",
+			options->password_file);
+		exit(1);
+	}
+
+	/* Keep the plaintext out of core files */
+	rl.rlim_cur = rl.rlim_max = 0;
+	setrlimit(RLIMIT_CORE, &rl);
+
+	folder_init();
+	if (folder_read_file() != 0) {
+		fprintf(stderr, "pwman: cannot read %s\n", options->password_file);
+		exit(1);
+	}
+	agent_stamp(&loaded);
+
+	/* Nobody else may even connect */
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		fprintf(stderr, "pwman: socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	unlink(sun.sun_path);
+	mask = umask(077);
+	if (bind(s, (struct sockaddr *) &sun, sizeof(sun)) == -1 ||
+	    chmod(sun.sun_path, S_IRUSR | S_IWUSR) == -1 || listen(s, 16) == -1) {
+		fprintf(stderr, "pwman: %s: %s\n", sun.sun_path, strerror(errno));
+		exit(1);
+	}
+	umask(mask);
+
+	/* The passphrase has been asked for, so go into the background */
+	switch (fork()) {
+	case -1:
+		fprintf(stderr, "pwman: fork: %s\n", strerror(errno));
+		unlink(sun.sun_path);
+		exit(1);
+
+	case 0:
+		break;
+
+	default:
+		_exit(0);
+	}
+
+#ifdef	USE_MLOCKALL
+	/* Memory locks aren't inherited */
+	mlockall(MCL_CURRENT | MCL_FUTURE);
+#endif
+
+	setsid();
+	if ((fd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(fd, 0);
+		dup2(fd, 1);
+		dup2(fd, 2);
+		if (fd > 2)
+			close(fd);
+	}
+
+	signal(SIGTERM, agent_signal);
+	signal(SIGINT, agent_signal);
+	signal(SIGHUP, agent_signal);
+
+	while (!agent_stop) {
+		wait = -1;
+		if (options->passphrase_timeout != 0) {
+			left = time_base + options->passphrase_timeout * 60 - time(NULL);
+			if (left <= 0)
+				break;
+			wait = left > INT_MAX / 1000 ? INT_MAX : left * 1000;
+		}
+
+		pfd.fd = s;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, wait) <= 0)
+			continue;
+
+		if ((fd = accept(s, NULL, NULL)) == -1)
+			continue;
+		agent_serve(fd, &loaded);
+		close(fd);
+	}
+
+	debug("agent_run: forgetting the database");
+	close(s);
+	unlink(sun.sun_path);
+	folder_free_all();
+	gnupg_forget_passphrase();
+	exit(0);
+}
@@ -0,0 +1,44 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef	PWMAN_AGENT_H
+#define	PWMAN_AGENT_H
+
+/*
+ * The agent keeps the database loaded and answers the commands pwman runs
+ * without the screen, so each one doesn't have to decrypt the whole database
+ * again.  It listens on a socket next to the database that only its owner
+ * can use, and exits when the passphrase times out.
+ *
+ * A request is the command's arguments, each followed by a NUL.  The reply
+ * is a line "<status> <output length> <error length>", then the output and
+ * the error messages.
+ */
+
+/* Requests longer than this are refused */
+#define	AGENT_MAX_REQUEST	65536
+
+/* How long, in seconds, a client has to send its request */
+#define	AGENT_TIMEOUT		5
+
+void	agent_run(void);
+int	agent_query(int argc, char **argv);
+
+#endif	/* !PWMAN_AGENT_H */
@@ -0,0 +1,243 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include	<stdlib.h>
+#include	<string.h>
+
+#include	"pwman.h"
+#include	"arena.h"
+
+#ifdef	HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+/* Chunk headers are padded so allocations after them stay aligned */
+#define	ARENA_HDR	((sizeof(arena_chunk_t) + ARENA_MIN - 1) & ~(ARENA_MIN - 1))
+
+/* A string's size class is kept in the byte before it; big ones are marked */
+#define	ARENA_BIGSTR	0xFF
+
+static int
+arena_class(size)
+	size_t	size;
+{
+int	c;
+
+	for (c = 0; (size_t) (ARENA_MIN << c) < size; c++)
+		;
+	return c;
+}
+
+static arena_chunk_t *
+arena_map(size)
+	size_t	size;
+{
+arena_chunk_t	*ch;
+
+#ifdef	HAVE_SYS_MMAN_H
+	ch = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
+		  -1, 0);
+	if (ch == MAP_FAILED) {
+		debug("arena_map: can't map %lu bytes", (unsigned long) size);
+		abort();
+	}
+
+	/* Not fatal; without privileges, the limit is often very low */
+	if (mlock(ch, size) == -1)
+		debug("arena_map: can't lock %lu bytes", (unsigned long) size);
+#else
+	ch = xcalloc(1, size);
+#endif
+
+	ch->size = size;
+	return ch;
+}
+
+static void
+arena_unmap(ch)
+	arena_chunk_t	*ch;
+{
+size_t	size = ch->size;
+
+	bzero(ch, size);
+#ifdef	HAVE_SYS_MMAN_H
+	munlock(ch, size);
+	munmap(ch, size);
+#else
+	free(ch);
+#endif
+}
+
+static void *
+arena_alloc_big(a, size)
+	arena_t	*a;
+	size_t	 size;
+{
+arena_chunk_t	*ch;
+
+	ch = arena_map(ARENA_HDR + size);
+	ch->next = a->big;
+	a->big = ch;
+	return (char *) ch + ARENA_HDR;
+}
+
+static void
+arena_release_big(a, p)
+	arena_t	*a;
+	void	*p;
+{
+arena_chunk_t	**chp, *ch = (arena_chunk_t *) ((char *) p - ARENA_HDR);
+
+	for (chp = &a->big; *chp; chp = &(*chp)->next) {
+		if (*chp == ch) {
+			*chp = ch->next;
+			arena_unmap(ch);
+			return;
+		}
+	}
+}
+
+static void *
+arena_alloc_class(a, c)
+	arena_t	*a;
+{
+arena_chunk_t	*ch;
+size_t		 size = ARENA_MIN << c;
+void		*p;
+
+	/* Released blocks were zeroed, except for the free list link */
+	if ((p = a->free[c]) != NULL) {
+		a->free[c] = *(void **) p;
+		*(void **) p = NULL;
+		return p;
+	}
+
+	if (a->next == NULL || (size_t) (a->end - a->next) < size) {
+		ch = arena_map(ARENA_CHUNK);
+		ch->next = a->chunks;
+		a->chunks = ch;
+		a->next = (char *) ch + ARENA_HDR;
+		a->end = (char *) ch + ARENA_CHUNK;
+	}
+
+	p = a->next;
+	a->next += size;
+	return p;
+}
+
+static void
+arena_release_class(a, p, c)
+	arena_t	*a;
+	void	*p;
+{
+	bzero(p, ARENA_MIN << c);
+	*(void **) p = a->free[c];
+	a->free[c] = p;
+}
+
+/*
+ * Return size bytes of zeroed memory from a.
+ */
+void *
+arena_alloc(a, size)
+	arena_t	*a;
+	size_t	 size;
+{
+	if (size > ARENA_MAX)
+		return arena_alloc_big(a, size);
+	return arena_alloc_class(a, arena_class(size));
+}
+
+/*
+ * Zero and release p, which was allocated from a with the same size.
+ */
+void
+arena_release(a, p, size)
+	arena_t	*a;
+	void	*p;
+	size_t	 size;
+{
+	if (p == NULL)
+		return;
+
+	if (size > ARENA_MAX)
+		arena_release_big(a, p);
+	else
+		arena_release_class(a, p, arena_class(size));
+}
+
+char *
+arena_strdup(a, s)
+	arena_t		*a;
+	char const	*s;
+{
+size_t	 len = strlen(s) + 1;
+char	*p;
+
+	if (len + 1 > ARENA_MAX) {
+		p = arena_alloc_big(a, len + 1);
+		*p = ARENA_BIGSTR;
+	} else {
+		p = arena_alloc_class(a, arena_class(len + 1));
+		*p = arena_class(len + 1);
+	}
+
+	memcpy(p + 1, s, len);
+	return p + 1;
+}
+
+void
+arena_strfree(a, s)
+	arena_t	*a;
+	char	*s;
+{
+unsigned char	*p;
+
+	if (s == NULL)
+		return;
+
+	p = (unsigned char *) s - 1;
+	if (*p == ARENA_BIGSTR)
+		arena_release_big(a, p);
+	else
+		arena_release_class(a, p, *p);
+}
+
+/*
+ * Zero and release everything allocated from a, leaving it empty.
+ */
+void
+arena_free(a)
+	arena_t	*a;
+{
+arena_chunk_t	*ch, *next;
+
+	for (ch = a->chunks; ch; ch = next) {
+		next = ch->next;
+		arena_unmap(ch);
+	}
+
+	for (ch = a->big; ch; ch = next) {
+		next = ch->next;
+		arena_unmap(ch);
+	}
+
+	bzero(a, sizeof(*a));
+}
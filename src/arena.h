@@ -0,0 +1,56 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef	PWMAN_ARENA_H
+#define	PWMAN_ARENA_H
+
+/*
+ * An arena holds many small allocations in a few large chunks, which are
+ * locked in memory where possible.  Allocations are rounded up to a size
+ * class; anything released is zeroed and kept for reuse within its class.
+ * arena_free() zeroes and unmaps everything at once.
+ *
+ * A zeroed arena_t is an empty arena.
+ */
+
+#define	ARENA_CHUNK	(1024 * 1024)
+#define	ARENA_MIN	16			/* the smallest size class */
+#define	ARENA_NCLASSES	9			/* 16 .. 4096 bytes */
+#define	ARENA_MAX	(ARENA_MIN << (ARENA_NCLASSES - 1))
+
+typedef struct arena_chunk {
+	struct arena_chunk	*next;
+	size_t			 size;
+} arena_chunk_t;
+
+typedef struct arena {
+	arena_chunk_t	*chunks;
+	char		*next, *end;	/* what's left of the newest chunk */
+	void		*free[ARENA_NCLASSES];
+	arena_chunk_t	*big;		/* allocations over ARENA_MAX */
+} arena_t;
+
+void	*arena_alloc(arena_t *, size_t);
+void	 arena_release(arena_t *, void *, size_t);
+char	*arena_strdup(arena_t *, char const *);
+void	 arena_strfree(arena_t *, char *);
+void	 arena_free(arena_t *);
+
+#endif	/* !PWMAN_ARENA_H */
@@ -24,6 +24,7 @@
 
 #include	"pwman.h"
 #include	"ui.h"
+#include	"match.h"
 
 #define	FIL_NONE	(-1)
 #define	FIL_NAME	0
@@ -41,27 +42,11 @@ filter_t       *new;
 	return new;
 }
 
-/*
- * String checking only case insensitive using gnu glibc
- */
-static char*
-filter_strcasestr(haystack, needle)
-	char const	*haystack, *needle;
-{
-	/* Never matches if null/empty string given */
-	if (haystack == NULL) {
-		return 0;
-	}
-	if (strlen(haystack) == 0) {
-		return 0;
-	}
+/* The filter string, ready to match */
+static match_t	filter_match;
 
-#ifdef HAVE_STRCASESTR
-	return (char *)strcasestr(haystack, needle);
-#else
-	return (char *)strstr(haystack, needle);
-#endif
-}
+/* Lists whose visible_gen doesn't match this need filtering again */
+static unsigned	filter_gen = 1;
 
 int
 filter_apply(pw, fil)
@@ -80,31 +65,81 @@ char const	*field;
 
 	switch (fil->field) {
 	case FIL_NAME:
-		field = pw->name;
+		field = PW_FIELD(pw, PW_NAME);
 		break;
 
 	case FIL_HOST:
-		field = pw->host;
+		field = PW_FIELD(pw, PW_HOST);
 		break;
 
 	case FIL_USER:
-		field = pw->user;
+		field = PW_FIELD(pw, PW_USER);
 		break;
 
 	case FIL_LAUNCH:
-		field = pw->launch;
+		field = PW_FIELD(pw, PW_LAUNCH);
 		break;
 
 	default:
 		return 0;
 	}
 
-	if (filter_strcasestr(field, fil->filter))
+	match_set(&filter_match, fil->filter);
+	if (match_find(&filter_match, field))
 		return 1;
 
 	return 0;
 }
 
+/*
+ * Called when something changes that could change what a list shows: the
+ * filter, the search results, or the entries or sublists of any list.
+ */
+void
+filter_invalidate()
+{
+	filter_gen++;
+}
+
+/*
+ * Changes whenever filter_invalidate() is called, so the list view can tell
+ * when it needs rebuilding.
+ */
+unsigned
+filter_generation()
+{
+	return filter_gen;
+}
+
+/*
+ * Return the entries in list that the filter shows, in order.  The result is
+ * kept until filter_invalidate() is next called.
+ */
+password_t **
+filter_visible(list, n)
+	folder_t	*list;
+	size_t		*n;
+{
+password_t	*pw;
+uint32_t	 i;
+
+	if (list->visible_gen != filter_gen) {
+		free(list->visible);
+		list->visible = xmalloc((list->list.n ? list->list.n : 1) *
+					sizeof(*list->visible));
+		list->nvisible = 0;
+
+		PWLIST_FOREACH(pw, &list->list, i)
+			if (filter_apply(pw, options->filter))
+				list->visible[list->nvisible++] = pw;
+
+		list->visible_gen = filter_gen;
+	}
+
+	*n = list->nvisible;
+	return list->visible;
+}
+
 void
 filter_get()
 {
@@ -133,12 +168,14 @@ char		c;
 		options->filter->field = FIL_NONE;
 		free(options->filter->filter);
 		options->filter->filter = NULL;
+		filter_invalidate();
 
 		uilist_refresh();
 		return;
 	}
 
 	options->filter->filter = ui_ask_str("String to search for: ", NULL);
+	filter_invalidate();
 
 	current_pw_sublist->current_item = -1;
 	uilist_refresh();
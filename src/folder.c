@@ -29,15 +29,76 @@
 #include	<libxml/parser.h>
 
 #include	"pwman.h"
+#include	"arena.h"
 #include	"gnupg.h"
+#include	"saver.h"
+#include	"journal.h"
+#include	"pwdb.h"
+#include	"trigram.h"
 #include	"ui.h"
 
-static int	folder_read(xmlNodePtr parent, folder_t *parent_list);
 static void	folder_free(folder_t *old);
-static void	folder_write(xmlNodePtr parent, folder_t *list);
-static void	folder_read_node(xmlNodePtr parent, folder_t *list);
-static void	folder_write_node(xmlNodePtr root, password_t *pw);
+static void	folder_write(FILE *fp, folder_t *list, int depth);
+static void	folder_write_node(FILE *fp, password_t *pw, int depth);
+static int	folder_write_doc(FILE *fp, void *arg);
+static int	folder_write_db(FILE *fp, void *arg);
 static int	folder_do_export(folder_t *folder, password_t *pw);
+static int	folder_load(char const *file, char const *root_name, folder_t *into,
+			    folder_t **ret, int *binary);
+
+/*
+ * State for the streaming loader.  The decrypted data is fed to a libxml2 push
+ * parser (or the binary reader) as it comes out of gpg, and the callbacks
+ * below build the folder tree directly, so the plaintext is never held in
+ * memory as a whole.
+ */
+typedef struct folder_loader {
+	xmlParserCtxtPtr pctxt;		/* XML parser, or NULL */
+	pwdb_reader_t	*pwdb;		/* binary reader, or NULL */
+	int		 binary;	/* the file is in the binary format */
+	char		 head[PWDB_MAGIC_LEN];	/* held until the format is known */
+	size_t		 headlen;
+
+	char const	*root_name;	/* expected document element */
+	int		 depth;		/* current element depth */
+	int		 skip;		/* depth of an ignored subtree, or 0 */
+	int		 done;		/* the top-level list/item has been read */
+	int		 error;
+
+	folder_t	*into;		/* import into this folder, or NULL */
+	folder_t	*top;		/* top-level list read from the file */
+	folder_t	*cur;		/* list currently being read */
+	password_t	*pw;		/* entry currently being read */
+	int		 field;		/* field of pw receiving text, or -1 */
+
+	char		*text;		/* text of the current field */
+	size_t		 textlen, textsize;
+} folder_loader_t;
+
+/*
+ * What folder_write_doc() should write: the document element, and either a
+ * list or a single entry below it.
+ */
+typedef struct folder_doc {
+	char const	*root_name;
+	folder_t	*list;
+	password_t	*pw;
+} folder_doc_t;
+
+static void	folder_load_start(void *ctx, xmlChar const *name, xmlChar const *prefix,
+			    xmlChar const *uri, int nns, xmlChar const **ns,
+			    int nattrs, int ndefaulted, xmlChar const **attrs);
+static void	folder_load_end(void *ctx, xmlChar const *name, xmlChar const *prefix,
+			    xmlChar const *uri);
+static void	folder_load_text(void *ctx, xmlChar const *text, int len);
+static int	folder_load_chunk(void *ctx, char const *buf, size_t len);
+static void    *folder_load_list(void *arg, void *parent, char const *name, int id);
+static void	folder_load_entry(void *arg, void *list, int id, char const **fields);
+
+static pwdb_ops_t const folder_pwdb_ops = {
+	folder_load_list,
+	folder_load_entry,
+};
 
 #if 0
 static int 
@@ -46,16 +107,351 @@ folder_add(folder_t *parent, char const *name, char const *host,
 
 #endif
 
+/* The highest entry and list ids given out so far */
 static int	pwindex = 0;
+static int	listindex = 0;
+
+/* Holds the lists and entries, and their strings */
+static arena_t	folder_arena;
+
+/*
+ * Allocate size bytes of zeroed memory for the tree.
+ */
+void *
+folder_alloc(size)
+	size_t	size;
+{
+	return arena_alloc(&folder_arena, size);
+}
+
+void
+folder_release(p, size)
+	void	*p;
+	size_t	 size;
+{
+	arena_release(&folder_arena, p, size);
+}
+
+/*
+ * Replace the tree string *field with a copy of value, which may be NULL.
+ */
+void
+folder_setstr(field, value)
+	char		**field;
+	char const	 *value;
+{
+char	*old = *field;
+
+	*field = value ? arena_strdup(&folder_arena, value) : NULL;
+	arena_strfree(&folder_arena, old);
+}
+
+static uint32_t
+folder_name_hash(name)
+	char const	*name;
+{
+uint32_t	h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (unsigned char) *name) * 16777619U;
+	return h;
+}
+
+static void
+folder_name_insert(parent, list)
+	folder_t	*parent, *list;
+{
+folder_t	**slot;
+
+	slot = &parent->names[folder_name_hash(list->name) & (parent->namesize - 1)];
+	list->nextname = *slot;
+	*slot = list;
+}
+
+/*
+ * Add list, which has just become one of parent's children, to parent's
+ * table of names.
+ */
+static void
+folder_name_add(parent, list)
+	folder_t	*parent, *list;
+{
+folder_t	 *iter;
+
+	if (parent->nsublists * 2 > parent->namesize) {
+		folder_release(parent->names, parent->namesize * sizeof(*parent->names));
+		parent->namesize = parent->namesize ? parent->namesize * 2 : 8;
+		parent->names = folder_alloc(parent->namesize * sizeof(*parent->names));
+
+		for (iter = parent->sublists; iter; iter = iter->next)
+			if (iter != list)
+				folder_name_insert(parent, iter);
+	}
+
+	folder_name_insert(parent, list);
+}
+
+static void
+folder_name_remove(parent, list)
+	folder_t	*parent, *list;
+{
+folder_t	**slot;
+
+	slot = &parent->names[folder_name_hash(list->name) & (parent->namesize - 1)];
+	for (; *slot; slot = &(*slot)->nextname) {
+		if (*slot == list) {
+			*slot = list->nextname;
+			break;
+		}
+	}
+	list->nextname = NULL;
+}
+
+/*
+ * Return the child of parent called name.  If several have that name, it
+ * returns one of them.
+ */
+folder_t *
+folder_find_sublist(parent, name)
+	folder_t	*parent;
+	char const	*name;
+{
+folder_t	*iter;
+
+	if (parent->namesize == 0)
+		return NULL;
+
+	for (iter = parent->names[folder_name_hash(name) & (parent->namesize - 1)];
+	     iter; iter = iter->nextname)
+		if (strcmp(iter->name, name) == 0)
+			return iter;
+	return NULL;
+}
+
+static void
+folder_entname_insert(list, pw)
+	folder_t	*list;
+	password_t	*pw;
+{
+uint32_t	*slot;
+
+	slot = &list->entnames[folder_name_hash(PW_FIELD(pw, PW_NAME)) & (list->entsize - 1)];
+	PW_ENT(pw)->nextname = *slot;
+	*slot = pw->num + 1;
+}
+
+/*
+ * Add pw, which is in list, to list's table of entry names.
+ */
+void
+folder_index_pw(list, pw)
+	folder_t	*list;
+	password_t	*pw;
+{
+password_t	*iter;
+uint32_t	 i;
+
+	if (++list->nentries * 2 > list->entsize) {
+		folder_release(list->entnames, list->entsize * sizeof(*list->entnames));
+		list->entsize = list->entsize ? list->entsize * 2 : 8;
+		list->entnames = folder_alloc(list->entsize * sizeof(*list->entnames));
+
+		PWLIST_FOREACH(iter, &list->list, i)
+			if (iter != pw)
+				folder_entname_insert(list, iter);
+	}
+
+	folder_entname_insert(list, pw);
+}
+
+void
+folder_unindex_pw(list, pw)
+	folder_t	*list;
+	password_t	*pw;
+{
+uint32_t	*slot;
+
+	slot = &list->entnames[folder_name_hash(PW_FIELD(pw, PW_NAME)) & (list->entsize - 1)];
+	for (; *slot; slot = &PW_ENT(pwstore_table[*slot - 1])->nextname) {
+		if (*slot == pw->num + 1) {
+			*slot = PW_ENT(pw)->nextname;
+			list->nentries--;
+			break;
+		}
+	}
+	PW_ENT(pw)->nextname = 0;
+}
+
+/*
+ * Return the entry in list called name.  If several have that name, it
+ * returns one of them.
+ */
+password_t *
+folder_find_entry(list, name)
+	folder_t	*list;
+	char const	*name;
+{
+password_t	*iter;
+uint32_t	 n;
+
+	if (list->entsize == 0)
+		return NULL;
+
+	for (n = list->entnames[folder_name_hash(name) & (list->entsize - 1)];
+	     n; n = PW_ENT(iter)->nextname) {
+		iter = pwstore_table[n - 1];
+		if (strcmp(PW_FIELD(iter, PW_NAME), name) == 0)
+			return iter;
+	}
+	return NULL;
+}
+
+/*
+ * Find what path names, below top.  A path is the names of the lists leading
+ * to a list or an entry, separated by slashes; a slash or backslash in a
+ * name is written with a backslash before it.  If the last name is both an
+ * entry and a list, the entry is found, unless the path ends with a slash.
+ *
+ * On success, *list is the list found, or the entry's list, and *entry is
+ * the entry or NULL.  Returns -1 if there's nothing at path.
+ */
+int
+folder_lookup(top, path, list, entry)
+	folder_t	 *top, **list;
+	char const	 *path;
+	password_t	**entry;
+{
+char		*name, *p;
+folder_t	*cur = top, *sub;
+password_t	*pw = NULL;
+int		 ret = -1;
+
+	name = xmalloc(strlen(path) + 1);
+
+	while (cur) {
+		while (*path == '/')
+			path++;
+		if (!*path) {
+			ret = 0;
+			break;
+		}
+
+		for (p = name; *path && *path != '/'; path++) {
+			if (*path == '\\' && path[1])
+				path++;
+			*p++ = *path;
+		}
+		*p = '\0';
+
+		sub = folder_find_sublist(cur, name);
+
+		/* Only the last name can be an entry, if no slash follows it */
+		if (!*path && (pw = folder_find_entry(cur, name)) != NULL) {
+			ret = 0;
+			break;
+		}
+
+		cur = sub;
+	}
+
+	free(name);
+	if (ret == 0) {
+		*list = cur;
+		*entry = pw;
+	}
+	return ret;
+}
+
+/*
+ * Return the path of entry, or of list if entry is NULL, as folder_lookup()
+ * takes it from the top-level list.
+ */
+char *
+folder_path(list, entry)
+	folder_t	*list;
+	password_t	*entry;
+{
+folder_t	 *iter;
+char const	**names, *q;
+char		 *path, *p;
+size_t		  len = 1, n = 0, i;
+
+	if (entry)
+		list = entry->parent;
+
+	for (iter = list; iter && iter->parent; iter = iter->parent)
+		n++;
+	names = xcalloc(n + 1, sizeof(*names));
+
+	/* The names from the top down, then the entry's */
+	for (iter = list, i = n; i > 0; iter = iter->parent)
+		names[--i] = iter->name;
+	if (entry)
+		names[n++] = PW_FIELD(entry, PW_NAME);
+
+	for (i = 0; i < n; i++)
+		for (q = names[i], len++; *q; q++)
+			len += (*q == '/' || *q == '\\') ? 2 : 1;
+
+	path = p = xmalloc(len);
+	for (i = 0; i < n; i++) {
+		*p++ = '/';
+		for (q = names[i]; *q; q++) {
+			if (*q == '/' || *q == '\\')
+				*p++ = '\\';
+			*p++ = *q;
+		}
+	}
+	*p = '\0';
+
+	free(names);
+	return path;
+}
+
+/* Put list among parent's children, before before, or last */
+static void
+folder_link(parent, list, before)
+	folder_t	*parent, *list, *before;
+{
+	list->next = before;
+	list->prev = before ? before->prev : parent->lastsub;
+
+	if (list->prev)
+		list->prev->next = list;
+	else
+		parent->sublists = list;
+
+	if (before)
+		before->prev = list;
+	else
+		parent->lastsub = list;
+}
+
+static void
+folder_unlink(parent, list)
+	folder_t	*parent, *list;
+{
+	if (list->prev)
+		list->prev->next = list->next;
+	else
+		parent->sublists = list->next;
+
+	if (list->next)
+		list->next->prev = list->prev;
+	else
+		parent->lastsub = list->prev;
+
+	list->next = list->prev = NULL;
+}
 
 folder_t *
 folder_new(char const *name)
 {
 folder_t       *ret;
 
-	ret = xcalloc(1, sizeof(*ret));
-	ret->name = xstrdup(name);
-	PWLIST_INIT(&ret->list);
+	ret = folder_alloc(sizeof(*ret));
+	ret->id = ++listindex;
+	folder_setstr(&ret->name, name);
 	debug("new_folder: %s", name);
 
 	return ret;
@@ -65,6 +461,7 @@ int
 folder_init()
 {
 	pwindex = 0;
+	listindex = 0;
 	folder = NULL;
 	current_pw_sublist = NULL;
 	return 0;
@@ -73,29 +470,45 @@ folder_init()
 static void
 folder_free(folder_t *old)
 {
-password_t     *current, *next;
-folder_t       *curlist, *nlist;
-
-	if (!old)
-		return;
-
-	PWLIST_FOREACH_SAFE(current, &old->list, next)
-		pw_free(current);
-
-	for (curlist = old->sublists; curlist != NULL; curlist = nlist) {
-		nlist = curlist->next;
-		folder_free(curlist);
+folder_iter_t	it;
+folder_t       *list;
+
+	folder_iter_init(&it, old, FOLDER_LEAVE);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		/* From the end, so nothing has to move up */
+		while (list->list.n)
+			pw_free(list->list.ents[list->list.n - 1].pw);
+
+		folder_setstr(&list->name, NULL);
+		free(list->visible);
+		folder_release(list->names, list->namesize * sizeof(*list->names));
+		folder_release(list->entnames, list->entsize * sizeof(*list->entnames));
+		folder_release(list, sizeof(*list));
 	}
-
-	free(old->name);
-	free(old);
-	old = NULL;
 }
 
+/*
+ * Free the whole tree.  Everything but the filter's caches is in the arena,
+ * so it all goes at once.
+ */
 int
 folder_free_all()
 {
-	folder_free(folder);
+folder_iter_t	it;
+folder_t       *list;
+
+	trigram_clear();
+	filter_invalidate();
+
+	if (folder) {
+		folder_iter_init(&it, folder, FOLDER_ENTER);
+		while ((list = folder_iter_next(&it)) != NULL)
+			free(list->visible);
+	}
+
+	arena_free(&folder_arena);
+	pwstore_clear();
+	folder = current_pw_sublist = NULL;
 	return 0;
 }
 
@@ -104,28 +517,18 @@ folder_change_item_order(pw, parent, moveUp)
 	password_t	*pw;
 	folder_t	*parent;
 {
-password_t	*swap;
+uint32_t	other;
 	
 	assert(pw);
 	assert(parent);
 
-	if (moveUp) {
-		swap = PWLIST_PREV(pw, &parent->list);
-
-		if (!swap)
-			return 0;
-
-		PWLIST_REMOVE(&parent->list, pw);
-		PWLIST_INSERT_BEFORE(&parent->list, swap, pw);
-		return 1;
-	}
-
-	swap = PWLIST_NEXT(pw);
-	if (!swap)
+	if (moveUp ? pw->slot == 0 : pw->slot + 1 >= parent->list.n)
 		return 0;
 
-	PWLIST_REMOVE(&parent->list, pw);
-	PWLIST_INSERT_AFTER(&parent->list, swap, pw);
+	other = moveUp ? pw->slot - 1 : pw->slot + 1;
+	pwstore_swap(pw, parent->list.ents[other].pw);
+	filter_invalidate();
+	journal_invalidate();
 	return 1;
 }
 
@@ -133,73 +536,21 @@ int
 folder_change_list_order(pw, moveUp)
 	folder_t	*pw;
 {
-	/* Grab the parent, assuming there is one */
-folder_t       *parent = pw->parent;
-folder_t       *iter = NULL;
-folder_t       *pprev = NULL;
-folder_t       *prev = NULL;
-folder_t       *next = NULL;
-folder_t       *nnext = NULL;
+folder_t       *parent = pw->parent, *other;
 
 	if (parent == NULL)
 		return 0;
 
-	/* Find us, in our parents list of children */
-	for (iter = parent->sublists; iter != NULL; iter = iter->next) {
-		if (iter == pw) {
-			/* Grab the next one, and the one after */
-			next = pw->next;
-
-			if (next != NULL)
-				nnext = next->next;
-			else
-				nnext = NULL;
-
-
-			/* Which way do we need to shuffle? */
-			if (moveUp) {
-				/* Up the list, if we can */
-				if (prev == NULL)
-					break;
-
-				/* Are we going to the top? */
-				if (prev == parent->sublists) {
-					parent->sublists = pw;
-					pw->next = prev;
-					prev->next = next;
-				} else {
-					pprev->next = pw;
-					pw->next = prev;
-					prev->next = next;
-				}
-
-				return 1;
-			} else {
-				/* Down the list, if we can */
-				if (next == NULL)
-					break;
+	/* Swap places with the list before or after us, if there is one */
+	if ((other = moveUp ? pw->prev : pw->next) == NULL)
+		return 0;
 
-				/* Were we at the top? */
-				if (pw == parent->sublists) {
-					parent->sublists = next;
-					next->next = pw;
-					pw->next = nnext;
-				} else {
-					prev->next = next;
-					next->next = pw;
-					pw->next = nnext;
-				}
-
-				return 1;
-			}
-		} else {
-			/* Update the running list of prev and pprev */
-			pprev = prev;
-			prev = iter;
-		}
-	}
+	folder_unlink(parent, pw);
+	folder_link(parent, pw, moveUp ? other : other->next);
 
-	return 0;
+	filter_invalidate();
+	journal_invalidate();
+	return 1;
 }
 
 void
@@ -207,8 +558,12 @@ folder_rename_sublist(list, new_name)
 	folder_t	*list;
 	char const	*new_name;
 {
-	free(list->name);
-	list->name = xstrdup(new_name);
+	if (list->parent)
+		folder_name_remove(list->parent, list);
+	folder_setstr(&list->name, new_name);
+	if (list->parent)
+		folder_name_insert(list->parent, list);
+	journal_put_list(list);
 }
 
 void
@@ -216,24 +571,18 @@ folder_add_sublist(parent, new)
 	folder_t	*parent;
 	folder_t	*new;
 {
-folder_t       *current;
-
-	current = parent->sublists;
 	new->parent = parent;
 	new->current_item = 1;
 
-	if (current == NULL) {
-		debug("add_pw_sublist: current = NULL");
-		parent->sublists = new;
-		new->next = NULL;
-		return;
-	}
+	if (new->id > listindex)
+		listindex = new->id;
 
-	while (current->next != NULL)
-		current = current->next;
+	folder_link(parent, new, NULL);
+	parent->nsublists++;
+	folder_name_add(parent, new);
 
-	current->next = new;
-	new->next = NULL;
+	filter_invalidate();
+	journal_put_list(new);
 }
 
 void
@@ -244,8 +593,18 @@ folder_add_pw(list, new)
 	assert(list);
 	assert(new);
 
-	PWLIST_INSERT_TAIL(&list->list, new);
-	new->parent = list;
+	pwstore_attach(list, new);
+
+	/* Entries keep their id for life, including across moves */
+	if (PW_ENT(new)->id == 0)
+		PW_ENT(new)->id = ++pwindex;
+	else if (PW_ENT(new)->id > pwindex)
+		pwindex = PW_ENT(new)->id;
+
+	folder_index_pw(list, new);
+	trigram_add(new);
+	filter_invalidate();
+	journal_put_entry(new);
 }
 
 void
@@ -256,109 +615,219 @@ folder_detach_pw(list, pw)
 	assert(list);
 	assert(pw);
 
-	PWLIST_REMOVE(&list->list, pw);
-	pw->parent = NULL;
+	folder_unindex_pw(list, pw);
+	pwstore_detach(pw);
+	filter_invalidate();
 }
 
 void
 folder_detach_sublist(parent, old)
 	folder_t	*parent, *old;
 {
-folder_t       *iter, *prev;
-
-	prev = NULL;
-	for (iter = parent->sublists; iter != NULL; iter = iter->next) {
-		if (iter == old) {
-			if (prev == NULL)
-				parent->sublists = iter->next;
-			else
-				prev->next = iter->next;
+	if (old->parent != parent)
+		return;
 
-			break;
-		}
-		prev = iter;
-	}
+	folder_name_remove(parent, old);
+	folder_unlink(parent, old);
+	parent->nsublists--;
+	filter_invalidate();
 }
 
 void
 folder_delete_sublist(parent, old)
 	folder_t	*parent, *old;
 {
-folder_t       *iter, *prev;
+	if (old->parent != parent)
+		return;
+
+	folder_detach_sublist(parent, old);
+	journal_del_list(old);
+	folder_free(old);
+}
+
+/*
+ * Write str to fp, escaped for use as XML character data (or as an attribute
+ * value, if attr is set).  The escaping is the same as libxml2 uses when it
+ * saves a document without a declared encoding, so the file is byte for byte
+ * what xmlDocFormatDump() used to produce.
+ */
+static void
+folder_write_escaped(fp, str, attr)
+	FILE		*fp;
+	char const	*str;
+{
+unsigned char const	*p, *run;
+unsigned		 c;
+int			 n;
+
+	if (!str)
+		return;
+
+	for (p = run = (unsigned char const *)str; *p; ) {
+		if (*p >= 0x20 && *p < 0x80 && *p != '<' && *p != '>' && *p != '&'
+		    && (*p != '"' || !attr)) {
+			p++;
+			continue;
+		}
+
+		if ((*p == '\t' || *p == '\n') && !attr) {
+			p++;
+			continue;
+		}
 
-	prev = NULL;
-	for (iter = parent->sublists; iter != NULL; iter = iter->next) {
-		if (iter == old) {
-			if (prev == NULL)
-				parent->sublists = iter->next;
-			else
-				prev->next = iter->next;
+		fwrite(run, 1, p - run, fp);
+
+		switch (*p) {
+		case '<':	fputs("&lt;", fp);	p++; break;
+		case '>':	fputs("&gt;", fp);	p++; break;
+		case '&':	fputs("&amp;", fp);	p++; break;
+		case '"':	fputs("&quot;", fp);	p++; break;
+		case '\t':	fputs("&#9;", fp);	p++; break;
+		case '\n':	fputs("&#10;", fp);	p++; break;
+		case '\r':	fputs(attr ? "&#13;" : "&#xD;", fp); p++; break;
+
+		default:
+			/* Decode a UTF-8 sequence into a character reference */
+			if (*p >= 0xF0 && *p <= 0xF4) {
+				c = *p & 0x07;
+				n = 3;
+			} else if (*p >= 0xE0) {
+				c = *p & 0x0F;
+				n = 2;
+			} else if (*p >= 0xC2) {
+				c = *p & 0x1F;
+				n = 1;
+			} else
+				n = -1;
+
+			for (p++; n > 0; n--, p++) {
+				if ((*p & 0xC0) != 0x80)
+					break;
+				c = (c << 6) | (*p & 0x3F);
+			}
 
-			folder_free(iter);
+			/* Invalid UTF-8 or control characters aren't allowed */
+			if (n != 0 || c < 0x80 || (c >= 0xD800 && c <= 0xDFFF) ||
+			    c == 0xFFFE || c == 0xFFFF || c > 0x10FFFF)
+				c = 0xFFFD;
+
+			fprintf(fp, "&#x%X;", c);
 			break;
 		}
-		prev = iter;
+
+		run = p;
 	}
+
+	fwrite(run, 1, p - run, fp);
 }
 
 static void
-folder_write_node(root, pw)
-	xmlNodePtr	root;
-	password_t	*pw;
+folder_write_field(fp, name, value, depth)
+	FILE		*fp;
+	char const	*name, *value;
 {
-xmlNodePtr	node;
+	fprintf(fp, "%*s", depth * 2, "");
 
-	/* We need to escape the strings before storing them */
-	/* Otherwise, special characters (especially &) will */
-	/* end up broken! */
-xmlChar        *escapedName = xmlEncodeSpecialChars(root->doc, (xmlChar *) pw->name);
-xmlChar        *escapedHost = xmlEncodeSpecialChars(root->doc, (xmlChar *) pw->host);
-xmlChar        *escapedUser = xmlEncodeSpecialChars(root->doc, (xmlChar *) pw->user);
-xmlChar        *escapedPasswd = xmlEncodeSpecialChars(root->doc, (xmlChar *) pw->passwd);
-xmlChar        *escapedLaunch = xmlEncodeSpecialChars(root->doc, (xmlChar *) pw->launch);
+	if (!value || !*value) {
+		fprintf(fp, "<%s/>\n", name);
+		return;
+	}
 
-	/* Build the entry and add in our (escaped) contents */
-	node = xmlNewChild(root, NULL, (xmlChar const *)"PwItem", NULL);
+	fprintf(fp, "<%s>", name);
+	folder_write_escaped(fp, value, 0);
+	fprintf(fp, "</%s>\n", name);
+}
 
-	xmlNewChild(node, NULL, (xmlChar const *)"name", escapedName);
-	xmlNewChild(node, NULL, (xmlChar const *)"host", escapedHost);
-	xmlNewChild(node, NULL, (xmlChar const *)"user", escapedUser);
-	xmlNewChild(node, NULL, (xmlChar const *)"passwd", escapedPasswd);
-	xmlNewChild(node, NULL, (xmlChar const *)"launch", escapedLaunch);
+static void
+folder_write_node(fp, pw, depth)
+	FILE		*fp;
+	password_t	*pw;
+{
+	fprintf(fp, "%*s<PwItem>\n", depth * 2, "");
 
-	/* Finally, we need to free all our escaped versions now we're done */
-	xmlFree(escapedName);
-	xmlFree(escapedHost);
-	xmlFree(escapedUser);
-	xmlFree(escapedPasswd);
-	xmlFree(escapedLaunch);
+	folder_write_field(fp, "name", PW_FIELD(pw, PW_NAME), depth + 1);
+	folder_write_field(fp, "host", PW_FIELD(pw, PW_HOST), depth + 1);
+	folder_write_field(fp, "user", PW_FIELD(pw, PW_USER), depth + 1);
+	folder_write_field(fp, "passwd", PW_FIELD(pw, PW_PASSWD), depth + 1);
+	folder_write_field(fp, "launch", PW_FIELD(pw, PW_LAUNCH), depth + 1);
+
+	fprintf(fp, "%*s</PwItem>\n", depth * 2, "");
 }
 
 static void
-folder_write(parent, list)
-	xmlNodePtr	parent;
-	folder_t	*list;
+folder_write(fp, top, depth)
+	FILE		*fp;
+	folder_t	*top;
 {
-xmlNodePtr	node;
+folder_iter_t	it;
 password_t     *iter;
-folder_t       *pwliter;
+folder_t       *list;
+uint32_t	i;
+int		d;
+
+	folder_iter_init(&it, top, FOLDER_ENTER | FOLDER_LEAVE);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		d = depth + it.depth;
+
+		if (PWLIST_EMPTY(&list->list) && list->sublists == NULL) {
+			if (it.event == FOLDER_ENTER) {
+				fprintf(fp, "%*s<PwList name=\"", d * 2, "");
+				folder_write_escaped(fp, list->name, 1);
+				fputs("\"/>\n", fp);
+			}
+			continue;
+		}
+
+		if (it.event == FOLDER_LEAVE) {
+			fprintf(fp, "%*s</PwList>\n", d * 2, "");
+			continue;
+		}
+
+		fprintf(fp, "%*s<PwList name=\"", d * 2, "");
+		folder_write_escaped(fp, list->name, 1);
+		fputs("\">\n", fp);
+
+		PWLIST_FOREACH(iter, &list->list, i)
+			folder_write_node(fp, iter, d + 1);
+	}
+}
+
+/*
+ * Serialise a document straight into fp, which is gpg's standard input.
+ */
+static int
+folder_write_doc(fp, arg)
+	FILE	*fp;
+	void	*arg;
+{
+folder_doc_t	*doc = arg;
 
-	node = xmlNewChild(parent, NULL, (xmlChar const *)"PwList", NULL);
-	xmlSetProp(node, (xmlChar const *)"name", (xmlChar *) list->name);
+	fprintf(fp, "<?xml version=\"1.0\"?>\n<%s version=\"%d\">\n",
+		doc->root_name, FF_XML_VERSION);
 
-	PWLIST_FOREACH(iter, &list->list)
-		folder_write_node(node, iter);
+	if (doc->list)
+		folder_write(fp, doc->list, 1);
+	else
+		folder_write_node(fp, doc->pw, 1);
 
-	for (pwliter = list->sublists; pwliter != NULL; pwliter = pwliter->next)
-		folder_write(node, pwliter);
+	fprintf(fp, "</%s>\n", doc->root_name);
+	return ferror(fp) ? -1 : 0;
 }
 
+static int
+folder_write_db(fp, arg)
+	FILE	*fp;
+	void	*arg;
+{
+	return pwdb_write(fp, arg);
+}
+
+/*
+ * Write the database now, asking the user what to do if it can't be.
+ */
 int
 folder_write_file()
 {
-char		vers[5];
-xmlDocPtr	doc;
-xmlNodePtr	root;
 char		tfile[PATH_MAX];
 
 	if (options->readonly)
@@ -370,103 +839,545 @@ char		tfile[PATH_MAX];
 		return -1;
 	}
 
-	snprintf(vers, 5, "%d", FF_VERSION);
-	doc = xmlNewDoc((xmlChar const *)"1.0");
+	/* Don't let a queued save land on top of this one */
+	saver_flush();
+	saver_failed();
 
-	root = xmlNewDocNode(doc, NULL, (xmlChar const *)"PWMan_PasswordList", NULL);
+	snprintf(tfile, sizeof(tfile), "%s.tmp", options->password_file);
+	if (gnupg_write(folder_write_db, folder, options->gpg_id, tfile) == 0 &&
+	    rename(tfile, options->password_file) == 0) {
+		journal_remove(options->password_file);
+		journal_restart();
+	}
 
-	xmlSetProp(root, (xmlChar const *)"version", (xmlChar *) vers);
-	folder_write(root, folder);
+	return 0;
+}
+
+static int
+folder_save_buf(fp, arg)
+	FILE	*fp;
+	void	*arg;
+{
+saver_job_t	*job = arg;
 
-	xmlDocSetRootElement(doc, root);
+	fwrite(job->buf, 1, job->len, fp);
+	return ferror(fp) ? -1 : 0;
+}
 
-	snprintf(tfile, sizeof(tfile), "%s.tmp", options->password_file);
-	if (gnupg_write(doc, options->gpg_id, tfile) == 0)
-		rename(tfile, options->password_file);
+/* Run by the saver */
+static int
+folder_save_db(job)
+	saver_job_t	*job;
+{
+char	tfile[PATH_MAX];
+
+	snprintf(tfile, sizeof(tfile), "%s.tmp", job->file);
+	if (gnupg_write_batch(folder_save_buf, job, job->id, tfile) != 0 ||
+	    rename(tfile, job->file) == -1)
+		return -1;
 
-	xmlFreeDoc(doc);
+	journal_remove(job->file);
 	return 0;
 }
 
+/*
+ * Write the database in the background.  The tree is serialised now, and
+ * encrypted by the saver while the user carries on.
+ */
+int
+folder_save()
+{
+FILE	*fp;
+char	*buf = NULL;
+size_t	 len = 0;
+
+	if (options->readonly)
+		return 0;
+
+	if (!folder)
+		return folder_write_file();
+
+	if ((fp = open_memstream(&buf, &len)) == NULL)
+		return folder_write_file();
+
+	if (pwdb_write(fp, folder) != 0) {
+		fclose(fp);
+		bzero(buf, len);
+		free(buf);
+		return folder_write_file();
+	}
+	fclose(fp);
+
+	if (saver_queue(SAVER_DB, folder_save_db, options->password_file,
+			(unsigned char *) buf, len) != 0) {
+		bzero(buf, len);
+		free(buf);
+		return folder_write_file();
+	}
+
+	/* Later changes are journaled against what was just queued */
+	journal_restart();
+	pwstore_compact();
+	return 0;
+}
+
+/*
+ * Save any changes made since the last write, to the journal if possible.
+ */
+int
+folder_write_changes()
+{
+unsigned char	*buf;
+size_t		 len;
+
+	if (options->readonly)
+		return 0;
+
+	/* Something didn't get saved, so save it all again */
+	if (saver_failed())
+		journal_invalidate();
+
+	if (!journal_pending())
+		return 0;
+
+	if (journal_snapshot(&buf, &len) == 0) {
+		if (saver_queue(SAVER_JOURNAL, journal_save, options->password_file,
+				buf, len) == 0)
+			return 0;
+
+		bzero(buf, len);
+		free(buf);
+	}
+
+	return folder_save();
+}
+
 static void
-folder_read_node(parent, list)
-	xmlNodePtr	parent;
-	folder_t	*list;
+folder_load_stop(ld, msg)
+	folder_loader_t	*ld;
+	char const	*msg;
 {
-password_t     *new;
-xmlNodePtr	node;
+	if (!ld->error)
+		ui_statusline_msg(msg);
+	ld->error = 1;
+}
 
-	new = xcalloc(1, sizeof(*new));
+/*
+ * pwman never writes a DTD, and one could declare entities pulling in local
+ * files, so stop as soon as one turns up.
+ */
+static void
+folder_load_dtd(ctx, name, extid, sysid)
+	void		*ctx;
+	xmlChar const	*name, *extid, *sysid;
+{
+folder_loader_t	*ld = ((xmlParserCtxtPtr) ctx)->_private;
 
-	for (node = parent->children; node != NULL; node = node->next) {
-	char const     *text;
+	folder_load_stop(ld, "Badly formed password data");
+	xmlStopParser(ctx);
+}
 
-		if (!node || !node->name) {
-			debug("Messed up xml node");
-			continue;
-		}
+/*
+ * Entities aren't substituted, so libxml2 leaves each "&" in an attribute
+ * value as "&#38;"; every other reference arrives decoded.
+ */
+static char *
+folder_load_attr(value, end)
+	xmlChar const	*value, *end;
+{
+char	*ret, *p;
+
+	ret = xmalloc(end - value + 1);
+	for (p = ret; value < end;) {
+		if (end - value >= 5 && memcmp(value, "&#38;", 5) == 0) {
+			*p++ = '&';
+			value += 5;
+		} else
+			*p++ = *value++;
+	}
+	*p = '\0';
+	return ret;
+}
 
-		text = (char const *)xmlNodeGetContent(node);
-		if (!text)
-			continue;
+static void
+folder_load_start(ctx, name, prefix, uri, nns, ns, nattrs, ndefaulted, attrs)
+	void		 *ctx;
+	xmlChar const	 *name, *prefix, *uri, **ns, **attrs;
+{
+folder_loader_t	*ld = ((xmlParserCtxtPtr) ctx)->_private;
+char const	*el = (char const *)name;
+char		*lname = NULL;
+int		 i, version = 0;
+folder_t	*new;
+
+	ld->depth++;
+	if (ld->error || ld->skip)
+		return;
 
-		if (strcmp((char const *)node->name, "name") == 0)
-			new->name = xstrdup(text);
+	if (ld->depth == 1) {
+		if (strcmp(el, ld->root_name) != 0) {
+			folder_load_stop(ld, "Badly formed password data");
+			xmlStopParser(ctx);
+			return;
+		}
 
-		else if (strcmp((char const *)node->name, "user") == 0)
-			new->user = xstrdup(text);
+		/* Attributes come as (name, prefix, URI, value, end) */
+		for (i = 0; i < nattrs; i++, attrs += 5)
+			if (strcmp((char const *)attrs[0], "version") == 0)
+				version = atoi((char const *)attrs[3]);
 
-		else if (strcmp((char const *)node->name, "passwd") == 0)
-			new->passwd = xstrdup(text);
+		if (version < FF_XML_VERSION) {
+			folder_load_stop(ld, ld->into
+			    ? "Password export file in older format, use convert_pwdb"
+			    : "Password file in older format, use convert_pwdb");
+			xmlStopParser(ctx);
+		}
+		return;
+	}
 
-		else if (strcmp((char const *)node->name, "host") == 0)
-			new->host = xstrdup(text);
+	/* Inside an entry, only the field elements are interesting */
+	if (ld->pw) {
+		ld->textlen = 0;
+
+		if (strcmp(el, "name") == 0)
+			ld->field = PW_NAME;
+		else if (strcmp(el, "host") == 0)
+			ld->field = PW_HOST;
+		else if (strcmp(el, "user") == 0)
+			ld->field = PW_USER;
+		else if (strcmp(el, "passwd") == 0)
+			ld->field = PW_PASSWD;
+		else if (strcmp(el, "launch") == 0)
+			ld->field = PW_LAUNCH;
+		else
+			ld->skip = ld->depth;
+		return;
+	}
 
-		else if (strcmp((char const *)node->name, "launch") == 0)
-			new->launch = xstrdup(text);
+	/* Only the first list or item below the root is read */
+	if (ld->depth == 2 && ld->done) {
+		ld->skip = ld->depth;
+		return;
 	}
 
-	folder_add_pw(list, new);
+	if (strcmp(el, "PwList") == 0) {
+		for (i = 0; i < nattrs; i++, attrs += 5)
+			if (strcmp((char const *)attrs[0], "name") == 0)
+				lname = folder_load_attr(attrs[3], attrs[4]);
+
+		new = folder_new(lname ? lname : "");
+		xfree(lname);
+
+		if (ld->cur)
+			folder_add_sublist(ld->cur, new);
+		else {
+			if (ld->into)
+				folder_add_sublist(ld->into, new);
+			ld->top = new;
+		}
+
+		ld->cur = new;
+
+	} else if (strcmp(el, "PwItem") == 0) {
+		/* A bare entry is only allowed at the top of an export */
+		if (!ld->cur && !ld->into) {
+			ld->skip = ld->depth;
+			return;
+		}
+
+		ld->pw = pwstore_new();
+
+	} else
+		ld->skip = ld->depth;
 }
 
-static int
-folder_read(parent, parent_list)
-	xmlNodePtr	parent;
-	folder_t	*parent_list;
+static void
+folder_load_end(ctx, name, prefix, uri)
+	void		*ctx;
+	xmlChar const	*name, *prefix, *uri;
 {
-xmlNodePtr	node;
-folder_t       *new;
-char const     *name;
+folder_loader_t	*ld = ((xmlParserCtxtPtr) ctx)->_private;
 
-	if (!parent || !parent->name) {
-		ui_statusline_msg("Messed up xml node");
-		return -1;
+	ld->depth--;
+	if (ld->error)
+		return;
+
+	if (ld->skip) {
+		if (ld->depth < ld->skip)
+			ld->skip = 0;
+		return;
 	}
 
-	if (strcmp((char const *)parent->name, "PwList") != 0)
-		return 0;
+	if (ld->field != -1) {
+		if (ld->text)
+			ld->text[ld->textlen] = '\0';
+		pw_setfield(ld->pw, ld->field, ld->text ? ld->text : "");
+		if (ld->text)
+			bzero(ld->text, ld->textlen);
 
-	name = (char const *)xmlGetProp(parent, (xmlChar const *)"name");
-	new = folder_new(name);
+		ld->field = -1;
+		ld->textlen = 0;
+		return;
+	}
 
-	for (node = parent->children; node != NULL; node = node->next) {
-		if (!node || !node->name) {
-			debug("read_folder: messed up child node");
-			continue;
+	if (ld->pw) {
+		folder_add_pw(ld->cur ? ld->cur : ld->into, ld->pw);
+		ld->pw = NULL;
+
+		if (ld->depth == 1)
+			ld->done = 1;
+		return;
+	}
+
+	/* The end of the document element */
+	if (ld->depth == 0)
+		return;
+
+	/* Otherwise, the end of a list */
+	if (ld->depth == 1) {
+		ld->cur = NULL;
+		ld->done = 1;
+	} else
+		ld->cur = ld->cur->parent;
+}
+
+static void
+folder_load_text(ctx, text, len)
+	void		*ctx;
+	xmlChar const	*text;
+{
+folder_loader_t	*ld = ((xmlParserCtxtPtr) ctx)->_private;
+
+	if (ld->error || ld->skip || ld->field == -1)
+		return;
+
+	if (ld->textlen + len + 1 > ld->textsize) {
+	char	*new;
+	size_t	 newsize = ld->textsize ? ld->textsize : STRING_LONG;
+
+		while (newsize < ld->textlen + len + 1)
+			newsize *= 2;
+
+		/* Don't leave copies of the old text lying around */
+		new = xmalloc(newsize);
+		memcpy(new, ld->text, ld->textlen);
+		if (ld->text) {
+			bzero(ld->text, ld->textsize);
+			free(ld->text);
 		}
 
-		if (strcmp((char const *)node->name, "PwList") == 0)
-			folder_read(node, new);
+		ld->text = new;
+		ld->textsize = newsize;
+	}
+
+	memcpy(ld->text + ld->textlen, text, len);
+	ld->textlen += len;
+}
 
-		else if (strcmp((char const *)node->name, "PwItem") == 0)
-			folder_read_node(node, new);
+static void *
+folder_load_list(arg, parent, name, id)
+	void		*arg, *parent;
+	char const	*name;
+{
+folder_loader_t	*ld = arg;
+folder_t	*new;
+
+	new = folder_new(name);
+	if (id > 0) {
+		new->id = id;
+		if (id > listindex)
+			listindex = id;
 	}
 
-	if (parent_list)
-		folder_add_sublist(parent_list, new);
+	if (parent)
+		folder_add_sublist(parent, new);
 	else
-		folder = current_pw_sublist = new;
+		ld->top = new;
+
+	return new;
+}
+
+static void
+folder_load_entry(arg, list, id, fields)
+	void		*arg, *list;
+	char const	**fields;
+{
+password_t	*pw;
+
+	pw = pwstore_new();
+	PW_ENT(pw)->id = id;
+	pw_setfield(pw, PW_NAME, fields[PWDB_NAME]);
+	pw_setfield(pw, PW_HOST, fields[PWDB_HOST]);
+	pw_setfield(pw, PW_USER, fields[PWDB_USER]);
+	pw_setfield(pw, PW_PASSWD, fields[PWDB_PASSWD]);
+	pw_setfield(pw, PW_LAUNCH, fields[PWDB_LAUNCH]);
+
+	folder_add_pw(list, pw);
+}
+
+static xmlParserCtxtPtr
+folder_load_xml(ld)
+	folder_loader_t	*ld;
+{
+xmlSAXHandler		sax;
+xmlParserCtxtPtr	pctxt;
+
+	bzero(&sax, sizeof(sax));
+	sax.initialized = XML_SAX2_MAGIC;
+	sax.startElementNs = folder_load_start;
+	sax.endElementNs = folder_load_end;
+	sax.characters = folder_load_text;
+	sax.cdataBlock = folder_load_text;
+	sax.internalSubset = folder_load_dtd;
+	sax.externalSubset = folder_load_dtd;
+
+	if ((pctxt = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, NULL)) == NULL)
+		return NULL;
+
+	/* The callbacks get the parser context, so they can stop it */
+	pctxt->userData = pctxt;
+	pctxt->_private = ld;
+
+	xmlCtxtUseOptions(pctxt, XML_PARSE_NONET);
+	return pctxt;
+}
+
+static void
+folder_load_feed(ld, buf, len)
+	folder_loader_t	*ld;
+	char const	*buf;
+	size_t		 len;
+{
+	if (ld->error || len == 0)
+		return;
+
+	if (ld->pwdb) {
+		if (pwdb_reader_feed(ld->pwdb, buf, len) != 0)
+			folder_load_stop(ld, "Badly formed password data");
+	} else if (xmlParseChunk(ld->pctxt, buf, len, 0) != 0 && !ld->error)
+		folder_load_stop(ld, "Bad XML data");
+}
+
+/*
+ * Choose the reader from what's in head, which is all of the data if there's
+ * less than the magic number, and pass it on.
+ */
+static int
+folder_load_format(ld)
+	folder_loader_t	*ld;
+{
+	if (!ld->into && ld->headlen == PWDB_MAGIC_LEN &&
+	    memcmp(ld->head, PWDB_MAGIC, PWDB_MAGIC_LEN) == 0) {
+		ld->pwdb = pwdb_reader_new(&folder_pwdb_ops, ld);
+		ld->binary = 1;
+	} else if ((ld->pctxt = folder_load_xml(ld)) == NULL) {
+		ld->error = 1;
+		return -1;
+	}
+
+	folder_load_feed(ld, ld->head, ld->headlen);
+	return ld->error ? -1 : 0;
+}
+
+static int
+folder_load_chunk(ctx, buf, len)
+	void		*ctx;
+	char const	*buf;
+	size_t		 len;
+{
+folder_loader_t	*ld = ctx;
+size_t		 n;
+
+	if (ld->error)
+		return -1;
+
+	/*
+	 * The start of the data tells us the format, however gpg splits it up.
+	 * Only the database itself can be binary; exports are always XML.
+	 */
+	if (!ld->pctxt && !ld->pwdb) {
+		n = PWDB_MAGIC_LEN - ld->headlen;
+		if (n > len)
+			n = len;
+		memcpy(ld->head + ld->headlen, buf, n);
+		ld->headlen += n;
+		buf += n;
+		len -= n;
+
+		if (ld->headlen < PWDB_MAGIC_LEN)
+			return 0;
+		if (folder_load_format(ld) != 0)
+			return -1;
+	}
+
+	folder_load_feed(ld, buf, len);
+	return ld->error ? -1 : 0;
+}
+
+/*
+ * Read the password list in file, whose document element should be
+ * root_name.  If into is given, the contents are added to it; otherwise the
+ * top-level list is returned in *ret.
+ */
+static int
+folder_load(file, root_name, into, ret, binary)
+	char const	*file, *root_name;
+	folder_t	*into, **ret;
+	int		*binary;
+{
+folder_loader_t		ld;
+int			gnupg_worked;
+
+	bzero(&ld, sizeof(ld));
+	ld.field = -1;
+	ld.root_name = root_name;
+	ld.into = into;
+
+	gnupg_worked = gnupg_read(file, folder_load_chunk, &ld);
+
+	/* Less than the magic number can only be (bad) XML */
+	if (gnupg_worked == 0 && !ld.error && !ld.pctxt && !ld.pwdb &&
+	    ld.headlen > 0)
+		folder_load_format(&ld);
+
+	if (gnupg_worked == 0 && !ld.error) {
+		if (ld.pwdb) {
+			if (pwdb_reader_finish(ld.pwdb) != 0)
+				folder_load_stop(&ld, "Badly formed password data");
+		} else if (!ld.pctxt)
+			folder_load_stop(&ld, "Badly formed password data");
+		else if (xmlParseChunk(ld.pctxt, NULL, 0, 1) != 0 || !ld.pctxt->wellFormed)
+			folder_load_stop(&ld, "Bad XML data");
+		else if (!ld.top && !into)
+			folder_load_stop(&ld, "Badly formed password data");
+	}
+
+	if (ld.pctxt)
+		xmlFreeParserCtxt(ld.pctxt);
+	pwdb_reader_free(ld.pwdb);
 
+	if (ld.text) {
+		bzero(ld.text, ld.textsize);
+		free(ld.text);
+	}
+
+	if (ld.pw)
+		pw_free(ld.pw);
+
+	if (gnupg_worked != 0 || ld.error) {
+		/* Throw away anything we managed to read */
+		if (ld.top && into)
+			folder_delete_sublist(into, ld.top);
+		else
+			folder_free(ld.top);
+
+		return gnupg_worked != 0 ? gnupg_worked : -1;
+	}
+
+	if (ret)
+		*ret = ld.top;
+	if (binary)
+		*binary = ld.binary;
 	return 0;
 }
 
@@ -474,11 +1385,8 @@ int
 folder_read_file()
 {
 char		fn[STRING_LONG];
-char const     *buf;
-int		i = 0;
-int		gnupg_worked = 0;
-xmlNodePtr	node, root;
-xmlDocPtr	doc;
+folder_t       *new;
+int		ret, binary;
 
 	/* Have the defined a file yet? */
 	if (!options->password_file)
@@ -492,40 +1400,24 @@ xmlDocPtr	doc;
 		return -1;
 	}
 
-	/* Try to load the file */
-	gnupg_worked = gnupg_read(options->password_file, &doc);
-
-	/* Did it work? */
-	if (gnupg_worked != 0)
-		return gnupg_worked;
-
-	if (!doc) {
-		ui_statusline_msg("Bad XML data");
-		return -1;
-	}
-
-	root = xmlDocGetRootElement(doc);
-	if (!root || !root->name || (strcmp((char const *)root->name, "PWMan_PasswordList") != 0)) {
-		ui_statusline_msg("Badly formed password data");
-		return -1;
-	}
-
-	if ((buf = (char const *)xmlGetProp(root, (xmlChar const *)"version")) != NULL)
-		i = atoi(buf);
+	/* Make sure we read what was last saved */
+	saver_flush();
 
-	if (i < FF_VERSION) {
-		ui_statusline_msg("Password file in older format, use convert_pwdb");
-		return -1;
-	}
+	/* Don't record the tree being built as changes */
+	journal_close();
 
-	for (node = root->children; node != NULL; node = node->next) {
-		if (strcmp((char const *)node->name, "PwList") == 0) {
-			folder_read(node, NULL);
-			break;
-		}
+	/* Try to load the file */
+	if ((ret = folder_load(options->password_file, "PWMan_PasswordList", NULL,
+			       &new, &binary)) != 0)
+		return ret;
+
+	/* Apply any changes saved since it was written */
+	if ((ret = journal_open(options->password_file, new, binary)) != 0) {
+		folder_free(new);
+		return ret;
 	}
 
-	xmlFreeDoc(doc);
+	folder = current_pw_sublist = new;
 	return 0;
 }
 
@@ -535,10 +1427,9 @@ folder_do_export(list, pw)
 	password_t	*pw;
 {
 #define	MAX_ID_NUM	5
-char		vers[5], *ids[MAX_ID_NUM], *file;
+char		*ids[MAX_ID_NUM], *file;
 int		i = 0,	valid_ids = 0;
-xmlDocPtr	doc;
-xmlNodePtr	root;
+folder_doc_t	doc;
 
 	bzero(ids, sizeof(ids));
 
@@ -565,26 +1456,13 @@ xmlNodePtr	root;
 
 	file = gnupg_get_filename('w');
 
-	debug("export_passwd: construct xml doc");
-	snprintf(vers, 5, "%d", FF_VERSION);
-	doc = xmlNewDoc((xmlChar const *)"1.0");
+	doc.root_name = "PWMan_Export";
+	doc.list = list;
+	doc.pw = pw;
 
-	root = xmlNewDocNode(doc, NULL, (xmlChar const *)"PWMan_Export", NULL);
-
-	xmlSetProp(root, (xmlChar const *)"version", (xmlChar const *)vers);
-
-	if (list)
-		folder_write(root, list);
-	else
-		folder_write_node(root, pw);
-
-	xmlDocSetRootElement(doc, root);
-
-	gnupg_write_many(doc, ids, MAX_ID_NUM, file);
+	gnupg_write_many(folder_write_doc, &doc, ids, MAX_ID_NUM, file, 1);
 	free(file);
 
-	xmlFreeDoc(doc);
-
 	for (i = 0; i < MAX_ID_NUM; i++)
 		free(ids[i]);
 
@@ -609,41 +1487,13 @@ int
 folder_import_passwd()
 {
 char           *file;
-char const     *buf;
-int		i = 0;
-
-xmlNodePtr	node, root;
-xmlDocPtr	doc;
+int		ret;
 
 	file = gnupg_get_filename('r');
-	gnupg_read(file, &doc);
+	ret = folder_load(file, "PWMan_Export", current_pw_sublist, NULL, NULL);
 	free(file);
 
-	if (!doc) {
+	if (ret != 0)
 		debug("import_passwd: bad data");
-		return -1;
-	}
-	root = xmlDocGetRootElement(doc);
-	if (!root || !root->name || (strcmp((char const *)root->name, "PWMan_Export") != 0)) {
-		ui_statusline_msg("Badly formed password data");
-		return -1;
-	}
-	if ((buf = (char const *)xmlGetProp(root, (xmlChar const *)"version")) != NULL)
-		i = atoi(buf);
-
-	if (i < FF_VERSION) {
-		ui_statusline_msg("Password export file in older format, use convert_pwdb");
-		return -1;
-	}
-	for (node = root->children; node != NULL; node = node->next) {
-		if (strcmp((char const *)node->name, "PwList") == 0) {
-			folder_read(node, current_pw_sublist);
-			break;
-		} else if (strcmp((char const *)node->name, "PwItem") == 0) {
-			folder_read_node(node, current_pw_sublist);
-			break;
-		}
-	}
-	xmlFreeDoc(doc);
-	return 0;
+	return ret;
 }
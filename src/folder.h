@@ -23,19 +23,52 @@
 #define	PWMAN_FOLDER_H
 
 typedef struct folder {
+	int		id;
 	char           *name;
 	pw_list_t	list;
 
 	int		marked;
+	unsigned	search_gen;	/* see search_apply() */
 
 	struct folder  *parent;
-	struct folder  *sublists;
-	struct folder  *next;
+	struct folder  *sublists, *lastsub;	/* first and last child */
+	struct folder  *next, *prev;		/* siblings */
+
+	/* The children by name; see folder_find_sublist() */
+	struct folder **names;
+	struct folder  *nextname;
+	size_t		nsublists, namesize;
+
+	/* The entries by name, as pwstore_table numbers + 1; see folder_find_entry() */
+	uint32_t       *entnames;
+	size_t		nentries, entsize;
 
 	/* ui stuff, shouldn't be here but this is a quick hack */
 	int		current_item;
+
+	/* The entries the filter shows; see filter_visible() */
+	password_t	**visible;
+	size_t		  nvisible;
+	unsigned	  visible_gen;
 } folder_t;
 
+/* A walk over a list and everything below it; see folder_iter_next() */
+#define	FOLDER_ENTER	0x1
+#define	FOLDER_LEAVE	0x2
+
+typedef struct folder_iter {
+	folder_t	*top;
+	folder_t	*cur;
+	folder_t	*next, *up;	/* where to go after leaving cur */
+	int		 flags;		/* events wanted */
+	int		 event;		/* FOLDER_ENTER or FOLDER_LEAVE */
+	int		 depth;		/* of cur below top */
+} folder_iter_t;
+
+void	       *folder_alloc(size_t);
+void		folder_release(void *, size_t);
+void		folder_setstr(char **, char const *);
+
 void		folder_add_pw(folder_t *, password_t *);
 folder_t       *folder_new(char const *);
 int		folder_change_item_order(password_t *pw, folder_t *parent, int moveUp);
@@ -50,10 +83,23 @@ void		folder_detach_pw(folder_t *list, password_t *pw);
 void		folder_delete_sublist(folder_t *parent, folder_t *old);
 void		folder_rename_sublist(folder_t *folder, char const *new_name);
 void		folder_add_sublist(folder_t *parent, folder_t *new);
+folder_t       *folder_find_sublist(folder_t *parent, char const *name);
+password_t     *folder_find_entry(folder_t *list, char const *name);
+void		folder_index_pw(folder_t *, password_t *);
+void		folder_unindex_pw(folder_t *, password_t *);
+int		folder_lookup(folder_t *top, char const *path,
+			      folder_t **list, password_t **entry);
+char	       *folder_path(folder_t *list, password_t *entry);
 int		folder_export_list(folder_t *folder);
 int		folder_write_file(void);
+int		folder_save(void);
+int		folder_write_changes(void);
 int		folder_import_passwd(void);
 
+void		folder_iter_init(folder_iter_t *, folder_t *top, int flags);
+folder_t       *folder_iter_next(folder_iter_t *);
+
+void		pw_setfield(password_t *, int, char const *);
 void		pw_rename(password_t *, char const *);
 void		pw_free(password_t *);
 void		pw_delete(password_t *);
@@ -0,0 +1,83 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Walk a tree of lists without recursion or a stack, by following the parent
+ * pointers back up, so there's no limit on how deep the tree can be.
+ */
+
+#include	<stdlib.h>
+
+#include	"pwman.h"
+
+void
+folder_iter_init(it, top, flags)
+	folder_iter_t	*it;
+	folder_t	*top;
+{
+	bzero(it, sizeof(*it));
+	it->top = top;
+	it->flags = flags;
+}
+
+/*
+ * Return the next list, with it->event saying whether it's being entered or
+ * left; only the events asked for are returned.  A list is entered before
+ * its sublists and left after them.  Having left a list, the caller may free
+ * it.  Returns NULL when the walk is finished.
+ */
+folder_t *
+folder_iter_next(it)
+	folder_iter_t	*it;
+{
+	for (;;) {
+		if (it->cur == NULL) {
+			/* Not started yet, or finished */
+			if (it->event || !it->top)
+				return NULL;
+			it->cur = it->top;
+			it->event = FOLDER_ENTER;
+		} else if (it->event == FOLDER_ENTER && it->cur->sublists) {
+			it->cur = it->cur->sublists;
+			it->depth++;
+		} else if (it->event == FOLDER_ENTER) {
+			it->event = FOLDER_LEAVE;
+		} else if (it->cur == it->top) {
+			it->cur = NULL;
+			return NULL;
+		} else if (it->next) {
+			it->cur = it->next;
+			it->event = FOLDER_ENTER;
+		} else {
+			it->cur = it->up;
+			it->depth--;
+		}
+
+		/* Remember where to go next, in case the caller frees it */
+		if (it->event == FOLDER_LEAVE && it->cur != it->top) {
+			it->next = it->cur->next;
+			it->up = it->cur->parent;
+		}
+
+		if (it->flags & it->event)
+			return it->cur;
+	}
+}
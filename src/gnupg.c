@@ -21,93 +21,38 @@
 
 
 /*
- * define for strings to check for with regex
- * should allow for internationalization
+ * The user-facing side of encryption: asking for passphrases and recipients,
+ * and reporting errors.  The work is done by one of the backends in
+ * gnupg_backend.h, chosen at configure time.
  */
 
-#define GPG_ERR_CANTWRITE	"file create error"
-#define GPG_ERR_CANTOPEN 	"can't open"
-#define GPG_ERR_BADPASSPHRASE	"bad passphrase"
-#define GPG_ERR_NOSECRETKEY	"secret key not available"
-
-/* end defines */
-
 #include	<sys/types.h>
 #include	<sys/stat.h>
-#include	<sys/wait.h>
 
 #include	<unistd.h>
 #include	<time.h>
-#include	<regex.h>
 #include	<stdlib.h>
-#include	<fcntl.h>
-#include	<errno.h>
 #include	<assert.h>
 #include	<pwd.h>
 #include	<limits.h>
-
-#include	<libxml/tree.h>
-#include	<libxml/parser.h>
+#include	<pthread.h>
 
 #include	"pwman.h"
 #include	"ui.h"
 #include	"actions.h"
 #include	"gnupg.h"
+#include	"gnupg_backend.h"
+
+#ifdef	HAVE_GPGME
+static gnupg_backend_t const	*backend = &gnupg_gpgme_backend;
+#else
+static gnupg_backend_t const	*backend = &gnupg_exec_backend;
+#endif
 
-static int	gnupg_hit_sigpipe = 0;
 static char    *passphrase = NULL;
 
 static char    *gnupg_expand_filename(char const *);
 
-static void
-gnupg_sigpipe_handler()
-{
-	gnupg_hit_sigpipe = 1;
-}
-
-static char    *
-gnupg_add_to_buf(buf, new)
-	char           *buf;
-	char const     *new;
-{
-size_t		size;
-
-	if (new == NULL)
-		return buf;
-
-	if (buf == NULL) {
-		buf = malloc(strlen(new) + 1);
-		strcpy(buf, new);
-		return buf;
-	}
-	size = strlen(buf) + strlen(new) + 1;
-	buf = realloc(buf, size);
-	strcat(buf, new);
-
-	return buf;
-}
-
-static int
-gnupg_str_in_buf(buf, check)
-	char const     *buf, *check;
-{
-regex_t		reg;
-
-	debug("str_in_buf: start checking");
-
-	if ((buf == NULL) || (check == NULL))
-		return 0;
-
-	regcomp(&reg, check, 0);
-	if (regexec(&reg, buf, 0, NULL, 0) == 0) {
-		regfree(&reg);
-		return 1;
-	} else {
-		regfree(&reg);
-		return 0;
-	}
-}
-
 static char    *
 gnupg_expand_filename(filename)
 	char const     *filename;
@@ -131,212 +76,12 @@ char           *ret;
 	return ret;
 }
 
-static int
-gnupg_exec(path, args, stream)
-	char const	*path;
-	char		**args;
-	FILE		*stream[3];
-{
-int		stdin_fd[2];
-int		stdout_fd[2];
-int		stderr_fd[2];
-int		pid, ret;
-
-	pipe(stdin_fd);
-	pipe(stdout_fd);
-	pipe(stderr_fd);
-
-	if ((path == NULL) || (args == NULL))
-		return -1;
-
-	if ((pid = fork()) == -1)
-		return -1;
-
-	/* Do the right thing with the fork */
-	if (pid == 0) {
-		close(stdout_fd[0]);
-		close(stdin_fd[1]);
-		close(stderr_fd[0]);
-
-		dup2(stdout_fd[1], STDOUT_FILENO);
-		dup2(stdin_fd[0], STDIN_FILENO);
-		dup2(stderr_fd[1], STDERR_FILENO);
-
-		ret = execv(path, args);
-		if (ret)
-			pw_abort("Failed to run %s, aborted with error code %d", path, errno);
-		abort();	/* NOTREACHED */
-	}
-
-	close(stdout_fd[1]);
-	close(stdin_fd[0]);
-	close(stderr_fd[1]);
-
-	if (stream != NULL) {
-		stream[STDOUT_FILENO] = fdopen(stdout_fd[0], "r");
-		stream[STDIN_FILENO] = fdopen(stdin_fd[1], "w");
-		stream[STDERR_FILENO] = fdopen(stderr_fd[0], "r");
-	}
-
-	/* Mark us as not having had a sigpipe yet */
-	gnupg_hit_sigpipe = 0;
-	signal(SIGPIPE, gnupg_sigpipe_handler);
-
-	return pid;
-}
-
-static void
-gnupg_exec_end(pid, stream)
-	FILE	*stream[3];
-{
-char		buf[STRING_LONG];
-
-	/* If we hit a problem, report that */
-	if (gnupg_hit_sigpipe) {
-		fputs("GPG hit an error and died...\n", stderr);
-
-		while (fgets(buf, sizeof(buf), stream[STDOUT_FILENO]) != NULL)
-			fputs(buf, stderr);
-
-		while (fgets(buf, sizeof(buf), stream[STDERR_FILENO]) != NULL)
-			fputs(buf, stderr);
-
-		/*
-		 * TODO - figure out why we don't get the real error message
-		 * from GPG displayed here like one might expect
-		 */ 
-	}
-	signal(SIGPIPE, NULL);
-
-	/* Close up */
-	debug("gnupg_exec_end : close streams");
-	if (stream[0])
-		fclose(stream[0]);
-
-	if (stream[1])
-		fclose(stream[1]);
-
-	if (stream[2])
-		fclose(stream[2]);
-
-	debug("waiting for pid %d", pid);
-	waitpid(pid, NULL, 0);
-
-	/* Bail out if gpg broke */
-	if (gnupg_hit_sigpipe)
-		exit(1);
-}
-
-static char    *
-gnupg_find_recp(str)
-	char const     *str;
-{
-char           *user, *start, *end;
-int		size;
-
-	debug(str);
-
-	/* Is it "<id>" ? */
-	start = strstr(str, "\"");
-	if (start != NULL) {
-		start += 1;
-		end = strstr(start, "\"");
-	} else {
-		/* Is it ID <id>\n? */
-		start = strstr(str, "ID");
-		if (start != NULL) {
-			start += 3;
-			end = strstr(start, "\n");
-		} else {
-			/* No idea */
-			user = "(not sure)";
-			return user;
-		}
-	}
-
-	size = end - start;
-	user = malloc(size + 1);
-	strcpy(user, start);
-	debug("Recipient is %s", user);
-	return user;
-}
-
 /* Returns 0 if found, -1 if not found, and -2 if found but expired */
 int
 gnupg_check_id(id)
 	char const     *id;
 {
-regex_t		reg, expired_reg;
-int		pid;
-char		text[STRING_LONG], idstr[STRING_LONG];
-char		*args[4];
-FILE           *streams[3];
-int		id_is_key_id = 0, key_found = 0, key_is_expired = -1;
-
-	debug("check_gnupg_id: check gnupg id\n");
-
-	/* Build our expired key matching regexp */
-	regcomp(&expired_reg, "^(pub|sub):e:", REG_EXTENDED);
-
-	/* Is the supplied ID really a key ID? */
-	/* (If it is, it's 8 chars long, and 0-9A-F) */
-	regcomp(&reg, "^[0-9A-Z]{8}$", REG_EXTENDED);
-
-	if (regexec(&reg, id, 0, NULL, 0) == 0) {
-		/* The supplied ID is a key ID */
-		id_is_key_id = 1;
-		debug("check_gnupg_id: supplied ID was a gnupg key id\n");
-	} else
-		debug("check_gnupg_id: supplied ID taken to be an email address\n");
-
-	if (id_is_key_id == 1)
-		/* Match on "pub:.:SIZE:type:FULLID:DATE" */
-		/* Where FULLID is 8 chars then the 8 chars we expected */
-		snprintf(idstr, sizeof(idstr), "^pub:.:[0-9]+:[0-9]+:[0-9a-zA-Z]{8}%s:", id);
-	else
-		/* Match on "(pub|uid) .... NAME <EMAIL ADDRESS>" */
-		snprintf(idstr, sizeof(idstr), "[^<]*<%s>", id);
-
-	/* Fire off GPG to find all our keys */
-	args[0] = "gpg";
-	args[1] = "--with-colons";
-	args[2] = "--list-keys";
-	args[3] = NULL;
-
-	pid = gnupg_exec(options->gpg_path, args, streams);
-
-	regcomp(&reg, idstr, REG_EXTENDED);
-	while (fgets(text, sizeof(text), streams[STDOUT_FILENO])) {
-		if (regexec(&reg, text, 0, NULL, 0) != 0)
-			continue;
-
-		/* Found the key! */
-		key_found = 1;
-
-		/* Check it isn't also expired */
-		if (regexec(&expired_reg, text, 0, NULL, 0) == 0) {
-
-			/*
-			 * Only mark as expired if we haven't found
-			 * another version that isn't expired.
-			 */
-			if (key_is_expired == -1)
-				key_is_expired = 1;
-		} else
-			key_is_expired = 0;
-	}
-
-	/* Tidy up */
-	gnupg_exec_end(pid, streams);
-
-	/* If we found it, return found / found+expired */
-	if (key_found) {
-		if (key_is_expired)
-			return -2;
-		return 0;
-	}
-	/* Didn't find it */
-	return -1;
+	return backend->check_id(id);
 }
 
 /**
@@ -414,65 +159,114 @@ gnupg_get_passphrase()
 
 	passphrase = ui_ask_passwd("Enter GnuPG passphrase:", NULL);
 
+	/* The timeout runs from when it was entered */
+	time_base = time(NULL);
 	return passphrase;
 }
 
 void
 gnupg_forget_passphrase()
 {
-	bzero(passphrase, strlen(passphrase));
-	free(passphrase);
-	passphrase = NULL;
+	if (passphrase) {
+		bzero(passphrase, strlen(passphrase));
+		free(passphrase);
+		passphrase = NULL;
+	}
 
 	debug("forget_passphrase: passphrase forgotten");
 	ui_statusline_msg("Passphrase forgotten");
 }
 
+
 static int
 gnupg_check_executable()
 {
-FILE           *streams[3];
-char           *args[3];
-int		pid, count, version[3];
-
-	debug("check_gnupg: start");
-	if (options->gpg_path == NULL)
+	if (backend->check() != 0) {
+		ui_statusline_msg("WARNING! GnuPG Executable not found");
+		getch();
 		return -1;
+	}
 
-	args[0] = "gpg";
-	args[1] = "--version";
-	args[2] = NULL;
+	return 0;
+}
 
-	pid = gnupg_exec(options->gpg_path, args, streams);
+struct gnupg_writer_thread {
+	pthread_t	 thread;
+	FILE		*stream;
+	gnupg_writer_t	 writer;
+	void		*arg;
+	int		 ret;
+	int		 threaded;
+};
+
+static void *
+gnupg_writer_run(arg)
+	void	*arg;
+{
+gnupg_writer_thread_t	*wt = arg;
 
-	/* this might do version checking someday if needed */
-	count = fscanf(streams[STDOUT_FILENO], "gpg (GnuPG) %d.%d.%d",
-		       &version[0], &version[1], &version[2]);
-	gnupg_exec_end(pid, streams);
+	wt->ret = wt->writer(wt->stream, wt->arg);
 
-	debug("exec ended");
-	if (count != 3) {
-		ui_statusline_msg("WARNING! GnuPG Executable not found");
-		getch();
-		return -1;
-	} else {
-		debug("check_gnupg: Version %d.%d.%d", version[0], version[1], version[2]);
-		return 0;
+	/* SIGPIPE is ignored, so gpg dying shows up here as EPIPE */
+	if (ferror(wt->stream))
+		wt->ret = -1;
+	if (fclose(wt->stream) == EOF)
+		wt->ret = -1;
+	return NULL;
+}
+
+gnupg_writer_thread_t *
+gnupg_writer_start(stream, writer, arg)
+	FILE		*stream;
+	gnupg_writer_t	 writer;
+	void		*arg;
+{
+gnupg_writer_thread_t	*wt;
+
+	wt = xcalloc(1, sizeof(*wt));
+	wt->stream = stream;
+	wt->writer = writer;
+	wt->arg = arg;
+
+	/* If we can't start a thread, just write it all now */
+	if (pthread_create(&wt->thread, NULL, gnupg_writer_run, wt) == 0)
+		wt->threaded = 1;
+	else {
+		debug("gnupg_writer_start: no thread, writing synchronously");
+		gnupg_writer_run(wt);
 	}
+
+	return wt;
 }
 
 int
-gnupg_write_many(doc, ids, num_ids, filename)
-	xmlDocPtr	doc;
+gnupg_writer_wait(wt)
+	gnupg_writer_thread_t	*wt;
+{
+int	ret;
+
+	if (wt->threaded)
+		pthread_join(wt->thread, NULL);
+
+	ret = wt->ret;
+	free(wt);
+	return ret;
+}
+
+/*
+ * Encrypt the output of writer to filename, for each of the given recipients.
+ * If armor is set, the file is written ASCII-armored.
+ */
+int
+gnupg_write_many(writer, arg, ids, num_ids, filename, armor)
+	gnupg_writer_t	writer;
+	void		*arg;
 	char		**ids;
 	char const	*filename;
 {
-FILE           *streams[3];
 char		buf[STRING_LONG];
-char           *args[7 + 1 + (2 * 10)];	/* 7 initial args, 1 null, 10
-					 * recipients */
-char           *err;
-int		pid, i, pos, num_valid_ids;
+char           *recps[GNUPG_MAX_RECIPIENTS];
+int		i, num_valid_ids, ret;
 char           *expfile;
 
 	debug("gnupg_write: do some checks");
@@ -493,7 +287,9 @@ char           *expfile;
 			if (ids[i][0] == 0)
 				return -1;
 		}
-		num_valid_ids++;
+
+		if (num_valid_ids < GNUPG_MAX_RECIPIENTS)
+			recps[num_valid_ids++] = ids[i];
 	}
 	debug("gnupg_write: writing to %d recipients", num_valid_ids);
 
@@ -504,55 +300,11 @@ char           *expfile;
 
 	expfile = gnupg_expand_filename(filename);
 
-	err = NULL;
-
-	pos = 0;
-	args[pos++] = "gpg";
-	args[pos++] = "-e";
-	args[pos++] = "-a";
-	args[pos++] = "--always-trust";	/* gets rid of error when moving keys
-					 * from other machines */
-	args[pos++] = "--yes";
-	args[pos++] = "-o";
-	args[pos++] = expfile;
-
-	/* Add in all the recipients */
-	for (i = 0; i < num_ids; i++) {
-		if (!ids[i] || (ids[i][0] == '\0'))
-			continue;
-
-		args[pos++] = "-r";
-		args[pos++] = ids[i];
-	}
-	args[pos] = NULL;
-
 	for (;;) {
-		/* clear err buffer */
-		xfree(err);
-		err = NULL;
-
-		pid = gnupg_exec(options->gpg_path, args, streams);
-		if (pid == -1)
-			return -1;
-
-#if LIBXML_VERSION >= 20423
-		xmlDocFormatDump(streams[STDIN_FILENO], doc, TRUE);
-#else
-		xmlDocDump(streams[STDIN_FILENO], doc);
-#endif
-
-		close(fileno(streams[STDIN_FILENO]));
+		ret = backend->encrypt(expfile, recps, num_valid_ids, armor,
+				       writer, arg);
 
-		while (fgets(buf, sizeof(buf), streams[STDERR_FILENO]) != NULL)
-			err = gnupg_add_to_buf(err, buf);
-		gnupg_exec_end(pid, streams);
-
-		debug("gnupg_write: start error checking");
-
-		/*
-		 * check for errors(no key, bad pass, no file etc etc)
-		 */
-		if (gnupg_str_in_buf(err, GPG_ERR_CANTWRITE)) {
+		if (ret == GNUPG_CANTWRITE) {
 			debug("gnupg_write: cannot write to %s", expfile);
 
 			snprintf(buf, sizeof(buf), "Cannot write to %s", expfile);
@@ -560,8 +312,7 @@ char           *expfile;
 			getch();
 
 			free(expfile);
-			expfile = gnupg_get_filename('w');
-			if (!expfile)
+			if ((expfile = gnupg_get_filename('w')) == NULL)
 				return -1;
 
 			continue;
@@ -569,57 +320,72 @@ char           *expfile;
 		break;
 	}
 
+	free(expfile);
+
+	if (ret != GNUPG_OK)
+		return -1;
+
 	ui_statusline_msg("List saved");
 	debug("gnupg_write: file write sucessful");
-
-	free(expfile);
 	return 0;
 }
 
+/*
+ * Write the database itself, which is stored unarmored.
+ */
 int
-gnupg_write(doc, id, filename)
-	xmlDocPtr	doc;
+gnupg_write(writer, arg, id, filename)
+	gnupg_writer_t	writer;
+	void		*arg;
 	char		*id;
 	char const	*filename;
 {
-	return gnupg_write_many(doc, &id, 1, filename);
+	return gnupg_write_many(writer, arg, &id, 1, filename, 0);
 }
 
+/*
+ * As gnupg_write(), but without asking the user anything, so it can be used
+ * by the background saver.  id must already have been checked.
+ */
 int
-gnupg_read(filename, doc)
-	char const     *filename;
-	xmlDocPtr      *doc;
+gnupg_write_batch(writer, arg, id, filename)
+	gnupg_writer_t	writer;
+	void		*arg;
+	char		*id;
+	char const	*filename;
 {
-char           *args[9], *data = NULL, *err = NULL, *user = NULL;
-char		buf[STRING_LONG], *expfile;
+char	*expfile;
+int	 ret;
+
+	expfile = gnupg_expand_filename(filename);
+
+	if ((ret = backend->check()) == 0)
+		ret = backend->encrypt(expfile, &id, 1, 0, writer, arg);
+
+	free(expfile);
+	return ret == GNUPG_OK ? 0 : -1;
+}
+
+/*
+ * Decrypt filename, passing the plaintext to reader in chunks as it arrives
+ * from gpg.  If reader returns non-zero, the remaining output is discarded.
+ */
+int
+gnupg_read(filename, reader, arg)
+	char const	*filename;
+	gnupg_reader_t	 reader;
+	void		*arg;
+{
+char		buf[STRING_LONG], *expfile, *user = NULL;
 char const     *pass;
-FILE           *streams[3];
-int		pid, ret = 0, pos;
+int		ret = 0;
 
-	if (gnupg_check_executable() != 0) {
-		*doc = xmlNewDoc((xmlChar const *)"1.0");
+	if (gnupg_check_executable() != 0)
 		return -1;
-	}
 
 	expfile = gnupg_expand_filename(filename);
 
-	pos = 0;
-	args[pos++] = "gpg";
-	args[pos++] = "--passphrase-fd";
-	args[pos++] = "0";
-	args[pos++] = "--no-verbose";
-	args[pos++] = "--batch";
-	args[pos++] = "--output";
-	args[pos++] = "-";
-	args[pos++] = expfile;
-	args[pos++] = NULL;
-
 	for (;;) {
-		/* clear buffers */
-		xfree(err);
-		xfree(data);
-		err = data = NULL;
-
 		pass = gnupg_get_passphrase();
 
 		if (pass == NULL) {
@@ -628,38 +394,22 @@ int		pid, ret = 0, pos;
 			ret = 255;
 			break;
 		}
-		pid = gnupg_exec(options->gpg_path, args, streams);
-
-		fputs(pass, streams[STDIN_FILENO]);
-		fputc('\n', streams[STDIN_FILENO]);
-		fclose(streams[STDIN_FILENO]);
-		streams[STDIN_FILENO] = NULL;
 
-		debug("gnupg_read: start reading data");
-		while (fgets(buf, sizeof(buf), streams[STDOUT_FILENO]) != NULL)
-			data = gnupg_add_to_buf(data, buf);
+		ret = backend->decrypt(expfile, pass, reader, arg, &user);
 
-		while (fgets(buf, sizeof(buf), streams[STDERR_FILENO]) != NULL)
-			err = gnupg_add_to_buf(err, buf);
-
-		gnupg_exec_end(pid, streams);
-
-		debug("gnupg_read: start error checking");
-		debug(err);
+		switch (ret) {
+		case GNUPG_OK:
+			break;
 
-		/*
-		 * check for errors(no key, bad pass, no file etc etc)
-		 */
-		if (gnupg_str_in_buf(err, GPG_ERR_BADPASSPHRASE)) {
+		case GNUPG_BADPASS:
 			debug("gnupg_read: bad passphrase");
 			ui_statusline_msg("Bad passphrase, please re-enter");
 			getch();
 
 			gnupg_forget_passphrase();
 			continue;
-		}
 
-		if (gnupg_str_in_buf(err, GPG_ERR_CANTOPEN)) {
+		case GNUPG_CANTOPEN:
 			debug("gnupg_read: cannot open %s", filename);
 			snprintf(buf, sizeof(buf), "Cannot open file \"%s\"", expfile);
 			ui_statusline_msg(buf);
@@ -667,34 +417,25 @@ int		pid, ret = 0, pos;
 
 			ret = -1;
 			break;
-		}
 
-		if (gnupg_str_in_buf(err, GPG_ERR_NOSECRETKEY)) {
+		case GNUPG_NOSECKEY:
 			debug("gnupg_read: secret key not available!");
-			user = gnupg_find_recp(err);
-			snprintf(buf, sizeof(buf), "You do not have the secret key for %s", user);
+			snprintf(buf, sizeof(buf), "You do not have the secret key for %s",
+				 user ? user : "(not sure)");
 			ui_statusline_msg(buf);
 			getch();
 
 			ret = 254;
 			break;
+
+		case GNUPG_FAILED:
+			ret = -1;
+			break;
 		}
 		break;
 	}
 
 	free(expfile);
-
-	debug("gnupg_read: finished read");
-	if (data != NULL) {
-		debug("gnupg_read: data != NULL");
-		*doc = xmlParseMemory(data, strlen(data));
-		free(data);
-	} else {
-		debug("gnupg_read: data is null");
-		*doc = xmlNewDoc((xmlChar const *)"1.0");
-	}
-
-	xfree(err);
 	xfree(user);
 
 	debug("gnupg_read: finished all");
@@ -707,85 +448,7 @@ gnupg_list_ids(ids, nids)
 	char	***ids;
 	size_t	  *nids;
 {
-int		pid;
-char		text[STRING_LONG];
-char		*args[4];
-FILE           *streams[3];
-
-	*ids = NULL;
-	*nids = 0;
-
-	args[0] = "gpg";
-	args[1] = "--with-colons";
-	args[2] = "-K";
-	args[3] = NULL;
-
-	pid = gnupg_exec(options->gpg_path, args, streams);
-
-	while (fgets(text, sizeof(text), streams[STDOUT_FILENO])) {
-	char	*type, *flags, *bits, *alg, *id, *date, *j1, *j2, *j3, *name, *j4;
-	char	 kstr[128];
-
-		text[strlen(text) - 1] = 0;
-		type = text;
-
-		if ((flags = index(type, ':')) == NULL)
-			continue;
-		*flags++ = 0;
-
-		if ((bits = index(flags, ':')) == NULL)
-			continue;
-		*bits++ = 0;
-		
-		if ((alg = index(bits, ':')) == NULL)
-			continue;
-		*alg++ = 0;
-
-		if ((id = index(alg, ':')) == NULL)
-			continue;
-		*id++ = 0;
-
-		if ((date = index(id, ':')) == NULL)
-			continue;
-		*date++ = 0;
-
-		if ((j1 = index(date, ':')) == NULL)
-			continue;
-		*j1++ = 0;
-
-		if ((j2 = index(j1, ':')) == NULL)
-			continue;
-		*j2++ = 0;
-
-		if ((j3 = index(j2, ':')) == NULL)
-			continue;
-		*j3++ = 0;
-
-		if ((name = index(j3, ':')) == NULL)
-			continue;
-		*name++ = 0;
-
-		if ((j4 = index(name, ':')) == NULL)
-			continue;
-		*j4++ = 0;
-
-		if (strcmp(type, "sec"))
-			continue;
-
-		if (strlen(id) > 8)
-			id += 8;
-
-		snprintf(kstr, sizeof(kstr), "%s: %s (%s bits, created %s)",
-			 id, name, bits, date);
-
-		*ids = realloc(*ids, (*nids + 1) * (sizeof(char *)));
-		(*ids)[*nids] = xstrdup(kstr);
-		(*nids)++;
-	}
-
-	/* Tidy up */
-	gnupg_exec_end(pid, streams);
-	return 0;
+	return backend->list_ids(ids, nids);
 }
 
 char *
@@ -22,9 +22,6 @@
 #ifndef PW_GNUPG_H
 #define PW_GNUPG_H
 
-#include <libxml/tree.h>
-#include <libxml/parser.h>
-
 void		gnupg_forget_passphrase(void);
 
 int		gnupg_check_id(char const *);
@@ -35,9 +32,14 @@ int		gnupg_list_ids(char ***, size_t *);
 char           *gnupg_get_filename(int mode);
 const char     *gnupg_get_passphrase(void);
 
-int		gnupg_read(char const *, xmlDocPtr *);
-int		gnupg_write(xmlDocPtr, char *, char const *);
-int		gnupg_write_many(xmlDocPtr, char **, int, char const *);
+typedef int	(*gnupg_reader_t)(void *, char const *, size_t);
+
+int		gnupg_read(char const *, gnupg_reader_t, void *);
+typedef int	(*gnupg_writer_t)(FILE *, void *);
+
+int		gnupg_write(gnupg_writer_t, void *, char *, char const *);
+int		gnupg_write_many(gnupg_writer_t, void *, char **, int, char const *, int);
+int		gnupg_write_batch(gnupg_writer_t, void *, char *, char const *);
 
 char		*gnupg_find_program(void);
 
@@ -0,0 +1,82 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef	PW_GNUPG_BACKEND_H
+#define	PW_GNUPG_BACKEND_H
+
+/*
+ * The crypto backends used by gnupg.c.  A backend only does the work; asking
+ * for passphrases and reporting errors to the user is left to gnupg.c.
+ */
+
+/* Results of decrypt and encrypt */
+#define	GNUPG_OK		0
+#define	GNUPG_FAILED		-1
+#define	GNUPG_BADPASS		1
+#define	GNUPG_CANTOPEN		2
+#define	GNUPG_NOSECKEY		3
+#define	GNUPG_CANTWRITE		4
+
+/* Most recipients a file can be encrypted to */
+#define	GNUPG_MAX_RECIPIENTS	10
+
+/*
+ * The saver encrypts from its own thread while the UI carries on using the
+ * backend, so a backend locks whatever state it shares between calls.
+ */
+typedef struct gnupg_backend {
+	char const	*name;
+
+	/* Returns 0 if the backend can be used */
+	int	(*check)(void);
+
+	/*
+	 * Decrypt file with the passphrase, passing the plaintext to the
+	 * reader as it's produced.  On GNUPG_NOSECKEY, *recp may be set to
+	 * the recipient the file was encrypted to.
+	 */
+	int	(*decrypt)(char const *file, char const *pass,
+			   gnupg_reader_t, void *, char **recp);
+
+	/* Encrypt the output of the writer to file, for nids recipients */
+	int	(*encrypt)(char const *file, char **ids, int nids, int armor,
+			   gnupg_writer_t, void *);
+
+	/* As gnupg_check_id() and gnupg_list_ids() */
+	int	(*check_id)(char const *id);
+	int	(*list_ids)(char ***, size_t *);
+} gnupg_backend_t;
+
+/*
+ * Run a writer in its own thread, so the backend can feed gpg's output and
+ * errors at the same time.  The stream is closed when the writer finishes;
+ * gnupg_writer_wait() returns what the writer returned.
+ */
+typedef struct gnupg_writer_thread gnupg_writer_thread_t;
+
+gnupg_writer_thread_t	*gnupg_writer_start(FILE *, gnupg_writer_t, void *);
+int			 gnupg_writer_wait(gnupg_writer_thread_t *);
+
+extern gnupg_backend_t const	gnupg_exec_backend;
+#ifdef	HAVE_GPGME
+extern gnupg_backend_t const	gnupg_gpgme_backend;
+#endif
+
+#endif	/* !PW_GNUPG_BACKEND_H */
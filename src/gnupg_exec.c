@@ -0,0 +1,771 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (C) 2002  Ivan Kelly <ivan@ivankelly.net>
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The exec backend, which runs the gpg program for each operation.
+ */
+
+/*
+ * define for strings to look for in gpg's error output
+ * should allow for internationalization
+ */
+
+#define GPG_ERR_CANTWRITE	"file create error"
+#define GPG_ERR_CANTOPEN 	"can't open"
+#define GPG_ERR_BADPASSPHRASE	"bad passphrase"
+#define GPG_ERR_NOSECRETKEY	"secret key not available"
+
+/* end defines */
+
+/* size of the stdio buffer used when writing to gpg */
+#define	GNUPG_WRITE_BUFSIZ	65536
+
+/* how much is read from gpg at once */
+#define	GNUPG_READ_BUFSIZ	65536
+
+/* buckets in the keyring cache */
+#define	GNUPG_KEYCACHE_SIZE	64
+
+#include	<sys/types.h>
+#include	<sys/stat.h>
+#include	<sys/wait.h>
+#include	<poll.h>
+
+#include	<unistd.h>
+#include	<fcntl.h>
+#include	<pthread.h>
+#include	<stdlib.h>
+#include	<errno.h>
+#include	<limits.h>
+
+#include	"pwman.h"
+#include	"gnupg.h"
+#include	"gnupg_backend.h"
+
+/*
+ * The public keyring, as listed by gpg --with-colons --list-keys.  Each key
+ * is entered under its short key id and under every email address on it.
+ */
+typedef struct gnupg_keycache_ent {
+	char				*name;
+	int				 expired;
+	struct gnupg_keycache_ent	*next;
+} gnupg_keycache_ent_t;
+
+static gnupg_keycache_ent_t	*keycache[GNUPG_KEYCACHE_SIZE];
+static int			 keycache_valid;
+static char			*keycache_path;		/* gpg it was built with */
+static time_t			 keycache_mtime;
+static off_t			 keycache_size;
+
+/* The gpg whose version has been checked */
+static char			*checked_path;
+
+/*
+ * The saver encrypts from its own thread, so the keyring cache and
+ * checked_path are locked.  gpg itself runs without the lock held.
+ */
+static pthread_mutex_t		 gnupg_exec_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Keeps one thread's child from inheriting another's pipes */
+static pthread_mutex_t		 gnupg_spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Read gpg's stdout and stderr until both are closed, reading whichever has
+ * data so gpg never blocks writing to one while we wait on the other.  Output
+ * is passed straight to the reader; error messages are collected in *errp,
+ * which is NUL terminated.  out may be -1 if there's no output to read.
+ */
+static void
+gnupg_exec_drain(out, errfd, reader, arg, errp)
+	int		 out, errfd;
+	gnupg_reader_t	 reader;
+	void		*arg;
+	char	       **errp;
+{
+struct pollfd	 pfd[2];
+char		 chunk[GNUPG_READ_BUFSIZ];
+char		*err = NULL;
+size_t		 errlen = 0, errsize = 0;
+ssize_t		 n;
+int		 i, stopped = 0;
+
+	pfd[0].fd = out;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = errfd;
+	pfd[1].events = POLLIN;
+
+	while (pfd[0].fd != -1 || pfd[1].fd != -1) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < 2; i++) {
+			if (pfd[i].fd == -1 || pfd[i].revents == 0)
+				continue;
+
+			if ((n = read(pfd[i].fd, chunk, sizeof(chunk))) == -1) {
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				n = 0;
+			}
+
+			if (n == 0) {
+				pfd[i].fd = -1;
+				continue;
+			}
+
+			if (i == 0) {
+				if (!stopped && reader && reader(arg, chunk, n) != 0) {
+					debug("gnupg_read: reader stopped, discarding output");
+					stopped = 1;
+				}
+				continue;
+			}
+
+			if (errlen + n + 1 > errsize) {
+				if (errsize == 0)
+					errsize = STRING_LONG;
+				while (errlen + n + 1 > errsize)
+					errsize *= 2;
+				err = realloc(err, errsize);
+			}
+
+			memcpy(err + errlen, chunk, n);
+			errlen += n;
+			err[errlen] = 0;
+		}
+	}
+
+	bzero(chunk, sizeof(chunk));
+	*errp = err;
+}
+
+static int
+gnupg_str_in_buf(buf, check)
+	char const     *buf, *check;
+{
+	if ((buf == NULL) || (check == NULL))
+		return 0;
+
+	return strstr(buf, check) != NULL;
+}
+
+static int
+gnupg_exec(path, args, stream)
+	char const	*path;
+	char		**args;
+	FILE		*stream[3];
+{
+int		stdin_fd[2];
+int		stdout_fd[2];
+int		stderr_fd[2];
+int		pid, ret;
+
+	if ((path == NULL) || (args == NULL))
+		return -1;
+
+	/*
+	 * Our ends of the pipes are close-on-exec, and made and forked under
+	 * the lock, so gpg run from the other thread can't hold them open.
+	 */
+	pthread_mutex_lock(&gnupg_spawn_lock);
+	pipe(stdin_fd);
+	pipe(stdout_fd);
+	pipe(stderr_fd);
+	fcntl(stdin_fd[1], F_SETFD, FD_CLOEXEC);
+	fcntl(stdout_fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(stderr_fd[0], F_SETFD, FD_CLOEXEC);
+
+	pid = fork();
+	pthread_mutex_unlock(&gnupg_spawn_lock);
+
+	if (pid == -1) {
+		close(stdin_fd[0]);
+		close(stdin_fd[1]);
+		close(stdout_fd[0]);
+		close(stdout_fd[1]);
+		close(stderr_fd[0]);
+		close(stderr_fd[1]);
+		return -1;
+	}
+
+	/* Do the right thing with the fork */
+	if (pid == 0) {
+		close(stdout_fd[0]);
+		close(stdin_fd[1]);
+		close(stderr_fd[0]);
+
+		dup2(stdout_fd[1], STDOUT_FILENO);
+		dup2(stdin_fd[0], STDIN_FILENO);
+		dup2(stderr_fd[1], STDERR_FILENO);
+
+		ret = execv(path, args);
+		if (ret)
+			pw_abort("Failed to run %s, aborted with error code %d", path, errno);
+		abort();	/* NOTREACHED */
+	}
+
+	close(stdout_fd[1]);
+	close(stdin_fd[0]);
+	close(stderr_fd[1]);
+
+	if (stream != NULL) {
+		stream[STDOUT_FILENO] = fdopen(stdout_fd[0], "r");
+		stream[STDIN_FILENO] = fdopen(stdin_fd[1], "w");
+		stream[STDERR_FILENO] = fdopen(stderr_fd[0], "r");
+	}
+
+	return pid;
+}
+
+/*
+ * Close gpg's streams and wait for it, returning its exit status, or -1 if it
+ * was killed.
+ */
+static int
+gnupg_exec_end(pid, stream)
+	FILE	*stream[3];
+{
+int		status;
+
+	/* Close up */
+	debug("gnupg_exec_end : close streams");
+	if (stream[0])
+		fclose(stream[0]);
+
+	if (stream[1])
+		fclose(stream[1]);
+
+	if (stream[2])
+		fclose(stream[2]);
+
+	debug("waiting for pid %d", pid);
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status))
+		return -1;
+	return WEXITSTATUS(status);
+}
+
+static char    *
+gnupg_find_recp(str)
+	char const     *str;
+{
+char           *user, *start, *end;
+int		size;
+
+	debug(str);
+
+	/* Is it "<id>" ? */
+	start = strstr(str, "\"");
+	if (start != NULL) {
+		start += 1;
+		end = strstr(start, "\"");
+	} else {
+		/* Is it ID <id>\n? */
+		start = strstr(str, "ID");
+		if (start != NULL) {
+			start += 3;
+			end = strstr(start, "\n");
+		} else {
+			/* No idea */
+			return xstrdup("(not sure)");
+		}
+	}
+
+	size = end - start;
+	user = malloc(size + 1);
+	strcpy(user, start);
+	debug("Recipient is %s", user);
+	return user;
+}
+
+static int
+gnupg_exec_probe()
+{
+FILE           *streams[3];
+char           *args[3];
+int		pid, count, version[3];
+
+	debug("check_gnupg: start");
+	if (options->gpg_path == NULL)
+		return -1;
+
+	/* Only run gpg --version once for each gpg we're pointed at */
+	if (checked_path && strcmp(checked_path, options->gpg_path) == 0)
+		return 0;
+
+	args[0] = "gpg";
+	args[1] = "--version";
+	args[2] = NULL;
+
+	pid = gnupg_exec(options->gpg_path, args, streams);
+
+	/* this might do version checking someday if needed */
+	count = fscanf(streams[STDOUT_FILENO], "gpg (GnuPG) %d.%d.%d",
+		       &version[0], &version[1], &version[2]);
+	gnupg_exec_end(pid, streams);
+
+	debug("exec ended");
+	if (count != 3)
+		return -1;
+
+	debug("check_gnupg: Version %d.%d.%d", version[0], version[1], version[2]);
+	xfree(checked_path);
+	checked_path = xstrdup(options->gpg_path);
+	return 0;
+}
+
+static int
+gnupg_exec_check()
+{
+int	ret;
+
+	pthread_mutex_lock(&gnupg_exec_lock);
+	ret = gnupg_exec_probe();
+	pthread_mutex_unlock(&gnupg_exec_lock);
+	return ret;
+}
+
+static uint32_t
+gnupg_keycache_hash(s)
+	char const	*s;
+{
+uint32_t	h = 2166136261U;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char) *s) * 16777619U;
+	return h % GNUPG_KEYCACHE_SIZE;
+}
+
+static void
+gnupg_keycache_clear()
+{
+gnupg_keycache_ent_t	*e, *next;
+int			 i;
+
+	for (i = 0; i < GNUPG_KEYCACHE_SIZE; i++) {
+		for (e = keycache[i]; e; e = next) {
+			next = e->next;
+			free(e->name);
+			free(e);
+		}
+		keycache[i] = NULL;
+	}
+
+	keycache_valid = 0;
+}
+
+/*
+ * A key matching name is only expired if every key matching it is.
+ */
+static void
+gnupg_keycache_add(name, len, expired)
+	char const	*name;
+	size_t		 len;
+{
+gnupg_keycache_ent_t	*e;
+char			*s;
+uint32_t		 b;
+
+	s = xmalloc(len + 1);
+	memcpy(s, name, len);
+	s[len] = 0;
+
+	b = gnupg_keycache_hash(s);
+	for (e = keycache[b]; e; e = e->next) {
+		if (strcmp(e->name, s) == 0) {
+			e->expired = e->expired && expired;
+			free(s);
+			return;
+		}
+	}
+
+	e = xmalloc(sizeof(*e));
+	e->name = s;
+	e->expired = expired;
+	e->next = keycache[b];
+	keycache[b] = e;
+}
+
+/*
+ * Find the public keyring gpg will use, and return its mtime and size, so
+ * we know when the cache is out of date.
+ */
+static void
+gnupg_keyring_stat(mtime, size)
+	time_t	*mtime;
+	off_t	*size;
+{
+static char const	*rings[] = {
+	"pubring.kbx", "pubring.gpg", "public-keys.d/pubring.db", NULL
+};
+struct stat		 sb;
+char			 path[PATH_MAX];
+char const		*home, *sub = "";
+int			 i;
+
+	*mtime = 0;
+	*size = 0;
+
+	if ((home = getenv("GNUPGHOME")) == NULL) {
+		if ((home = getenv("HOME")) == NULL)
+			return;
+		sub = "/.gnupg";
+	}
+
+	for (i = 0; rings[i]; i++) {
+		snprintf(path, sizeof(path), "%s%s/%s", home, sub, rings[i]);
+		if (stat(path, &sb) == -1)
+			continue;
+
+		if (sb.st_mtime > *mtime)
+			*mtime = sb.st_mtime;
+		*size += sb.st_size;
+	}
+}
+
+static void
+gnupg_keycache_load()
+{
+int		pid;
+char		text[STRING_LONG];
+char		*args[4];
+FILE           *streams[3];
+char           *field[10], *p, *q;
+int		nfields, expired = 0;
+size_t		len;
+
+	gnupg_keycache_clear();
+
+	args[0] = "gpg";
+	args[1] = "--with-colons";
+	args[2] = "--list-keys";
+	args[3] = NULL;
+
+	debug("gnupg_keycache_load: reading keyring");
+	pid = gnupg_exec(options->gpg_path, args, streams);
+
+	while (fgets(text, sizeof(text), streams[STDOUT_FILENO])) {
+		nfields = 0;
+		for (p = text; nfields < 10; p = q + 1) {
+			field[nfields++] = p;
+			if ((q = index(p, ':')) == NULL)
+				break;
+			*q = 0;
+		}
+
+		if (strcmp(field[0], "pub") == 0) {
+			if (nfields < 5)
+				continue;
+
+			expired = (field[1][0] == 'e');
+
+			/* Keys are looked up by the last 8 digits of the id */
+			if ((len = strlen(field[4])) >= 8)
+				gnupg_keycache_add(field[4] + len - 8, 8, expired);
+
+		} else if (strcmp(field[0], "uid") != 0)
+			continue;
+
+		/* "Name <email>", on the uid record (or pub, for gpg 1.x) */
+		if (nfields < 10)
+			continue;
+
+		if ((p = index(field[9], '<')) != NULL &&
+		    (q = index(p + 1, '>')) != NULL)
+			gnupg_keycache_add(p + 1, q - p - 1, expired);
+	}
+
+	gnupg_exec_end(pid, streams);
+
+	xfree(keycache_path);
+	keycache_path = xstrdup(options->gpg_path);
+	keycache_valid = 1;
+}
+
+/* Returns 0 if found, -1 if not found, and -2 if found but expired */
+static int
+gnupg_exec_find_id(id)
+	char const     *id;
+{
+gnupg_keycache_ent_t	*e;
+time_t			 mtime;
+off_t			 size;
+
+	debug("check_gnupg_id: check gnupg id\n");
+
+	if (options->gpg_path == NULL)
+		return -1;
+
+	/*
+	 * Re-read the keyring if it's changed since we last looked, or
+	 * we're using a different gpg.
+	 */
+	gnupg_keyring_stat(&mtime, &size);
+	if (!keycache_valid || mtime != keycache_mtime || size != keycache_size ||
+	    strcmp(keycache_path, options->gpg_path) != 0) {
+		gnupg_keycache_load();
+		keycache_mtime = mtime;
+		keycache_size = size;
+	}
+
+	/* Key ids and email addresses are both in the cache */
+	for (e = keycache[gnupg_keycache_hash(id)]; e; e = e->next) {
+		if (strcmp(e->name, id) != 0)
+			continue;
+
+		/* If we found it, return found / found+expired */
+		if (e->expired)
+			return -2;
+		return 0;
+	}
+
+	/* Didn't find it */
+	return -1;
+}
+
+static int
+gnupg_exec_check_id(id)
+	char const     *id;
+{
+int	ret;
+
+	pthread_mutex_lock(&gnupg_exec_lock);
+	ret = gnupg_exec_find_id(id);
+	pthread_mutex_unlock(&gnupg_exec_lock);
+	return ret;
+}
+
+static int
+gnupg_exec_decrypt(file, pass, reader, arg, recp)
+	char const	*file, *pass;
+	gnupg_reader_t	 reader;
+	void		*arg;
+	char	       **recp;
+{
+char           *args[9], *err = NULL;
+FILE           *streams[3];
+int		pid, pos, ret = GNUPG_OK;
+
+	pos = 0;
+	args[pos++] = "gpg";
+	args[pos++] = "--passphrase-fd";
+	args[pos++] = "0";
+	args[pos++] = "--no-verbose";
+	args[pos++] = "--batch";
+	args[pos++] = "--output";
+	args[pos++] = "-";
+	args[pos++] = (char *) file;
+	args[pos++] = NULL;
+
+	if ((pid = gnupg_exec(options->gpg_path, args, streams)) == -1)
+		return GNUPG_FAILED;
+
+	fputs(pass, streams[STDIN_FILENO]);
+	fputc('\n', streams[STDIN_FILENO]);
+	fclose(streams[STDIN_FILENO]);
+	streams[STDIN_FILENO] = NULL;
+
+	debug("gnupg_read: start reading data");
+	gnupg_exec_drain(fileno(streams[STDOUT_FILENO]),
+			 fileno(streams[STDERR_FILENO]), reader, arg, &err);
+
+	gnupg_exec_end(pid, streams);
+
+	debug("gnupg_read: start error checking");
+	debug(err);
+
+	/*
+	 * check for errors(no key, bad pass, no file etc etc)
+	 */
+	if (gnupg_str_in_buf(err, GPG_ERR_BADPASSPHRASE))
+		ret = GNUPG_BADPASS;
+	else if (gnupg_str_in_buf(err, GPG_ERR_CANTOPEN))
+		ret = GNUPG_CANTOPEN;
+	else if (gnupg_str_in_buf(err, GPG_ERR_NOSECRETKEY)) {
+		*recp = gnupg_find_recp(err);
+		ret = GNUPG_NOSECKEY;
+	}
+
+	xfree(err);
+	return ret;
+}
+
+static int
+gnupg_exec_encrypt(file, ids, nids, armor, writer, arg)
+	char const	*file;
+	char	       **ids;
+	gnupg_writer_t	 writer;
+	void		*arg;
+{
+FILE           *streams[3];
+char           *args[7 + 1 + (2 * GNUPG_MAX_RECIPIENTS)];
+char           *err = NULL;
+gnupg_writer_thread_t	*wt;
+int		pid, i, pos, ret = GNUPG_OK;
+
+	pos = 0;
+	args[pos++] = "gpg";
+	args[pos++] = "-e";
+	if (armor)
+		args[pos++] = "-a";
+	args[pos++] = "--always-trust";	/* gets rid of error when moving keys
+					 * from other machines */
+	args[pos++] = "--yes";
+	args[pos++] = "-o";
+	args[pos++] = (char *) file;
+
+	/* Add in all the recipients */
+	for (i = 0; i < nids && i < GNUPG_MAX_RECIPIENTS; i++) {
+		args[pos++] = "-r";
+		args[pos++] = ids[i];
+	}
+	args[pos] = NULL;
+
+	if ((pid = gnupg_exec(options->gpg_path, args, streams)) == -1)
+		return GNUPG_FAILED;
+
+	/*
+	 * Serialise in another thread while we collect gpg's output here, so
+	 * serialising and encrypting happen at the same time.
+	 */
+	setvbuf(streams[STDIN_FILENO], NULL, _IOFBF, GNUPG_WRITE_BUFSIZ);
+	wt = gnupg_writer_start(streams[STDIN_FILENO], writer, arg);
+	streams[STDIN_FILENO] = NULL;
+
+	gnupg_exec_drain(fileno(streams[STDOUT_FILENO]),
+			 fileno(streams[STDERR_FILENO]), NULL, NULL, &err);
+
+	if (gnupg_writer_wait(wt) != 0) {
+		debug("gnupg_write: writer failed");
+		ret = GNUPG_FAILED;
+	}
+	if (gnupg_exec_end(pid, streams) != 0)
+		ret = GNUPG_FAILED;
+
+	debug("gnupg_write: start error checking");
+
+	/*
+	 * check for errors(no key, bad pass, no file etc etc)
+	 */
+	if (gnupg_str_in_buf(err, GPG_ERR_CANTWRITE))
+		ret = GNUPG_CANTWRITE;
+
+	xfree(err);
+	return ret;
+}
+
+static int
+gnupg_exec_list_ids(ids, nids)
+	char	***ids;
+	size_t	  *nids;
+{
+int		pid;
+char		text[STRING_LONG];
+char		*args[4];
+FILE           *streams[3];
+
+	*ids = NULL;
+	*nids = 0;
+
+	args[0] = "gpg";
+	args[1] = "--with-colons";
+	args[2] = "-K";
+	args[3] = NULL;
+
+	pid = gnupg_exec(options->gpg_path, args, streams);
+
+	while (fgets(text, sizeof(text), streams[STDOUT_FILENO])) {
+	char	*type, *flags, *bits, *alg, *id, *date, *j1, *j2, *j3, *name, *j4;
+	char	 kstr[128];
+
+		text[strlen(text) - 1] = 0;
+		type = text;
+
+		if ((flags = index(type, ':')) == NULL)
+			continue;
+		*flags++ = 0;
+
+		if ((bits = index(flags, ':')) == NULL)
+			continue;
+		*bits++ = 0;
+
+		if ((alg = index(bits, ':')) == NULL)
+			continue;
+		*alg++ = 0;
+
+		if ((id = index(alg, ':')) == NULL)
+			continue;
+		*id++ = 0;
+
+		if ((date = index(id, ':')) == NULL)
+			continue;
+		*date++ = 0;
+
+		if ((j1 = index(date, ':')) == NULL)
+			continue;
+		*j1++ = 0;
+
+		if ((j2 = index(j1, ':')) == NULL)
+			continue;
+		*j2++ = 0;
+
+		if ((j3 = index(j2, ':')) == NULL)
+			continue;
+		*j3++ = 0;
+
+		if ((name = index(j3, ':')) == NULL)
+			continue;
+		*name++ = 0;
+
+		if ((j4 = index(name, ':')) == NULL)
+			continue;
+		*j4++ = 0;
+
+		if (strcmp(type, "sec"))
+			continue;
+
+		if (strlen(id) > 8)
+			id += 8;
+
+		snprintf(kstr, sizeof(kstr), "%s: %s (%s bits, created %s)",
+			 id, name, bits, date);
+
+		*ids = realloc(*ids, (*nids + 1) * (sizeof(char *)));
+		(*ids)[*nids] = xstrdup(kstr);
+		(*nids)++;
+	}
+
+	/* Tidy up */
+	gnupg_exec_end(pid, streams);
+	return 0;
+}
+
+gnupg_backend_t const gnupg_exec_backend = {
+	"exec",
+	gnupg_exec_check,
+	gnupg_exec_decrypt,
+	gnupg_exec_encrypt,
+	gnupg_exec_check_id,
+	gnupg_exec_list_ids,
+};
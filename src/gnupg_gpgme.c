@@ -0,0 +1,444 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The GPGME backend.  One GPGME context is kept for the whole session, and
+ * recipient keys are looked up once and remembered, so a save is a single
+ * encryption operation.  Saves get a context of their own, so encrypting in
+ * the saver's thread doesn't hold up the rest.
+ */
+
+#include	"pwman.h"
+
+#ifdef	HAVE_GPGME
+
+#include	<sys/types.h>
+
+#include	<stdlib.h>
+#include	<fcntl.h>
+#include	<unistd.h>
+#include	<locale.h>
+#include	<signal.h>
+#include	<pthread.h>
+
+#include	<gpgme.h>
+
+#include	"gnupg.h"
+#include	"gnupg_backend.h"
+
+/* A recipient we've already looked up */
+typedef struct gnupg_gpgme_key {
+	char			*id;
+	gpgme_key_t		 key;
+	struct gnupg_gpgme_key	*next;
+} gnupg_gpgme_key_t;
+
+/* What decrypted data is passed to */
+typedef struct gnupg_gpgme_sink {
+	gnupg_reader_t	 reader;
+	void		*arg;
+	int		 stopped;
+} gnupg_gpgme_sink_t;
+
+static gpgme_ctx_t		 ctx;
+static int			 ready;
+static char const		*cur_pass;	/* for the current operation */
+static gnupg_gpgme_key_t	*keys;
+
+/* Covers everything above */
+static pthread_mutex_t		 gnupg_gpgme_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static gpgme_error_t
+gnupg_gpgme_passphrase(hook, uid_hint, info, prev_was_bad, fd)
+	void		*hook;
+	char const	*uid_hint, *info;
+	int		 prev_was_bad, fd;
+{
+	/* Don't let gpg retry with the same passphrase; we'll ask again */
+	if (prev_was_bad || !cur_pass)
+		return gpg_error(GPG_ERR_BAD_PASSPHRASE);
+
+	if (gpgme_io_writen(fd, cur_pass, strlen(cur_pass)) != 0 ||
+	    gpgme_io_writen(fd, "\n", 1) != 0)
+		return gpg_error(GPG_ERR_CANCELED);
+
+	return 0;
+}
+
+static int
+gnupg_gpgme_new_ctx(c)
+	gpgme_ctx_t	*c;
+{
+	if (gpgme_new(c) != 0)
+		return -1;
+
+	/* Use the gpg the user configured, rather than GPGME's default */
+	if (options->gpg_path)
+		gpgme_ctx_set_engine_info(*c, GPGME_PROTOCOL_OpenPGP,
+					  options->gpg_path, NULL);
+
+	gpgme_set_protocol(*c, GPGME_PROTOCOL_OpenPGP);
+	gpgme_set_pinentry_mode(*c, GPGME_PINENTRY_MODE_LOOPBACK);
+	gpgme_set_passphrase_cb(*c, gnupg_gpgme_passphrase, NULL);
+	return 0;
+}
+
+/* Called with the lock held */
+static int
+gnupg_gpgme_setup()
+{
+	if (ready)
+		return 0;
+
+	/* GPGME reports a closed pipe as an error; don't die of SIGPIPE */
+	signal(SIGPIPE, SIG_IGN);
+
+	setlocale(LC_ALL, "");
+	if (gpgme_check_version(NULL) == NULL)
+		return -1;
+
+	gpgme_set_locale(NULL, LC_CTYPE, setlocale(LC_CTYPE, NULL));
+
+	if (gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP) != 0)
+		return -1;
+
+	if (gnupg_gpgme_new_ctx(&ctx) != 0)
+		return -1;
+
+	debug("gnupg_gpgme_check: using GPGME %s", gpgme_check_version(NULL));
+	ready = 1;
+	return 0;
+}
+
+static int
+gnupg_gpgme_check()
+{
+int	ret;
+
+	pthread_mutex_lock(&gnupg_gpgme_lock);
+	ret = gnupg_gpgme_setup();
+	pthread_mutex_unlock(&gnupg_gpgme_lock);
+	return ret;
+}
+
+/*
+ * Look up the key for id, remembering it for next time.  *expired is set if
+ * the only matching keys have expired.  Called with the lock held; the keys
+ * are kept until we exit, so can be used after it's released.
+ */
+static gpgme_key_t
+gnupg_gpgme_find_key(id, expired)
+	char const	*id;
+	int		*expired;
+{
+gnupg_gpgme_key_t	*k;
+gpgme_key_t		 key, found = NULL;
+
+	*expired = 0;
+
+	for (k = keys; k; k = k->next)
+		if (strcmp(k->id, id) == 0)
+			return k->key;
+
+	if (gpgme_op_keylist_start(ctx, id, 0) != 0)
+		return NULL;
+
+	while (gpgme_op_keylist_next(ctx, &key) == 0) {
+		if (found || key->revoked || key->disabled || key->invalid) {
+			gpgme_key_unref(key);
+			continue;
+		}
+
+		if (key->expired || !key->can_encrypt) {
+			*expired = *expired || key->expired;
+			gpgme_key_unref(key);
+			continue;
+		}
+
+		found = key;
+	}
+	gpgme_op_keylist_end(ctx);
+
+	if (!found)
+		return NULL;
+
+	*expired = 0;
+	k = xcalloc(1, sizeof(*k));
+	k->id = xstrdup(id);
+	k->key = found;
+	k->next = keys;
+	keys = k;
+
+	return found;
+}
+
+static int
+gnupg_gpgme_check_id(id)
+	char const	*id;
+{
+int	expired, ret = -1;
+
+	pthread_mutex_lock(&gnupg_gpgme_lock);
+	if (gnupg_gpgme_setup() == 0) {
+		if (gnupg_gpgme_find_key(id, &expired) != NULL)
+			ret = 0;
+		else if (expired)
+			ret = -2;
+	}
+	pthread_mutex_unlock(&gnupg_gpgme_lock);
+	return ret;
+}
+
+static ssize_t
+gnupg_gpgme_write(handle, buf, size)
+	void		*handle;
+	void const	*buf;
+	size_t		 size;
+{
+gnupg_gpgme_sink_t	*sink = handle;
+
+	if (!sink->stopped && sink->reader(sink->arg, buf, size) != 0) {
+		debug("gnupg_read: reader stopped, discarding output");
+		sink->stopped = 1;
+	}
+
+	return size;
+}
+
+static int
+gnupg_gpgme_decrypt(file, pass, reader, arg, recp)
+	char const	*file, *pass;
+	gnupg_reader_t	 reader;
+	void		*arg;
+	char	       **recp;
+{
+struct gpgme_data_cbs	 cbs;
+gnupg_gpgme_sink_t	 sink;
+gpgme_data_t		 cipher, plain;
+gpgme_decrypt_result_t	 res;
+gpgme_error_t		 err;
+int			 fd, ret = GNUPG_OK;
+
+	if ((fd = open(file, O_RDONLY)) == -1)
+		return GNUPG_CANTOPEN;
+
+	bzero(&cbs, sizeof(cbs));
+	cbs.write = gnupg_gpgme_write;
+	sink.reader = reader;
+	sink.arg = arg;
+	sink.stopped = 0;
+
+	if (gpgme_data_new_from_fd(&cipher, fd) != 0) {
+		close(fd);
+		return GNUPG_FAILED;
+	}
+
+	if (gpgme_data_new_from_cbs(&plain, &cbs, &sink) != 0) {
+		gpgme_data_release(cipher);
+		close(fd);
+		return GNUPG_FAILED;
+	}
+
+	pthread_mutex_lock(&gnupg_gpgme_lock);
+	if (gnupg_gpgme_setup() != 0)
+		err = gpg_error(GPG_ERR_GENERAL);
+	else {
+		cur_pass = pass;
+		err = gpgme_op_decrypt(ctx, cipher, plain);
+		cur_pass = NULL;
+	}
+
+	switch (gpgme_err_code(err)) {
+	case GPG_ERR_NO_ERROR:
+		break;
+
+	case GPG_ERR_BAD_PASSPHRASE:
+		ret = GNUPG_BADPASS;
+		break;
+
+	case GPG_ERR_NO_SECKEY:
+		ret = GNUPG_NOSECKEY;
+		if ((res = gpgme_op_decrypt_result(ctx)) != NULL &&
+		    res->recipients && res->recipients->keyid)
+			*recp = xstrdup(res->recipients->keyid);
+		break;
+
+	default:
+		debug("gnupg_gpgme_decrypt: %s", gpgme_strerror(err));
+		ret = GNUPG_FAILED;
+		break;
+	}
+	pthread_mutex_unlock(&gnupg_gpgme_lock);
+
+	gpgme_data_release(plain);
+	gpgme_data_release(cipher);
+	close(fd);
+
+	return ret;
+}
+
+static int
+gnupg_gpgme_encrypt(file, ids, nids, armor, writer, arg)
+	char const	*file;
+	char	       **ids;
+	gnupg_writer_t	 writer;
+	void		*arg;
+{
+gpgme_key_t		 rcpt[GNUPG_MAX_RECIPIENTS + 1];
+gpgme_ctx_t		 ectx;
+gpgme_data_t		 cipher, plain;
+gpgme_error_t		 err;
+gnupg_writer_thread_t	*wt;
+FILE			*fp;
+int			 fd, i, expired, pfd[2], ret = GNUPG_OK;
+
+	pthread_mutex_lock(&gnupg_gpgme_lock);
+	if (gnupg_gpgme_setup() != 0)
+		i = -1;
+	else
+		for (i = 0; i < nids && i < GNUPG_MAX_RECIPIENTS; i++)
+			if ((rcpt[i] = gnupg_gpgme_find_key(ids[i], &expired)) == NULL) {
+				i = -1;
+				break;
+			}
+	pthread_mutex_unlock(&gnupg_gpgme_lock);
+
+	if (i == -1)
+		return GNUPG_FAILED;
+	rcpt[i] = NULL;
+
+	if (gnupg_gpgme_new_ctx(&ectx) != 0)
+		return GNUPG_FAILED;
+
+	if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		gpgme_release(ectx);
+		return GNUPG_CANTWRITE;
+	}
+
+	if (gpgme_data_new_from_fd(&cipher, fd) != 0) {
+		gpgme_release(ectx);
+		close(fd);
+		return GNUPG_FAILED;
+	}
+
+	/*
+	 * The writer runs in its own thread and feeds GPGME through a pipe,
+	 * so the plaintext is encrypted as it's produced.
+	 */
+	if (pipe(pfd) == -1) {
+		gpgme_data_release(cipher);
+		gpgme_release(ectx);
+		close(fd);
+		return GNUPG_FAILED;
+	}
+
+	if ((fp = fdopen(pfd[1], "w")) == NULL) {
+		close(pfd[0]);
+		close(pfd[1]);
+		gpgme_data_release(cipher);
+		gpgme_release(ectx);
+		close(fd);
+		return GNUPG_FAILED;
+	}
+
+	wt = gnupg_writer_start(fp, writer, arg);
+
+	if (gpgme_data_new_from_fd(&plain, pfd[0]) != 0)
+		ret = GNUPG_FAILED;
+	else {
+		gpgme_set_armor(ectx, armor);
+		err = gpgme_op_encrypt(ectx, rcpt, GPGME_ENCRYPT_ALWAYS_TRUST,
+				       plain, cipher);
+		if (err != 0) {
+			debug("gnupg_gpgme_encrypt: %s", gpgme_strerror(err));
+			ret = GNUPG_FAILED;
+		}
+		gpgme_data_release(plain);
+	}
+
+	/* Closing the pipe stops the writer if GPGME gave up early */
+	close(pfd[0]);
+	if (gnupg_writer_wait(wt) != 0) {
+		debug("gnupg_write: writer failed");
+		ret = GNUPG_FAILED;
+	}
+
+	gpgme_data_release(cipher);
+	gpgme_release(ectx);
+	if (close(fd) == -1)
+		ret = GNUPG_CANTWRITE;
+
+	return ret;
+}
+
+static int
+gnupg_gpgme_list_ids(ids, nids)
+	char	***ids;
+	size_t	  *nids;
+{
+gpgme_key_t	key;
+char		kstr[128];
+char const	*id;
+
+	*ids = NULL;
+	*nids = 0;
+
+	pthread_mutex_lock(&gnupg_gpgme_lock);
+	if (gnupg_gpgme_setup() != 0 || gpgme_op_keylist_start(ctx, NULL, 1) != 0) {
+		pthread_mutex_unlock(&gnupg_gpgme_lock);
+		return -1;
+	}
+
+	while (gpgme_op_keylist_next(ctx, &key) == 0) {
+		if (!key->subkeys || !key->uids) {
+			gpgme_key_unref(key);
+			continue;
+		}
+
+		id = key->subkeys->keyid;
+		if (strlen(id) > 8)
+			id += strlen(id) - 8;
+
+		snprintf(kstr, sizeof(kstr), "%s: %s (%u bits, created %ld)",
+			 id, key->uids->uid, key->subkeys->length,
+			 (long) key->subkeys->timestamp);
+
+		*ids = realloc(*ids, (*nids + 1) * (sizeof(char *)));
+		(*ids)[*nids] = xstrdup(kstr);
+		(*nids)++;
+
+		gpgme_key_unref(key);
+	}
+	gpgme_op_keylist_end(ctx);
+	pthread_mutex_unlock(&gnupg_gpgme_lock);
+
+	return 0;
+}
+
+gnupg_backend_t const gnupg_gpgme_backend = {
+	"gpgme",
+	gnupg_gpgme_check,
+	gnupg_gpgme_decrypt,
+	gnupg_gpgme_encrypt,
+	gnupg_gpgme_check_id,
+	gnupg_gpgme_list_ids,
+};
+
+#endif	/* HAVE_GPGME */
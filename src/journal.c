@@ -0,0 +1,800 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The change journal.  gpg can't decrypt several messages appended to one
+ * file, so the records are kept in memory and the whole journal is
+ * re-encrypted, by the background saver, each time it's written; its size is
+ * bounded by JOURNAL_MAX_SIZE, so the cost of saving a change doesn't depend
+ * on the size of the database.
+ *
+ * The plaintext is:
+ *
+ *	magic		"PWMJ"
+ *	version		JOURNAL_VERSION
+ *	base		st_ino, st_size, st_mtime of the database it applies to
+ *	records		until the end of the file
+ *
+ * with integers as unsigned LEB128 varints and strings as (length + 1,
+ * bytes), or 0 for no value.  A record is a type followed by:
+ *
+ *	J_ENTRY		id, list id, name, host, user, passwd, launch
+ *	J_DELENTRY	id
+ *	J_LIST		id, parent id (0 for the top-level list), name
+ *	J_DELLIST	id
+ *
+ * J_ENTRY and J_LIST create the entry or list if it doesn't exist, and
+ * otherwise update it, moving it to the end of its new parent if that has
+ * changed.  Anything the journal can't describe (such as reordering a list)
+ * is saved by writing the whole database instead.
+ *
+ * The header is added when the journal is written, from the database file
+ * as it is then, since a full write of the database may still be queued
+ * when the records are taken.
+ */
+
+#include	<sys/types.h>
+#include	<sys/stat.h>
+
+#include	<stdlib.h>
+#include	<string.h>
+#include	<limits.h>
+#include	<unistd.h>
+
+#include	"pwman.h"
+#include	"gnupg.h"
+#include	"saver.h"
+#include	"journal.h"
+#include	"trigram.h"
+#include	"ui.h"
+
+#define	JOURNAL_MAGIC		"PWMJ"
+#define	JOURNAL_MAGIC_LEN	4
+#define	JOURNAL_VERSION		1
+
+#define	J_ENTRY		1
+#define	J_DELENTRY	2
+#define	J_LIST		3
+#define	J_DELLIST	4
+
+/* Id to object map used while replaying */
+typedef struct journal_ids {
+	int		*keys;
+	void	       **objs;
+	size_t		 size, n;
+} journal_ids_t;
+
+static int	 recording = 1;	/* changes are being tracked */
+static int	 usable;	/* changes can be appended to the journal */
+static int	 dirty;		/* changes haven't been saved yet */
+
+/* The records in the journal */
+static unsigned char	*jbuf;
+static size_t		 jlen, jsize;
+
+static void
+journal_grow(need)
+	size_t	need;
+{
+unsigned char	*new;
+size_t		 newsize = jsize ? jsize : BUFSIZ;
+
+	if (jlen + need <= jsize)
+		return;
+
+	while (newsize < jlen + need)
+		newsize *= 2;
+
+	new = xmalloc(newsize);
+	if (jbuf) {
+		memcpy(new, jbuf, jlen);
+		bzero(jbuf, jsize);
+		free(jbuf);
+	}
+
+	jbuf = new;
+	jsize = newsize;
+}
+
+static void
+journal_clear()
+{
+	if (jbuf) {
+		bzero(jbuf, jsize);
+		free(jbuf);
+	}
+
+	jbuf = NULL;
+	jlen = jsize = 0;
+}
+
+static void
+journal_put_varint(v)
+	uint64_t	v;
+{
+	journal_grow(10);
+
+	while (v >= 0x80) {
+		jbuf[jlen++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	jbuf[jlen++] = v;
+}
+
+static void
+journal_put_string(s)
+	char const	*s;
+{
+size_t	len;
+
+	if (!s) {
+		journal_put_varint(0);
+		return;
+	}
+
+	len = strlen(s);
+	journal_put_varint(len + 1);
+	journal_grow(len);
+	memcpy(jbuf + jlen, s, len);
+	jlen += len;
+}
+
+static int
+journal_get_varint(pos, ret)
+	size_t		*pos;
+	uint64_t	*ret;
+{
+uint64_t	v = 0;
+int		shift;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if (*pos >= jlen)
+			return -1;
+
+		v |= (uint64_t) (jbuf[*pos] & 0x7F) << shift;
+		if ((jbuf[(*pos)++] & 0x80) == 0) {
+			*ret = v;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int
+journal_get_id(pos, ret)
+	size_t	*pos;
+	int	*ret;
+{
+uint64_t	v;
+
+	if (journal_get_varint(pos, &v) == -1 || v > INT_MAX)
+		return -1;
+
+	*ret = v;
+	return 0;
+}
+
+/*
+ * Return a copy of the string at *pos in *ret, or NULL if it has no value.
+ */
+static int
+journal_get_string(pos, ret)
+	size_t	 *pos;
+	char	**ret;
+{
+uint64_t	len;
+
+	if (journal_get_varint(pos, &len) == -1)
+		return -1;
+
+	if (len == 0) {
+		*ret = NULL;
+		return 0;
+	}
+
+	if (--len > jlen - *pos)
+		return -1;
+
+	*ret = xmalloc(len + 1);
+	memcpy(*ret, jbuf + *pos, len);
+	(*ret)[len] = '\0';
+	*pos += len;
+	return 0;
+}
+
+/*
+ * Identify the database file, so a journal written against an older copy
+ * of it isn't replayed.
+ */
+static int
+journal_base(file, base)
+	char const	*file;
+	uint64_t	*base;
+{
+struct stat	sb;
+
+	if (stat(file, &sb) == -1)
+		return -1;
+
+	base[0] = sb.st_ino;
+	base[1] = sb.st_size;
+	base[2] = sb.st_mtime;
+	return 0;
+}
+
+static void
+journal_fput_varint(fp, v)
+	FILE		*fp;
+	uint64_t	 v;
+{
+	while (v >= 0x80) {
+		putc((v & 0x7F) | 0x80, fp);
+		v >>= 7;
+	}
+	putc(v, fp);
+}
+
+static void
+journal_fput_header(fp, base)
+	FILE		*fp;
+	uint64_t	*base;
+{
+	fwrite(JOURNAL_MAGIC, 1, JOURNAL_MAGIC_LEN, fp);
+	journal_fput_varint(fp, JOURNAL_VERSION);
+	journal_fput_varint(fp, base[0]);
+	journal_fput_varint(fp, base[1]);
+	journal_fput_varint(fp, base[2]);
+}
+
+/*
+ * Check the header against base, and return the offset of the first record,
+ * or 0 if the journal doesn't apply to this database.
+ */
+static size_t
+journal_check_header(base)
+	uint64_t	*base;
+{
+size_t		pos = JOURNAL_MAGIC_LEN;
+uint64_t	v;
+int		i;
+
+	if (jlen < JOURNAL_MAGIC_LEN || memcmp(jbuf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0)
+		return 0;
+
+	if (journal_get_varint(&pos, &v) == -1 || v != JOURNAL_VERSION)
+		return 0;
+
+	for (i = 0; i < 3; i++)
+		if (journal_get_varint(&pos, &v) == -1 || v != base[i])
+			return 0;
+
+	return pos;
+}
+
+static void **
+journal_ids_slot(ids, key)
+	journal_ids_t	*ids;
+	int		 key;
+{
+size_t	i = (unsigned) key & (ids->size - 1);
+
+	while (ids->keys[i] && ids->keys[i] != key)
+		i = (i + 1) & (ids->size - 1);
+
+	return &ids->objs[i];
+}
+
+static void *
+journal_ids_find(ids, key)
+	journal_ids_t	*ids;
+	int		 key;
+{
+	return *journal_ids_slot(ids, key);
+}
+
+static void
+journal_ids_set(ids, key, obj)
+	journal_ids_t	*ids;
+	int		 key;
+	void		*obj;
+{
+void	**slot;
+size_t	  i;
+
+	/* Keep the table at most half full */
+	if ((ids->n + 1) * 2 > ids->size) {
+	journal_ids_t	new;
+
+		new.size = ids->size ? ids->size * 2 : 64;
+		new.n = 0;
+		new.keys = xcalloc(new.size, sizeof(*new.keys));
+		new.objs = xcalloc(new.size, sizeof(*new.objs));
+
+		for (i = 0; i < ids->size; i++)
+			if (ids->keys[i])
+				journal_ids_set(&new, ids->keys[i], ids->objs[i]);
+
+		free(ids->keys);
+		free(ids->objs);
+		*ids = new;
+	}
+
+	slot = journal_ids_slot(ids, key);
+	if (ids->keys[slot - ids->objs] == 0) {
+		ids->keys[slot - ids->objs] = key;
+		ids->n++;
+	}
+	*slot = obj;
+}
+
+static void
+journal_ids_add(lists, entries, top)
+	journal_ids_t	*lists, *entries;
+	folder_t	*top;
+{
+folder_iter_t	 it;
+password_t	*pw;
+folder_t	*list;
+uint32_t	 i;
+
+	folder_iter_init(&it, top, FOLDER_ENTER);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		journal_ids_set(lists, list->id, list);
+
+		PWLIST_FOREACH(pw, &list->list, i)
+			journal_ids_set(entries, list->list.ents[i].id, pw);
+	}
+}
+
+/*
+ * Forget a list which is about to be freed, along with everything in it.
+ */
+static void
+journal_ids_forget(lists, entries, top)
+	journal_ids_t	*lists, *entries;
+	folder_t	*top;
+{
+folder_iter_t	 it;
+folder_t	*list;
+uint32_t	 i;
+
+	folder_iter_init(&it, top, FOLDER_ENTER);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		*journal_ids_slot(lists, list->id) = NULL;
+
+		for (i = 0; i < list->list.n; i++)
+			*journal_ids_slot(entries, list->list.ents[i].id) = NULL;
+	}
+}
+
+static int
+journal_replay_entry(pos, lists, entries)
+	size_t		*pos;
+	journal_ids_t	*lists, *entries;
+{
+char		*fields[5];
+password_t	*pw;
+folder_t	*list;
+int		 id, lid, i, ret = -1;
+
+	bzero(fields, sizeof(fields));
+
+	if (journal_get_id(pos, &id) == -1 || journal_get_id(pos, &lid) == -1)
+		return -1;
+
+	for (i = 0; i < 5; i++)
+		if (journal_get_string(pos, &fields[i]) == -1)
+			goto end;
+
+	if (id == 0 || (list = journal_ids_find(lists, lid)) == NULL)
+		goto end;
+
+	if ((pw = journal_ids_find(entries, id)) == NULL) {
+		pw = pwstore_new();
+		PW_ENT(pw)->id = id;
+		journal_ids_set(entries, id, pw);
+	} else if (pw->parent != list)
+		folder_detach_pw(pw->parent, pw);
+
+	for (i = 0; i < PW_NFIELDS; i++)
+		pw_setfield(pw, i, fields[i]);
+
+	if (pw->parent == NULL)
+		folder_add_pw(list, pw);
+	else {
+		trigram_add(pw);
+		filter_invalidate();
+	}
+	ret = 0;
+
+end:
+	for (i = 0; i < 5; i++) {
+		if (fields[i])
+			bzero(fields[i], strlen(fields[i]));
+		xfree(fields[i]);
+	}
+	return ret;
+}
+
+static int
+journal_replay_list(pos, lists)
+	size_t		*pos;
+	journal_ids_t	*lists;
+{
+folder_t	*list, *parent = NULL;
+char		*name;
+int		 id, pid;
+
+	if (journal_get_id(pos, &id) == -1 || journal_get_id(pos, &pid) == -1 ||
+	    journal_get_string(pos, &name) == -1)
+		return -1;
+
+	list = journal_ids_find(lists, id);
+
+	/* Only the top-level list has no parent, and that always exists */
+	if (id == 0 || (pid == 0 && (!list || list->parent)) ||
+	    (pid && (parent = journal_ids_find(lists, pid)) == NULL)) {
+		xfree(name);
+		return -1;
+	}
+
+	if (list == NULL) {
+		list = folder_new(name ? name : "");
+		list->id = id;
+		journal_ids_set(lists, id, list);
+	} else {
+		folder_rename_sublist(list, name ? name : "");
+
+		if (list->parent != parent) {
+			folder_detach_sublist(list->parent, list);
+			list->parent = NULL;
+		}
+	}
+
+	if (parent && list->parent == NULL)
+		folder_add_sublist(parent, list);
+
+	xfree(name);
+	return 0;
+}
+
+static int
+journal_replay(pos, top)
+	size_t		 pos;
+	folder_t	*top;
+{
+journal_ids_t	 lists, entries;
+password_t	*pw;
+folder_t	*list;
+uint64_t	 type;
+int		 id, ret = 0;
+
+	bzero(&lists, sizeof(lists));
+	bzero(&entries, sizeof(entries));
+	journal_ids_add(&lists, &entries, top);
+
+	while (pos < jlen && ret == 0) {
+		if (journal_get_varint(&pos, &type) == -1) {
+			ret = -1;
+			break;
+		}
+
+		switch (type) {
+		case J_ENTRY:
+			ret = journal_replay_entry(&pos, &lists, &entries);
+			break;
+
+		case J_DELENTRY:
+			if ((ret = journal_get_id(&pos, &id)) == -1)
+				break;
+
+			if ((pw = journal_ids_find(&entries, id)) != NULL) {
+				*journal_ids_slot(&entries, id) = NULL;
+				pw_delete(pw);
+			}
+			break;
+
+		case J_LIST:
+			ret = journal_replay_list(&pos, &lists);
+			break;
+
+		case J_DELLIST:
+			if ((ret = journal_get_id(&pos, &id)) == -1)
+				break;
+
+			if ((list = journal_ids_find(&lists, id)) != NULL) {
+				if (!list->parent) {
+					ret = -1;
+					break;
+				}
+
+				journal_ids_forget(&lists, &entries, list);
+				folder_delete_sublist(list->parent, list);
+			}
+			break;
+
+		default:
+			ret = -1;
+			break;
+		}
+	}
+
+	free(lists.keys);
+	free(lists.objs);
+	free(entries.keys);
+	free(entries.objs);
+
+	return ret;
+}
+
+static int
+journal_read_chunk(arg, buf, len)
+	void		*arg;
+	char const	*buf;
+	size_t		 len;
+{
+	journal_grow(len);
+	memcpy(jbuf + jlen, buf, len);
+	jlen += len;
+	return 0;
+}
+
+/*
+ * Start tracking changes to top, which was just read from file.  If replay
+ * is set, the journal for file is replayed and later changes are appended
+ * to it; otherwise the database isn't in a format the journal can apply to,
+ * and the next change will cause it to be written out in full.
+ */
+int
+journal_open(file, top, replay)
+	char const	*file;
+	folder_t	*top;
+{
+char		jfile[PATH_MAX];
+uint64_t	base[3];
+size_t		pos;
+int		ret;
+
+	journal_close();
+
+	if (!replay || journal_base(file, base) == -1) {
+		recording = 1;
+		return 0;
+	}
+
+	snprintf(jfile, sizeof(jfile), "%s.journal", file);
+
+	if (access(jfile, F_OK) == 0) {
+		if ((ret = gnupg_read(jfile, journal_read_chunk, NULL)) != 0) {
+			journal_clear();
+			return ret;
+		}
+
+		if ((pos = journal_check_header(base)) != 0) {
+			if (journal_replay(pos, top) == -1) {
+				/* Keep what we could read, and write it all out */
+				ui_statusline_msg("Journal is damaged, some changes may be lost");
+				journal_clear();
+				recording = dirty = 1;
+				return 0;
+			}
+
+			debug("journal_open: replayed %lu bytes", (unsigned long) jlen);
+
+			/* Keep the records; the header is written afresh */
+			memmove(jbuf, jbuf + pos, jlen - pos);
+			jlen -= pos;
+			recording = usable = 1;
+			return 0;
+		}
+
+		/* The database was written after this journal; ignore it */
+		debug("journal_open: ignoring stale journal");
+		journal_clear();
+	}
+
+	recording = usable = 1;
+	return 0;
+}
+
+/*
+ * Stop tracking changes, e.g. while the database is being read.
+ */
+void
+journal_close()
+{
+	journal_clear();
+	recording = usable = dirty = 0;
+}
+
+/*
+ * Everything recorded so far is being written out in full, so start a new
+ * journal.
+ */
+void
+journal_restart()
+{
+	journal_clear();
+	dirty = 0;
+	usable = recording;
+}
+
+/*
+ * The database has been written to file in full, so the journal on disk no
+ * longer applies to it.  Called from the saver, so mustn't touch the
+ * in-memory journal.
+ */
+void
+journal_remove(file)
+	char const	*file;
+{
+char	jfile[PATH_MAX];
+
+	snprintf(jfile, sizeof(jfile), "%s.journal", file);
+	unlink(jfile);
+}
+
+int
+journal_pending()
+{
+	return dirty;
+}
+
+/*
+ * Copy the records for saving.  Returns -1 if the changes can't be saved
+ * to the journal, in which case the database should be written in full.
+ */
+int
+journal_snapshot(buf, len)
+	unsigned char	**buf;
+	size_t		 *len;
+{
+	if (!usable || jlen > JOURNAL_MAX_SIZE)
+		return -1;
+
+	*buf = xmalloc(jlen ? jlen : 1);
+	memcpy(*buf, jbuf, jlen);
+	*len = jlen;
+
+	dirty = 0;
+	return 0;
+}
+
+static int
+journal_write_buf(fp, arg)
+	FILE	*fp;
+	void	*arg;
+{
+saver_job_t	*job = arg;
+uint64_t	 base[3];
+
+	if (journal_base(job->file, base) == -1)
+		return -1;
+
+	journal_fput_header(fp, base);
+	fwrite(job->buf, 1, job->len, fp);
+	return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * Write a snapshot taken by journal_snapshot() to the journal for job->file.
+ * Run by the saver.
+ */
+int
+journal_save(job)
+	saver_job_t	*job;
+{
+char	jfile[PATH_MAX], tfile[PATH_MAX];
+
+	/* Without the database, there's nothing for the journal to apply to */
+	if (access(job->file, F_OK) == -1)
+		return -1;
+
+	snprintf(jfile, sizeof(jfile), "%s.journal", job->file);
+	snprintf(tfile, sizeof(tfile), "%s.journal.tmp", job->file);
+
+	if (gnupg_write_batch(journal_write_buf, job, job->id, tfile) != 0 ||
+	    rename(tfile, jfile) == -1)
+		return -1;
+
+	return 0;
+}
+
+void
+journal_put_entry(pw)
+	password_t	*pw;
+{
+	if (!recording || !pw->parent)
+		return;
+
+	dirty = 1;
+	if (!usable)
+		return;
+
+	journal_put_varint(J_ENTRY);
+	journal_put_varint(PW_ENT(pw)->id);
+	journal_put_varint(pw->parent->id);
+	journal_put_string(PW_FIELD(pw, PW_NAME));
+	journal_put_string(PW_FIELD(pw, PW_HOST));
+	journal_put_string(PW_FIELD(pw, PW_USER));
+	journal_put_string(PW_FIELD(pw, PW_PASSWD));
+	journal_put_string(PW_FIELD(pw, PW_LAUNCH));
+}
+
+void
+journal_del_entry(pw)
+	password_t	*pw;
+{
+	if (!recording || !pw->parent)
+		return;
+
+	dirty = 1;
+	if (!usable)
+		return;
+
+	journal_put_varint(J_DELENTRY);
+	journal_put_varint(PW_ENT(pw)->id);
+}
+
+void
+journal_put_list(list)
+	folder_t	*list;
+{
+	if (!recording)
+		return;
+
+	dirty = 1;
+	if (!usable)
+		return;
+
+	journal_put_varint(J_LIST);
+	journal_put_varint(list->id);
+	journal_put_varint(list->parent ? list->parent->id : 0);
+	journal_put_string(list->name);
+}
+
+void
+journal_del_list(list)
+	folder_t	*list;
+{
+	if (!recording)
+		return;
+
+	dirty = 1;
+	if (!usable)
+		return;
+
+	journal_put_varint(J_DELLIST);
+	journal_put_varint(list->id);
+}
+
+/*
+ * Record a change the journal can't describe.
+ */
+void
+journal_invalidate()
+{
+	if (!recording)
+		return;
+
+	dirty = 1;
+	usable = 0;
+}
@@ -0,0 +1,49 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef	PWMAN_JOURNAL_H
+#define	PWMAN_JOURNAL_H
+
+/*
+ * The journal records changes made since the database was last written, so
+ * a single change doesn't require re-encrypting the whole database.  It's
+ * kept in <password_file>.journal, and compacted into the database when it
+ * grows past JOURNAL_MAX_SIZE, or when pwman exits.
+ */
+
+#define	JOURNAL_MAX_SIZE	(64 * 1024)
+
+struct saver_job;
+
+int	journal_open(char const *, folder_t *, int);
+void	journal_close(void);
+void	journal_restart(void);
+void	journal_remove(char const *);
+int	journal_pending(void);
+int	journal_snapshot(unsigned char **, size_t *);
+int	journal_save(struct saver_job *);
+
+void	journal_put_entry(password_t *);
+void	journal_del_entry(password_t *);
+void	journal_put_list(folder_t *);
+void	journal_del_list(folder_t *);
+void	journal_invalidate(void);
+
+#endif	/* !PWMAN_JOURNAL_H */
@@ -75,15 +75,21 @@ launch(password_t *pw)
 int		i;
 char           *cmd;
 size_t		clen = 0;
-char           *p, *q;
+char const     *p, *launch, *host, *user, *passwd;
+char           *q;
 
 	if (options->safemode)
 		return -1;
 
-	if ((pw == NULL) || (pw->launch == NULL) || !(*pw->launch))
+	if ((pw == NULL) || !*PW_FIELD(pw, PW_LAUNCH))
 		return -1;
 
-	for (p = pw->launch; *p; p++) {
+	launch = PW_FIELD(pw, PW_LAUNCH);
+	host = PW_FIELD(pw, PW_HOST);
+	user = PW_FIELD(pw, PW_USER);
+	passwd = PW_FIELD(pw, PW_PASSWD);
+
+	for (p = launch; *p; p++) {
 		if (*p != '%') {
 			clen++;
 			continue;
@@ -91,21 +97,21 @@ char           *p, *q;
 
 		switch (*++p) {
 		case 'h':
-			clen += strlen(pw->host);
+			clen += strlen(host);
 			break;
 
 		case 'u':
-			clen += strlen(pw->user);
+			clen += strlen(user);
 			break;
 
 		case 'p':
-			clen += strlen(pw->passwd);
+			clen += strlen(passwd);
 			break;
 		}
 	}
 
 	cmd = xmalloc(clen + 1);
-	for (p = pw->launch, q = cmd; *p; p++) {
+	for (p = launch, q = cmd; *p; p++) {
 		if (*p != '%') {
 			*q++ = *p;
 			continue;
@@ -113,18 +119,18 @@ char           *p, *q;
 
 		switch (*++p) {
 		case 'h':
-			bcopy(pw->host, q, strlen(pw->host));
-			q += strlen(pw->host);
+			bcopy(host, q, strlen(host));
+			q += strlen(host);
 			break;
 
 		case 'u':
-			bcopy(pw->user, q, strlen(pw->user));
-			q += strlen(pw->user);
+			bcopy(user, q, strlen(user));
+			q += strlen(user);
 			break;
 
 		case 'p':
-			bcopy(pw->passwd, q, strlen(pw->passwd));
-			q += strlen(pw->passwd);
+			bcopy(passwd, q, strlen(passwd));
+			q += strlen(passwd);
 			break;
 		}
 	}
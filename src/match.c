@@ -0,0 +1,294 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include	<stdlib.h>
+
+#include	"pwman.h"
+#include	"match.h"
+
+#if	defined(__GNUC__) && defined(__x86_64__)
+# define	MATCH_SIMD
+# include	<stdint.h>
+# include	<immintrin.h>
+
+/*
+ * Fields shorter than a block are read a whole block at a time if that
+ * doesn't cross into the next page, which might not be mapped.  The bytes
+ * past the NUL are masked off, but the address sanitizer can't know that.
+ */
+# define	MATCH_PAGE		4096
+# define	MATCH_IN_PAGE(p, n)	(((uintptr_t) (p) & (MATCH_PAGE - 1)) + (n) <= MATCH_PAGE)
+# define	MATCH_OVERREAD		__attribute__((no_sanitize_address))
+#endif
+
+typedef char const	*(*match_fn_t)(match_t const *, char const *, size_t, size_t);
+
+static match_fn_t	match_impl;
+
+/*
+ * Does s, folded, start with the n bytes of the folded pattern p?
+ */
+static int
+match_rest(s, p, n)
+	char const	*s, *p;
+	size_t		 n;
+{
+size_t	i;
+
+	for (i = 0; i < n; i++)
+		if (MATCH_FOLD((unsigned char) s[i]) != (unsigned char) p[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Find the pattern in h, which is hlen bytes long, starting at offset i.
+ */
+static char const *
+match_find_scalar(m, h, hlen, i)
+	match_t const	*m;
+	char const	*h;
+	size_t		 hlen, i;
+{
+unsigned char	first = m->folded[0];
+
+	for (; i + m->len <= hlen; i++)
+		if (MATCH_FOLD((unsigned char) h[i]) == first &&
+		    match_rest(h + i + 1, m->folded + 1, m->len - 1))
+			return h + i;
+	return NULL;
+}
+
+#ifdef	MATCH_SIMD
+
+MATCH_OVERREAD
+static __m128i
+match_fold_sse2(__m128i v)
+{
+__m128i	upper;
+
+	/* Bytes over 0x7F are negative, so never taken for capitals */
+	upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+			      _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+	return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+/*
+ * Check the 16 start positions from i whose bits are set in live.  Inlined
+ * into the AVX2 version too, so it gets VEX encoding there.
+ */
+MATCH_OVERREAD
+static inline __attribute__((always_inline)) char const *
+match_block_sse2(match_t const *m, char const *h, size_t i, unsigned live)
+{
+__m128i		a, b;
+unsigned	mask, bit;
+size_t		n = m->len;
+
+	a = match_fold_sse2(_mm_loadu_si128((__m128i const *) (h + i)));
+	b = match_fold_sse2(_mm_loadu_si128((__m128i const *) (h + i + n - 1)));
+	mask = _mm_movemask_epi8(
+	    _mm_and_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8(m->folded[0])),
+			  _mm_cmpeq_epi8(b, _mm_set1_epi8(m->folded[n - 1]))));
+
+	for (mask &= live; mask; mask &= mask - 1) {
+		bit = __builtin_ctz(mask);
+		if (n <= 2 || match_rest(h + i + bit + 1, m->folded + 1, n - 2))
+			return h + i + bit;
+	}
+	return NULL;
+}
+
+/*
+ * The last block overlaps the one before it rather than running off the
+ * end of the string; the positions already checked are skipped.
+ */
+MATCH_OVERREAD
+static inline __attribute__((always_inline)) char const *
+match_scan_sse2(match_t const *m, char const *h, size_t hlen, size_t i)
+{
+char const	*r;
+size_t		 npos = hlen - m->len + 1;
+
+	if (npos < 16) {
+		if (MATCH_IN_PAGE(h, m->len + 15))
+			return match_block_sse2(m, h, 0, (1U << npos) - (1U << i));
+		return match_find_scalar(m, h, hlen, i);
+	}
+
+	for (; i < npos; i += 16) {
+		if (i + 16 > npos) {
+			if ((r = match_block_sse2(m, h, npos - 16, ~0U << (16 - (npos - i)))))
+				return r;
+			break;
+		}
+
+		if ((r = match_block_sse2(m, h, i, ~0U)))
+			return r;
+	}
+	return NULL;
+}
+
+MATCH_OVERREAD
+static char const *
+match_find_sse2(m, h, hlen, i)
+	match_t const	*m;
+	char const	*h;
+	size_t		 hlen, i;
+{
+	return match_scan_sse2(m, h, hlen, i);
+}
+
+__attribute__((target("avx2"))) MATCH_OVERREAD
+static __m256i
+match_fold_avx2(__m256i v)
+{
+__m256i	upper;
+
+	upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+				 _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+	return _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) MATCH_OVERREAD
+static char const *
+match_block_avx2(match_t const *m, char const *h, size_t i, unsigned live)
+{
+__m256i		a, b;
+unsigned	mask, bit;
+size_t		n = m->len;
+
+	a = match_fold_avx2(_mm256_loadu_si256((__m256i const *) (h + i)));
+	b = match_fold_avx2(_mm256_loadu_si256((__m256i const *) (h + i + n - 1)));
+	mask = _mm256_movemask_epi8(
+	    _mm256_and_si256(_mm256_cmpeq_epi8(a, _mm256_set1_epi8(m->folded[0])),
+			     _mm256_cmpeq_epi8(b, _mm256_set1_epi8(m->folded[n - 1]))));
+
+	for (mask &= live; mask; mask &= mask - 1) {
+		bit = __builtin_ctz(mask);
+		if (n <= 2 || match_rest(h + i + bit + 1, m->folded + 1, n - 2))
+			return h + i + bit;
+	}
+	return NULL;
+}
+
+__attribute__((target("avx2"))) MATCH_OVERREAD
+static char const *
+match_find_avx2(m, h, hlen, i)
+	match_t const	*m;
+	char const	*h;
+	size_t		 hlen, i;
+{
+char const	*r;
+size_t		 npos = hlen - m->len + 1;
+
+	if (npos < 32) {
+		if (MATCH_IN_PAGE(h, m->len + 31))
+			return match_block_avx2(m, h, 0, (1U << npos) - (1U << i));
+		return match_scan_sse2(m, h, hlen, i);
+	}
+
+	for (; i < npos; i += 32) {
+		if (i + 32 > npos) {
+			if ((r = match_block_avx2(m, h, npos - 32, ~0U << (32 - (npos - i)))))
+				return r;
+			break;
+		}
+
+		if ((r = match_block_avx2(m, h, i, ~0U)))
+			return r;
+	}
+	return NULL;
+}
+
+#endif	/* MATCH_SIMD */
+
+static void
+match_init()
+{
+	match_impl = match_find_scalar;
+
+#ifdef	MATCH_SIMD
+	/* SSE2 is always there on x86-64 */
+	match_impl = match_find_sse2;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		match_impl = match_find_avx2;
+#endif
+}
+
+/*
+ * Set the pattern to look for.  Nothing is done if it hasn't changed, so
+ * this can be called before every use.
+ */
+void
+match_set(m, pat)
+	match_t		*m;
+	char const	*pat;
+{
+size_t	i;
+
+	if (!match_impl)
+		match_init();
+
+	if (m->pat && strcmp(m->pat, pat) == 0)
+		return;
+
+	match_clear(m);
+	m->pat = xstrdup(pat);
+	m->len = strlen(pat);
+	m->folded = xmalloc(m->len + 1);
+	for (i = 0; i <= m->len; i++)
+		m->folded[i] = MATCH_FOLD((unsigned char) pat[i]);
+}
+
+void
+match_clear(m)
+	match_t	*m;
+{
+	xfree(m->pat);
+	xfree(m->folded);
+	bzero(m, sizeof(*m));
+}
+
+/*
+ * Return where the pattern first appears in s, or NULL.  An empty or NULL s
+ * never matches.
+ */
+char const *
+match_find(m, s)
+	match_t const	*m;
+	char const	*s;
+{
+size_t	len;
+
+	if (s == NULL || (len = strlen(s)) == 0)
+		return NULL;
+
+	if (m->len == 0)
+		return s;
+
+	if (len < m->len)
+		return NULL;
+
+	return match_impl(m, s, len, 0);
+}
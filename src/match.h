@@ -0,0 +1,45 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef	PWMAN_MATCH_H
+#define	PWMAN_MATCH_H
+
+/*
+ * Case-insensitive substring matching.  Only ASCII letters are folded, so a
+ * match doesn't depend on the locale or the C library.  The pattern is
+ * folded once by match_set(), and where the CPU has them, SSE2 or AVX2 are
+ * used to find the places where the first and last bytes of the pattern
+ * both appear before anything else is compared.
+ */
+
+#define	MATCH_FOLD(c)	((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+
+typedef struct match {
+	char	*pat;		/* as given */
+	char	*folded;
+	size_t	 len;
+} match_t;
+
+void		 match_set(match_t *, char const *);
+void		 match_clear(match_t *);
+char const	*match_find(match_t const *, char const *);
+
+#endif	/* !PWMAN_MATCH_H */
@@ -39,6 +39,8 @@ Options *ret;
 
 	ret = xcalloc(1, sizeof(*ret));
 	ret->passphrase_timeout = 180;
+	/* More threads didn't make searches faster in search_bench.sh */
+	ret->search_threads = 1;
 	ret->readonly = FALSE;
 
 	ret->filter = filter_new();
@@ -125,6 +127,9 @@ xmlNodePtr	node, root;
 		else if (strcmp((char *)node->name, "passphrase_timeout") == 0)
 			options->passphrase_timeout = atoi(text);
 
+		else if (strcmp((char *)node->name, "search_threads") == 0)
+			options->search_threads = atoi(text);
+
 		else if (strcmp((char *)node->name, "filter") == 0) {
 			options->filter->field = atoi((char const *)xmlGetProp(node, (xmlChar const *)"field"));
 			options->filter->filter = xstrdup(text);
@@ -171,6 +176,9 @@ xmlNodePtr	node, root;
 	snprintf(text, sizeof(text), "%d", options->passphrase_timeout);
 	xmlNewChild(root, NULL, (xmlChar const *) "passphrase_timeout", (xmlChar *) text);
 
+	snprintf(text, sizeof(text), "%d", options->search_threads);
+	xmlNewChild(root, NULL, (xmlChar const *) "search_threads", (xmlChar *) text);
+
 	snprintf(text, sizeof(text), "%d", options->filter->field);
 	node = xmlNewChild(root, NULL, (xmlChar const *) "filter", (xmlChar *) options->filter->filter);
 	xmlSetProp(node, (xmlChar const *)"field", (xmlChar const *)text);
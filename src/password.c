@@ -24,14 +24,37 @@
 
 #include	"pwman.h"
 #include	"password.h"
+#include	"journal.h"
+#include	"trigram.h"
+
+/*
+ * Set one of pw's fields to a copy of value.  Hosts, users and launch
+ * commands repeat a lot, so they're shared.  Its list's table of names is
+ * kept up to date.
+ */
+void
+pw_setfield(pw, field, value)
+	password_t	*pw;
+	char const	*value;
+{
+	if (field == PW_NAME && pw->parent) {
+		folder_unindex_pw(pw->parent, pw);
+		pwstore_set(pw, field, value, 0);
+		folder_index_pw(pw->parent, pw);
+	} else
+		pwstore_set(pw, field, value,
+			    field == PW_HOST || field == PW_USER || field == PW_LAUNCH);
+}
 
 void
 pw_rename(item, new_name)
 	password_t	*item;
 	char const	*new_name;
 {
-	free(item->name);
-	item->name = xstrdup(new_name);
+	pw_setfield(item, PW_NAME, new_name);
+	trigram_add(item);
+	filter_invalidate();
+	journal_put_entry(item);
 }
 
 void
@@ -40,8 +63,10 @@ pw_delete(pw)
 {
 	assert(pw);
 
-	if (pw->parent)
-		PWLIST_REMOVE(&pw->parent->list, pw);
+	if (pw->parent) {
+		journal_del_entry(pw);
+		folder_detach_pw(pw->parent, pw);
+	}
 	pw_free(pw);
 }
 
@@ -52,11 +77,6 @@ pw_free(pw)
 	if (!pw)
 		return;
 
-	free(pw->name);
-	free(pw->user);
-	free(pw->host);
-	free(pw->passwd);
-	free(pw->launch);
-	free(pw);
+	trigram_remove(pw);
+	pwstore_free(pw);
 }
-
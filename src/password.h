@@ -22,37 +22,79 @@
 #ifndef	PWMAN_PASSWORD_H
 #define	PWMAN_PASSWORD_H
 
-#include	"queue.h"
-
 struct folder;
 
-typedef struct password {
+/*
+ * Entries are kept in their list's array of pw_entry_t, in list order, and
+ * their strings all live in one pool; a pw_entry_t refers to them by offset.
+ * Offset 0 is the empty string.  Hosts, users and launch commands are stored
+ * once however many entries share them.  See pwstore.c.
+ */
+#define	PW_NAME		0
+#define	PW_HOST		1
+#define	PW_USER		2
+#define	PW_PASSWD	3
+#define	PW_LAUNCH	4
+#define	PW_NFIELDS	5
+
+/* Case-folded copies of the searchable fields, kept by the trigram index */
+#define	PW_FOLD		PW_NFIELDS
+#define	PW_NSTRS	(PW_FOLD + 4)
+
+typedef struct pw_entry {
+	uint32_t	 str[PW_NSTRS];
 	int		 id;
-	char		*name;
-	char		*host;
-	char		*user;
-	char		*passwd;
-	char		*launch;
-	struct folder	*parent;
-
-	/* ui */
+	uint32_t	 nextname;	/* in parent's table of names, + 1 */
+	unsigned	 search_gen;	/* see search_apply() */
 	int		 marked;
+	struct password	*pw;
+} pw_entry_t;
+
+typedef struct pw_list {
+	pw_entry_t	*ents;
+	uint32_t	 n, size;
+} pw_list_t;
 
-	TAILQ_ENTRY(password)	pw_entries;
+/*
+ * What everything else holds on to.  It stays put while its entry moves
+ * within or between lists.
+ */
+typedef struct password {
+	struct folder	*parent;	/* NULL until it's added to a list */
+	uint32_t	 slot;		/* in its list's ents */
+	uint32_t	 num;		/* in pwstore_table */
 } password_t;
 
-typedef TAILQ_HEAD(pw_list, password) pw_list_t;
-
-#define	PWLIST_INIT(list)			TAILQ_INIT((list))
-#define	PWLIST_EMPTY(list)			TAILQ_EMPTY((list))
-#define	PWLIST_FIRST(list)			TAILQ_FIRST((list))
-#define	PWLIST_PREV(elm,list)			TAILQ_PREV((elm), pw_list, pw_entries)
-#define	PWLIST_NEXT(elm)			TAILQ_NEXT((elm), pw_entries)
-#define	PWLIST_FOREACH(elm,list)		TAILQ_FOREACH((elm), (list), pw_entries)
-#define	PWLIST_FOREACH_SAFE(elm,list,t)		TAILQ_FOREACH_SAFE((elm), (list), pw_entries, (t))
-#define	PWLIST_REMOVE(list, elm)		TAILQ_REMOVE((list), (elm), pw_entries)
-#define	PWLIST_INSERT_BEFORE(list,lelm,elm)	TAILQ_INSERT_BEFORE((lelm), (elm), pw_entries)
-#define	PWLIST_INSERT_AFTER(list,lelm,elm)	TAILQ_INSERT_AFTER((list), (lelm), (elm), pw_entries)
-#define	PWLIST_INSERT_TAIL(list,elm)		TAILQ_INSERT_TAIL((list), (elm), pw_entries)
+typedef struct pwstore_pool {
+	char		*buf;
+	uint32_t	 len, size;
+	uint32_t	 garbage;	/* bytes released since the last compaction */
+	uint32_t	*istrs;		/* shared strings, open addressed */
+	uint32_t	 nistrs, istrsize;
+} pwstore_pool_t;
+
+extern pwstore_pool_t	  pwstore_strings;
+extern pw_list_t	  pwstore_unfiled;
+extern password_t	**pwstore_table;
+extern uint32_t		  pwstore_ntable;
+
+#define	PW_LIST(pw)	((pw)->parent ? &(pw)->parent->list : &pwstore_unfiled)
+#define	PW_ENT(pw)	(&PW_LIST(pw)->ents[(pw)->slot])
+#define	PW_STR(pw, i)	(pwstore_strings.buf + PW_ENT(pw)->str[(i)])
+#define	PW_FIELD(pw, f)	PW_STR((pw), (f))
+
+#define	PWLIST_EMPTY(list)		((list)->n == 0)
+#define	PWLIST_FOREACH(var, list, i)					\
+	for ((i) = 0; (i) < (list)->n && ((var) = (list)->ents[(i)].pw) != NULL; (i)++)
+
+password_t	*pwstore_new(void);
+void		 pwstore_set(password_t *, int, char const *, int);
+void		 pwstore_share(password_t *, int, int);
+void		 pwstore_attach(struct folder *, password_t *);
+void		 pwstore_detach(password_t *);
+void		 pwstore_swap(password_t *, password_t *);
+void		 pwstore_free(password_t *);
+void		 pwstore_compact(void);
+void		 pwstore_clear(void);
 
 #endif	/* !PWMAN_PASSWORD_H */
@@ -0,0 +1,582 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Reading and writing the binary database format.  This file only depends on
+ * the folder_t and password_t structures, so it can be shared with the
+ * conversion tools.
+ */
+
+#include	<stdlib.h>
+#include	<string.h>
+
+#include	"pwman.h"
+#include	"pwdb.h"
+
+/* Sanity limits, so a corrupt file can't make us allocate the world */
+#define	PWDB_MAX_STRING		(16 * 1024 * 1024)
+#define	PWDB_MAX_STRINGS	(64 * 1024 * 1024)
+
+#define	PWDB_ST_HEADER		0
+#define	PWDB_ST_NSTRINGS	1
+#define	PWDB_ST_STRINGS		2
+#define	PWDB_ST_TREE		3
+#define	PWDB_ST_DONE		4
+
+typedef struct pwdb_frame {
+	void		*list;
+	uint32_t	 nentries;
+	uint32_t	 nsublists;
+} pwdb_frame_t;
+
+struct pwdb_reader {
+	pwdb_ops_t const	*ops;
+	void			*arg;
+	int			 state;
+
+	/* Input which hasn't been consumed yet */
+	unsigned char		*buf;
+	size_t			 len, size;
+
+	char		       **strings;
+	uint32_t		 nstrings, nread;
+
+	/* Lists whose contents are still being read */
+	pwdb_frame_t		*stack;
+	size_t			 depth, stacksize;
+};
+
+/* One string in the table built while writing */
+typedef struct pwdb_str {
+	char const	*str;
+	uint32_t	 index;
+	struct pwdb_str	*next;
+} pwdb_str_t;
+
+typedef struct pwdb_strtab {
+	pwdb_str_t     **buckets;
+	uint32_t	 nbuckets;
+	pwdb_str_t     **strings;	/* in index order */
+	uint32_t	 nstrings, size;
+} pwdb_strtab_t;
+
+static uint32_t
+pwdb_hash(s)
+	char const	*s;
+{
+uint32_t	h = 2166136261U;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char) *s) * 16777619U;
+	return h;
+}
+
+static pwdb_str_t *
+pwdb_strtab_find(tab, s)
+	pwdb_strtab_t	*tab;
+	char const	*s;
+{
+pwdb_str_t	*e;
+
+	for (e = tab->buckets[pwdb_hash(s) % tab->nbuckets]; e; e = e->next)
+		if (strcmp(e->str, s) == 0)
+			return e;
+	return NULL;
+}
+
+static void
+pwdb_strtab_add(tab, s)
+	pwdb_strtab_t	*tab;
+	char const	*s;
+{
+pwdb_str_t	*e;
+uint32_t	 i, b;
+
+	if (!s || pwdb_strtab_find(tab, s))
+		return;
+
+	/* Keep the chains short by growing the table with the strings */
+	if (tab->nstrings >= tab->nbuckets) {
+	pwdb_str_t	**nb;
+	uint32_t	  nn = tab->nbuckets * 2;
+
+		nb = xcalloc(nn, sizeof(*nb));
+		for (i = 0; i < tab->nstrings; i++) {
+			e = tab->strings[i];
+			b = pwdb_hash(e->str) % nn;
+			e->next = nb[b];
+			nb[b] = e;
+		}
+
+		free(tab->buckets);
+		tab->buckets = nb;
+		tab->nbuckets = nn;
+	}
+
+	if (tab->nstrings == tab->size) {
+		tab->size *= 2;
+		tab->strings = realloc(tab->strings, tab->size * sizeof(*tab->strings));
+	}
+
+	e = xmalloc(sizeof(*e));
+	e->str = s;
+	e->index = tab->nstrings;
+
+	b = pwdb_hash(s) % tab->nbuckets;
+	e->next = tab->buckets[b];
+	tab->buckets[b] = e;
+	tab->strings[tab->nstrings++] = e;
+}
+
+static void
+pwdb_put_varint(fp, v)
+	FILE		*fp;
+	uint32_t	 v;
+{
+	while (v >= 0x80) {
+		putc((v & 0x7F) | 0x80, fp);
+		v >>= 7;
+	}
+	putc(v, fp);
+}
+
+static void
+pwdb_put_string(fp, tab, s)
+	FILE		*fp;
+	pwdb_strtab_t	*tab;
+	char const	*s;
+{
+	if (!s) {
+		pwdb_put_varint(fp, 0);
+		return;
+	}
+
+	pwdb_put_varint(fp, pwdb_strtab_find(tab, s)->index + 1);
+}
+
+static void
+pwdb_collect(tab, top)
+	pwdb_strtab_t	*tab;
+	folder_t	*top;
+{
+folder_iter_t	 it;
+password_t	*pw;
+folder_t	*list;
+uint32_t	 i;
+int		 f;
+
+	folder_iter_init(&it, top, FOLDER_ENTER);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		pwdb_strtab_add(tab, list->name);
+
+		PWLIST_FOREACH(pw, &list->list, i)
+			for (f = 0; f < PW_NFIELDS; f++)
+				pwdb_strtab_add(tab, PW_FIELD(pw, f));
+	}
+}
+
+static void
+pwdb_put_list(fp, tab, top)
+	FILE		*fp;
+	pwdb_strtab_t	*tab;
+	folder_t	*top;
+{
+folder_iter_t	 it;
+password_t	*pw;
+folder_t	*list, *sub;
+uint32_t	 nentries, nsublists, i;
+int		 f;
+
+	/* Each list is followed by its entries, then its sublists */
+	folder_iter_init(&it, top, FOLDER_ENTER);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		nentries = list->list.n;
+		nsublists = 0;
+		for (sub = list->sublists; sub; sub = sub->next)
+			nsublists++;
+
+		pwdb_put_string(fp, tab, list->name);
+		pwdb_put_varint(fp, list->id);
+		pwdb_put_varint(fp, nentries);
+		pwdb_put_varint(fp, nsublists);
+
+		PWLIST_FOREACH(pw, &list->list, i) {
+			pwdb_put_varint(fp, list->list.ents[i].id);
+			for (f = 0; f < PW_NFIELDS; f++)
+				pwdb_put_string(fp, tab, PW_FIELD(pw, f));
+		}
+	}
+}
+
+/*
+ * Write the tree below top to fp in the binary format.
+ */
+int
+pwdb_write(fp, top)
+	FILE		*fp;
+	folder_t	*top;
+{
+pwdb_strtab_t	tab;
+uint32_t	i;
+
+	tab.nbuckets = 256;
+	tab.buckets = xcalloc(tab.nbuckets, sizeof(*tab.buckets));
+	tab.size = 256;
+	tab.strings = xmalloc(tab.size * sizeof(*tab.strings));
+	tab.nstrings = 0;
+
+	pwdb_collect(&tab, top);
+
+	fwrite(PWDB_MAGIC, 1, PWDB_MAGIC_LEN, fp);
+	pwdb_put_varint(fp, FF_VERSION);
+
+	pwdb_put_varint(fp, tab.nstrings);
+	for (i = 0; i < tab.nstrings; i++) {
+	size_t	len = strlen(tab.strings[i]->str);
+
+		pwdb_put_varint(fp, len);
+		fwrite(tab.strings[i]->str, 1, len, fp);
+	}
+
+	pwdb_put_list(fp, &tab, top);
+
+	for (i = 0; i < tab.nstrings; i++)
+		free(tab.strings[i]);
+	free(tab.strings);
+	free(tab.buckets);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+pwdb_reader_t *
+pwdb_reader_new(ops, arg)
+	pwdb_ops_t const	*ops;
+	void			*arg;
+{
+pwdb_reader_t	*r;
+
+	r = xcalloc(1, sizeof(*r));
+	r->ops = ops;
+	r->arg = arg;
+	r->state = PWDB_ST_HEADER;
+	return r;
+}
+
+void
+pwdb_reader_free(r)
+	pwdb_reader_t	*r;
+{
+uint32_t	i;
+
+	if (!r)
+		return;
+
+	for (i = 0; i < r->nread; i++) {
+		bzero(r->strings[i], strlen(r->strings[i]));
+		free(r->strings[i]);
+	}
+	free(r->strings);
+
+	if (r->buf) {
+		bzero(r->buf, r->size);
+		free(r->buf);
+	}
+
+	free(r->stack);
+	free(r);
+}
+
+/*
+ * Decode a varint at *pos.  Returns 1 if one was read, 0 if more input is
+ * needed, or -1 if it's invalid.
+ */
+static int
+pwdb_get_varint(r, pos, ret)
+	pwdb_reader_t	*r;
+	size_t		*pos;
+	uint32_t	*ret;
+{
+size_t		p = *pos;
+uint32_t	v = 0;
+int		shift;
+
+	for (shift = 0; shift < 35; shift += 7) {
+		if (p >= r->len)
+			return 0;
+
+		v |= (uint32_t) (r->buf[p] & 0x7F) << shift;
+		if ((r->buf[p++] & 0x80) == 0) {
+			*pos = p;
+			*ret = v;
+			return 1;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Decode n varints at *pos; as for pwdb_get_varint().  *pos is only advanced
+ * if all of them were available.
+ */
+static int
+pwdb_get_varints(r, pos, v, n)
+	pwdb_reader_t	*r;
+	size_t		*pos;
+	uint32_t	*v;
+	int		 n;
+{
+size_t	p = *pos;
+int	i, ret;
+
+	for (i = 0; i < n; i++)
+		if ((ret = pwdb_get_varint(r, &p, &v[i])) != 1)
+			return ret;
+
+	*pos = p;
+	return 1;
+}
+
+static int
+pwdb_get_string(r, idx, ret)
+	pwdb_reader_t	*r;
+	uint32_t	 idx;
+	char const     **ret;
+{
+	if (idx > r->nread)
+		return -1;
+
+	*ret = idx ? r->strings[idx - 1] : NULL;
+	return 0;
+}
+
+static int
+pwdb_push(r, list, nentries, nsublists)
+	pwdb_reader_t	*r;
+	void		*list;
+	uint32_t	 nentries, nsublists;
+{
+	if (r->depth == r->stacksize) {
+		r->stacksize = r->stacksize ? r->stacksize * 2 : 16;
+		r->stack = realloc(r->stack, r->stacksize * sizeof(*r->stack));
+	}
+
+	r->stack[r->depth].list = list;
+	r->stack[r->depth].nentries = nentries;
+	r->stack[r->depth].nsublists = nsublists;
+	r->depth++;
+	return 0;
+}
+
+/*
+ * Read a list header at *pos and tell the caller about it.
+ */
+static int
+pwdb_read_list(r, pos, parent)
+	pwdb_reader_t	*r;
+	size_t		*pos;
+	void		*parent;
+{
+uint32_t	 v[4];
+char const	*name;
+void		*list;
+int		 ret;
+
+	if ((ret = pwdb_get_varints(r, pos, v, 4)) != 1)
+		return ret;
+
+	if (pwdb_get_string(r, v[0], &name) == -1)
+		return -1;
+
+	list = r->ops->list(r->arg, parent, name ? name : "", v[1]);
+	pwdb_push(r, list, v[2], v[3]);
+	return 1;
+}
+
+static int
+pwdb_read_entry(r, pos, list)
+	pwdb_reader_t	*r;
+	size_t		*pos;
+	void		*list;
+{
+uint32_t	 v[1 + PWDB_NFIELDS];
+char const	*fields[PWDB_NFIELDS];
+int		 i, ret;
+
+	if ((ret = pwdb_get_varints(r, pos, v, 1 + PWDB_NFIELDS)) != 1)
+		return ret;
+
+	for (i = 0; i < PWDB_NFIELDS; i++)
+		if (pwdb_get_string(r, v[i + 1], &fields[i]) == -1)
+			return -1;
+
+	r->ops->entry(r->arg, list, v[0], fields);
+	return 1;
+}
+
+/*
+ * Consume as much of the buffered input as possible, leaving any incomplete
+ * item for the next call.
+ */
+static int
+pwdb_parse(r)
+	pwdb_reader_t	*r;
+{
+size_t		 pos = 0;
+uint32_t	 v;
+int		 ret = 1;
+
+	while (ret == 1) {
+	pwdb_frame_t	*top;
+
+		switch (r->state) {
+		case PWDB_ST_HEADER:
+			if (r->len < PWDB_MAGIC_LEN)
+				ret = 0;
+			else if (memcmp(r->buf, PWDB_MAGIC, PWDB_MAGIC_LEN) != 0)
+				ret = -1;
+			else {
+				pos = PWDB_MAGIC_LEN;
+				if ((ret = pwdb_get_varint(r, &pos, &v)) == 1) {
+					if (v != FF_VERSION)
+						ret = -1;
+					r->state = PWDB_ST_NSTRINGS;
+				} else
+					pos = 0;
+			}
+			break;
+
+		case PWDB_ST_NSTRINGS:
+			if ((ret = pwdb_get_varint(r, &pos, &v)) != 1)
+				break;
+			if (v > PWDB_MAX_STRINGS) {
+				ret = -1;
+				break;
+			}
+
+			r->nstrings = v;
+			r->strings = xcalloc(v ? v : 1, sizeof(*r->strings));
+			r->state = PWDB_ST_STRINGS;
+			break;
+
+		case PWDB_ST_STRINGS:
+			if (r->nread == r->nstrings) {
+				r->state = PWDB_ST_TREE;
+				break;
+			}
+		{
+		size_t	p = pos;
+
+			if ((ret = pwdb_get_varint(r, &p, &v)) != 1)
+				break;
+			if (v > PWDB_MAX_STRING) {
+				ret = -1;
+				break;
+			}
+			if (r->len - p < v) {
+				ret = 0;
+				break;
+			}
+
+			r->strings[r->nread] = xmalloc(v + 1);
+			memcpy(r->strings[r->nread], r->buf + p, v);
+			r->strings[r->nread][v] = '\0';
+			r->nread++;
+			pos = p + v;
+		}
+			break;
+
+		case PWDB_ST_TREE:
+			if (r->depth == 0) {
+				ret = pwdb_read_list(r, &pos, NULL);
+				break;
+			}
+
+			top = &r->stack[r->depth - 1];
+
+			if (top->nentries) {
+				if ((ret = pwdb_read_entry(r, &pos, top->list)) == 1)
+					top->nentries--;
+			} else if (top->nsublists) {
+				top->nsublists--;
+				if ((ret = pwdb_read_list(r, &pos, top->list)) != 1)
+					top->nsublists++;
+			} else if (--r->depth == 0)
+				r->state = PWDB_ST_DONE;
+			break;
+
+		case PWDB_ST_DONE:
+			/* Trailing garbage */
+			ret = r->len > pos ? -1 : 0;
+			break;
+		}
+	}
+
+	/* Keep whatever is left for next time, and wipe what was used */
+	if (pos) {
+		memmove(r->buf, r->buf + pos, r->len - pos);
+		bzero(r->buf + r->len - pos, pos);
+		r->len -= pos;
+	}
+
+	return ret;
+}
+
+int
+pwdb_reader_feed(r, buf, len)
+	pwdb_reader_t	*r;
+	char const	*buf;
+	size_t		 len;
+{
+	if (r->len + len > r->size) {
+	unsigned char	*new;
+	size_t		 newsize = r->size ? r->size : BUFSIZ;
+
+		while (newsize < r->len + len)
+			newsize *= 2;
+
+		new = xmalloc(newsize);
+		if (r->buf) {
+			memcpy(new, r->buf, r->len);
+			bzero(r->buf, r->size);
+			free(r->buf);
+		}
+
+		r->buf = new;
+		r->size = newsize;
+	}
+
+	memcpy(r->buf + r->len, buf, len);
+	r->len += len;
+
+	return pwdb_parse(r) == -1 ? -1 : 0;
+}
+
+/*
+ * Check the whole file has been read.
+ */
+int
+pwdb_reader_finish(r)
+	pwdb_reader_t	*r;
+{
+	if (r->state != PWDB_ST_DONE || r->len != 0)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef	PWMAN_PWDB_H
+#define	PWMAN_PWDB_H
+
+/*
+ * The binary database format (FF_VERSION 4).  All integers are unsigned
+ * LEB128 varints.
+ *
+ *	magic		"PWMB"
+ *	version		FF_VERSION
+ *	nstrings	then nstrings of (length, bytes)
+ *	list		the top-level list
+ *
+ * A list is (name, id, nentries, nsublists), followed by its entries, each of
+ * which is (id, name, host, user, passwd, launch), and then its sublists.
+ * Strings are stored as an index into the string table plus one, with zero
+ * meaning no value.
+ */
+
+#define	PWDB_MAGIC	"PWMB"
+#define	PWDB_MAGIC_LEN	4
+
+#define	PWDB_NAME	0
+#define	PWDB_HOST	1
+#define	PWDB_USER	2
+#define	PWDB_PASSWD	3
+#define	PWDB_LAUNCH	4
+#define	PWDB_NFIELDS	5
+
+/*
+ * Called by the reader as the file is decoded.  list is called for each list,
+ * with the value returned for its parent (NULL for the top-level list), and
+ * its return value is passed as the parent of its entries and sublists.  The
+ * strings are only valid for the duration of the call.
+ */
+typedef struct pwdb_ops {
+	void	*(*list)(void *arg, void *parent, char const *name, int id);
+	void	 (*entry)(void *arg, void *list, int id, char const **fields);
+} pwdb_ops_t;
+
+typedef struct pwdb_reader pwdb_reader_t;
+
+pwdb_reader_t	*pwdb_reader_new(pwdb_ops_t const *, void *);
+int		 pwdb_reader_feed(pwdb_reader_t *, char const *, size_t);
+int		 pwdb_reader_finish(pwdb_reader_t *);
+void		 pwdb_reader_free(pwdb_reader_t *);
+
+int		 pwdb_write(FILE *, folder_t *);
+
+#endif	/* !PWMAN_PWDB_H */
@@ -40,20 +40,28 @@
 
 #include	"pwman.h"
 #include	"gnupg.h"
+#include	"agent.h"
 #include	"ui.h"
 
 static void	pwman_parse_command_line(int argc, char **argv);
 static void	pwman_show_usage();
 static void	pwman_show_version();
 static void	pwman_quit();
+static void	pwman_batch(void);
 
 Options        *options;
 int		write_options;
 folder_t       *folder;
 folder_t       *current_pw_sublist;
 search_result_t *search_results;
+size_t		nsearch_results;
 time_t		time_base;
 
+/* A command given after the options, to run without the screen */
+static int	batch_argc;
+static char   **batch_argv;
+static int	agent_mode;
+
 static int
 pwman_check_lock_file()
 {
@@ -95,6 +103,9 @@ int		load_worked, gpg_id_valid;
 	signal(SIGKILL, pwman_quit);
 	signal(SIGTERM, pwman_quit);
 
+	/* Writing to gpg after it dies should fail, not kill the saver */
+	signal(SIGPIPE, SIG_IGN);
+
 	umask(DEFAULT_UMASK);
 
 	/* get options from .pwmanrc */
@@ -105,6 +116,11 @@ int		load_worked, gpg_id_valid;
 	/* parse command line options */
 	pwman_parse_command_line(argc, argv);
 
+	if (agent_mode)
+		agent_run();
+	if (batch_argc)
+		pwman_batch();
+
 	/* check to see if another instance of pwman is open */
 	if (!options->readonly && pwman_check_lock_file()) {
 		fprintf(stderr, "File %s is already opened by another instance of pwman.\n",
@@ -231,6 +247,7 @@ static struct pw_option longopts[] = {
 	{ "passphrase-timeout",	pw_required_argument, NULL,	't' },
 	{ "readonly",		pw_no_argument, NULL,		'r' },
 	{ "safe",		pw_no_argument, NULL, 		's' },
+	{ "agent",		pw_no_argument, NULL,		'a' },
 	{ }
 };
 
@@ -284,10 +301,217 @@ int		i;
 			options->copy_command = xstrdup(optarg);
 			break;
 
+		case 'a':
+			agent_mode = TRUE;
+			break;
+
 		default:
 			exit(1);
 		}
 	}
+
+	if (optind < argc) {
+		batch_argc = argc - optind;
+		batch_argv = argv + optind;
+	}
+}
+
+static char const *batch_fields[] = {
+	"name", "host", "user", "password", "launch", NULL
+};
+
+static void
+pwman_put_path(out, list, entry)
+	FILE		*out;
+	folder_t	*list;
+	password_t	*entry;
+{
+char	*path;
+
+	path = folder_path(list, entry);
+	fprintf(out, "%s%s\n", path, entry ? "" : "/");
+	free(path);
+}
+
+/*
+ * get <path> [field]: print one field of an entry, or every field as
+ * "field<tab>value" lines.
+ */
+static int
+pwman_cmd_get(out, err, argc, argv)
+	FILE	 *out, *err;
+	char	**argv;
+{
+folder_t	*list;
+password_t	*pw;
+char const	*values[5];
+int		 i, ret = 1;
+
+	if (folder_lookup(folder, argv[0], &list, &pw) == -1 || pw == NULL) {
+		fprintf(err, "pwman: %s: no such entry\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < PW_NFIELDS; i++)
+		values[i] = PW_FIELD(pw, i);
+
+	for (i = 0; batch_fields[i]; i++) {
+		if (argc == 1)
+			fprintf(out, "%s\t%s\n", batch_fields[i],
+				values[i]);
+		else if (strcmp(argv[1], batch_fields[i]) == 0) {
+			fprintf(out, "%s\n", values[i]);
+			ret = 0;
+		}
+	}
+
+	if (argc == 1)
+		return 0;
+
+	if (ret)
+		fprintf(err, "pwman: %s: no such field\n", argv[1]);
+	return ret;
+}
+
+/*
+ * ls [path]: print the path of everything in a list, lists first, with a
+ * slash after each list.
+ */
+static int
+pwman_cmd_ls(out, err, argc, argv)
+	FILE	 *out, *err;
+	char	**argv;
+{
+folder_t	*list, *iter;
+password_t	*pw;
+uint32_t	 i;
+
+	if (folder_lookup(folder, argc ? argv[0] : "/", &list, &pw) == -1) {
+		fprintf(err, "pwman: %s: not found\n", argv[0]);
+		return 1;
+	}
+
+	if (pw) {
+		pwman_put_path(out, NULL, pw);
+		return 0;
+	}
+
+	for (iter = list->sublists; iter; iter = iter->next)
+		pwman_put_path(out, iter, NULL);
+	PWLIST_FOREACH(pw, &list->list, i)
+		pwman_put_path(out, NULL, pw);
+	return 0;
+}
+
+/*
+ * search <term>: print the path of every list and entry matching term, as
+ * the interactive search would find them.
+ */
+static int
+pwman_cmd_search(out, err, argc, argv)
+	FILE	 *out, *err;
+	char	**argv;
+{
+size_t	i;
+
+	search_run(argv[0]);
+	for (i = 0; i < nsearch_results; i++)
+		pwman_put_path(out, search_results[i].sublist,
+			       search_results[i].entry);
+
+	return nsearch_results ? 0 : 1;
+}
+
+static struct pwman_command {
+	char const	*name;
+	int		 minargs, maxargs;
+	int		(*fn)(FILE *, FILE *, int, char **);
+} commands[] = {
+	{ "get",	1, 2,	pwman_cmd_get },
+	{ "ls",		0, 1,	pwman_cmd_ls },
+	{ "search",	1, 1,	pwman_cmd_search },
+	{ }
+};
+
+static struct pwman_command *
+pwman_find_command(err, argc, argv)
+	FILE	 *err;
+	char	**argv;
+{
+struct pwman_command	*cmd;
+
+	for (cmd = commands; cmd->name; cmd++)
+		if (strcmp(cmd->name, argv[0]) == 0)
+			break;
+
+	if (!cmd->name) {
+		fprintf(err, "pwman: unknown command \"%s\"\n", argv[0]);
+		return NULL;
+	}
+
+	if (argc - 1 < cmd->minargs || argc - 1 > cmd->maxargs) {
+		fprintf(err, "pwman: wrong number of arguments to %s\n", cmd->name);
+		return NULL;
+	}
+
+	return cmd;
+}
+
+/*
+ * Run a command against the loaded database, printing the answer to out and
+ * any errors to err.  Returns the status to exit with.
+ */
+int
+pwman_run_command(out, err, argc, argv)
+	FILE	 *out, *err;
+	char	**argv;
+{
+struct pwman_command	*cmd;
+
+	if ((cmd = pwman_find_command(err, argc, argv)) == NULL)
+		return 1;
+
+	return cmd->fn(out, err, argc - 1, argv + 1);
+}
+
+/*
+ * Run the command given on the command line, printing the answer to standard
+ * output, and exit.  The screen is never started and nothing is written: no
+ * lock file, no options and no database.  If an agent has the database
+ * loaded, it answers instead.
+ */
+static void
+pwman_batch()
+{
+int	ret;
+
+	if (pwman_find_command(stderr, batch_argc, batch_argv) == NULL)
+		exit(1);
+
+	options->readonly = TRUE;
+	write_options = FALSE;
+
+	if ((ret = agent_query(batch_argc, batch_argv)) != -1)
+		exit(ret);
+
+	if (!options->password_file || access(options->password_file, F_OK) != 0) {
+		fprintf(stderr, "pwman: cannot open database %s\n",
+			options->password_file ? options->password_file : "");
+		exit(1);
+	}
+
+	folder_init();
+	if (folder_read_file() != 0) {
+		fprintf(stderr, "pwman: cannot read %s\n", options->password_file);
+		exit(1);
+	}
+
+	ret = pwman_run_command(stdout, stderr, batch_argc, batch_argv);
+	if (fflush(stdout) == EOF)
+		ret = 1;
+
+	folder_free_all();
+	exit(ret);
 }
 
 static void
@@ -326,7 +550,7 @@ static void
 pwman_show_usage(progname)
 	char const	*progname;
 {
-	printf("Usage: %s [OPTIONS]...\n", progname);
+	printf("Usage: %s [OPTIONS]... [COMMAND]\n", progname);
 	puts("Store your passwords securely using public key encryption\n");
 	puts("  -h, --help a                               show usage");
 	puts("  -v, --version                              display version information");
@@ -335,7 +559,14 @@ pwman_show_usage(progname)
 	puts("  -f <file>, --file <file>                   file to read passwords from");
 	puts("  -t <mins>, --passphrase-timeout <mins>     time before app forgets passphrase(in minutes)");
 	puts("  -r, --readonly                             open the database readonly");
-	puts("  -s, --safe-mode                            disable 'l'aunch command\n\n");
+	puts("  -s, --safe-mode                            disable 'l'aunch command");
+	puts("  --agent                                    keep the database loaded in the background,");
+	puts("                                             answering commands until the passphrase times out\n");
+	puts("Commands, which print their answer and exit without starting the screen:");
+	puts("  get <path> [field]                         print an entry, or one of its fields");
+	puts("                                             (name, host, user, password, launch)");
+	puts("  ls [path]                                  print the contents of a list");
+	puts("  search <term>                              print the lists and entries matching term\n\n");
 	puts("Report bugs to <felicity@loreley.flyingparchment.org.uk>");
 }
 
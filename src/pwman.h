@@ -54,12 +54,12 @@
 #define MAIN_HELPLINE 	"q:quit  ?:help  a:add  e:edit  d:delete"
 #define READONLY_MSG	"RO"
 #define SAFE_MSG	"SAFE"
-
-#define MAX_SEARCH_DEPTH 25
+#define SAVING_MSG	"Saving..."
 
 #define DEFAULT_UMASK 066
 
-#define FF_VERSION 3
+#define FF_VERSION 4		/* binary database */
+#define FF_XML_VERSION 3	/* XML database and exports */
 
 #define	xstrdup(s)	strdup(s)
 #define	xmalloc(s)	malloc(s)
@@ -75,8 +75,6 @@ typedef struct search_result {
 
 	/* If the entry itself matches, will be present */
 	password_t     *entry;
-
-	struct search_result *next;
 } search_result_t;
 
 typedef struct filter {
@@ -86,6 +84,7 @@ typedef struct filter {
 
 typedef struct search {
 	char           *search_term;
+	int		fuzzy;		/* rank by fuzzy match, not substring */
 } search_t;
 
 typedef struct {
@@ -98,13 +97,15 @@ typedef struct {
 	int		 readonly;
 	int		 safemode;
 	char		*copy_command;
+	int		 search_threads;	/* 0 for one per CPU */
 } Options;
 
 extern Options *options;
 extern int	write_options;
 extern folder_t *folder;
 extern folder_t *current_pw_sublist;
-extern search_result_t *search_results;
+extern search_result_t *search_results;	/* NULL if nothing was found */
+extern size_t	nsearch_results;
 extern time_t	time_base;
 
 char           *trim_ws(char *);
@@ -115,13 +116,17 @@ int		ui_run     (void);
 int		ui_end     (void);
 
 filter_t       *filter_new(void);
+void		filter_invalidate(void);
+unsigned	filter_generation(void);
+password_t    **filter_visible(folder_t *, size_t *);
 search_t       *search_new(void);
 Options        *options_new(void);
 int		options_read(void);
 int		options_write(void);
 void		options_get(void);
 
-void		search_get(void);
+void		search_get(int fuzzy);
+void		search_run(char const *term);
 void		search_remove(void);
 
 char           *pwgen_ask(void);
@@ -164,5 +169,6 @@ int pw_getopt(int nargc, char * const *, const char *,
 	const struct pw_option *, int *);
 
 int copy_string(char const *);
+int pwman_run_command(FILE *out, FILE *err, int argc, char **argv);
 
 #endif
@@ -0,0 +1,524 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The entry store.  Each list keeps its entries' pw_entry_t in one array, and
+ * every entry's strings are in a single pool, so looking at all the entries
+ * of a list touches a few contiguous blocks of memory rather than six
+ * allocations per entry.
+ *
+ * A string in the pool is preceded by its reference count.  Shared strings
+ * are also in a hash table, so storing one again only adds a reference.
+ * Released strings are zeroed and left where they were until
+ * pwstore_compact() copies what's still in use to a new pool.
+ *
+ * Nothing here knows about the journal, the filter or the search index, so
+ * the conversion tools can use it too.
+ */
+
+#include	<stdlib.h>
+#include	<string.h>
+
+#include	"pwman.h"
+#include	"arena.h"
+
+#define	POOL_HDR	sizeof(uint32_t)
+#define	POOL_ROUND(n)	(((n) + POOL_HDR - 1) & ~(POOL_HDR - 1))
+#define	POOL_MIN	(64 * 1024)
+
+#define	POOL_SHARED	0x80000000U
+#define	POOL_MOVED	0xFFFFFFFFU	/* by pwstore_compact() */
+
+#define	POOL_REFS(p, off)	(((uint32_t *) ((p)->buf + (off)))[-1])
+
+/* Until the first string is stored, the pool is just the empty string */
+static char	  pool_empty[POOL_HDR];
+
+pwstore_pool_t	  pwstore_strings = { pool_empty };
+pw_list_t	  pwstore_unfiled;
+password_t	**pwstore_table;
+uint32_t	  pwstore_ntable;
+
+static uint32_t	  tablesize;
+static uint32_t	 *freenums;
+static uint32_t	  nfree, freesize;
+
+/* Holds the handles, the lists' entries and the strings */
+static arena_t	  pwstore_arena;
+
+static uint32_t
+pool_hash(s)
+	char const	*s;
+{
+uint32_t	h = 2166136261U;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char) *s) * 16777619U;
+	return h;
+}
+
+/*
+ * Make room for need more bytes.  The pool moves, so anything pointing into
+ * it is stale afterwards.
+ */
+static void
+pool_grow(p, need)
+	pwstore_pool_t	*p;
+	size_t		 need;
+{
+char		*old = p->buf;
+uint32_t	 oldsize = p->size;
+size_t		 size;
+
+	if (oldsize && p->size - p->len >= need)
+		return;
+
+	/* The empty string is at offset 0 */
+	if (!oldsize)
+		p->len = POOL_HDR;
+
+	for (size = p->size ? p->size : POOL_MIN; size - p->len < need; size *= 2)
+		;
+
+	p->buf = arena_alloc(&pwstore_arena, size);
+	p->size = size;
+	if (oldsize) {
+		memcpy(p->buf, old, p->len);
+		arena_release(&pwstore_arena, old, oldsize);
+	}
+}
+
+static uint32_t
+pool_add(p, s)
+	pwstore_pool_t	*p;
+	char const	*s;
+{
+size_t		len = strlen(s) + 1, need = POOL_HDR + POOL_ROUND(len);
+uintptr_t	at = (uintptr_t) s - (uintptr_t) p->buf;
+uint32_t	off;
+
+	if (len == 1)
+		return 0;
+
+	/* s may be in the pool already */
+	if ((uintptr_t) s >= (uintptr_t) p->buf && at < p->len) {
+		pool_grow(p, need);
+		s = p->buf + at;
+	} else
+		pool_grow(p, need);
+
+	off = p->len + POOL_HDR;
+	POOL_REFS(p, off) = 1;
+	memcpy(p->buf + off, s, len);
+	p->len += need;
+	return off;
+}
+
+static uint32_t *
+pool_islot(p, s, h)
+	pwstore_pool_t	*p;
+	char const	*s;
+	uint32_t	 h;
+{
+uint32_t	i;
+
+	for (i = h & (p->istrsize - 1); p->istrs[i];
+	     i = (i + 1) & (p->istrsize - 1))
+		if (strcmp(p->buf + p->istrs[i], s) == 0)
+			break;
+	return &p->istrs[i];
+}
+
+static void
+pool_igrow(p)
+	pwstore_pool_t	*p;
+{
+uint32_t	*old = p->istrs, oldsize = p->istrsize, i;
+
+	p->istrsize = p->istrsize ? p->istrsize * 2 : 256;
+	p->istrs = xcalloc(p->istrsize, sizeof(*p->istrs));
+
+	for (i = 0; i < oldsize; i++)
+		if (old[i])
+			*pool_islot(p, p->buf + old[i],
+				    pool_hash(p->buf + old[i])) = old[i];
+	free(old);
+}
+
+static uint32_t
+pool_intern(p, s)
+	pwstore_pool_t	*p;
+	char const	*s;
+{
+uint32_t	*slot, off;
+
+	if (!*s)
+		return 0;
+
+	if ((p->nistrs + 1) * 2 > p->istrsize)
+		pool_igrow(p);
+
+	if (*(slot = pool_islot(p, s, pool_hash(s))) != 0) {
+		POOL_REFS(p, *slot)++;
+		return *slot;
+	}
+
+	off = pool_add(p, s);
+	POOL_REFS(p, off) |= POOL_SHARED;
+	*slot = off;
+	p->nistrs++;
+	return off;
+}
+
+/*
+ * Take off out of the table of shared strings, moving back any later
+ * strings in its run which could have gone in its place.
+ */
+static void
+pool_iremove(p, off)
+	pwstore_pool_t	*p;
+	uint32_t	 off;
+{
+uint32_t	mask = p->istrsize - 1, i, j, k;
+
+	for (i = pool_hash(p->buf + off) & mask; p->istrs[i] != off;
+	     i = (i + 1) & mask)
+		;
+	p->istrs[i] = 0;
+	p->nistrs--;
+
+	for (j = (i + 1) & mask; p->istrs[j]; j = (j + 1) & mask) {
+		k = pool_hash(p->buf + p->istrs[j]) & mask;
+		if (i < j ? (k <= i || k > j) : (k <= i && k > j)) {
+			p->istrs[i] = p->istrs[j];
+			p->istrs[j] = 0;
+			i = j;
+		}
+	}
+}
+
+static void
+pool_release(p, off)
+	pwstore_pool_t	*p;
+	uint32_t	 off;
+{
+uint32_t	*refs;
+size_t		 len;
+
+	if (off == 0)
+		return;
+
+	refs = &POOL_REFS(p, off);
+	if ((--*refs & ~POOL_SHARED) != 0)
+		return;
+
+	if (*refs & POOL_SHARED)
+		pool_iremove(p, off);
+
+	len = strlen(p->buf + off) + 1;
+	bzero(p->buf + off - POOL_HDR, POOL_HDR + len);
+	p->garbage += POOL_HDR + POOL_ROUND(len);
+}
+
+/*
+ * Copy the string at off in old to the current pool, once however many
+ * times it's referred to.
+ */
+static uint32_t
+pool_move(old, off)
+	pwstore_pool_t	*old;
+	uint32_t	 off;
+{
+pwstore_pool_t	*p = &pwstore_strings;
+uint32_t	*refs, noff;
+
+	if (off == 0)
+		return 0;
+
+	refs = &POOL_REFS(old, off);
+	if (*refs == POOL_MOVED) {
+		memcpy(&noff, old->buf + off, sizeof(noff));
+		POOL_REFS(p, noff)++;
+		return noff;
+	}
+
+	if (*refs & POOL_SHARED)
+		noff = pool_intern(p, old->buf + off);
+	else
+		noff = pool_add(p, old->buf + off);
+
+	/* Every string has room for this */
+	*refs = POOL_MOVED;
+	memcpy(old->buf + off, &noff, sizeof(noff));
+	return noff;
+}
+
+static uint32_t
+table_add(pw)
+	password_t	*pw;
+{
+uint32_t	n;
+
+	if (nfree)
+		n = freenums[--nfree];
+	else {
+		if (pwstore_ntable == tablesize) {
+			tablesize = tablesize ? tablesize * 2 : 1024;
+			pwstore_table = realloc(pwstore_table,
+					tablesize * sizeof(*pwstore_table));
+		}
+		n = pwstore_ntable++;
+	}
+
+	pwstore_table[n] = pw;
+	return n;
+}
+
+static void
+table_remove(n)
+	uint32_t	n;
+{
+	pwstore_table[n] = NULL;
+
+	if (nfree == freesize) {
+		freesize = freesize ? freesize * 2 : 256;
+		freenums = realloc(freenums, freesize * sizeof(*freenums));
+	}
+	freenums[nfree++] = n;
+}
+
+static void
+list_grow(l)
+	pw_list_t	*l;
+{
+pw_entry_t	*old = l->ents;
+uint32_t	 oldsize = l->size;
+
+	if (l->n < l->size)
+		return;
+
+	l->size = l->size ? l->size * 2 : 8;
+	l->ents = arena_alloc(&pwstore_arena, l->size * sizeof(*l->ents));
+	if (old)
+		memcpy(l->ents, old, l->n * sizeof(*l->ents));
+	arena_release(&pwstore_arena, old, oldsize * sizeof(*old));
+}
+
+/*
+ * Take the entry at slot out of l, closing the gap.
+ */
+static void
+list_remove(l, slot)
+	pw_list_t	*l;
+	uint32_t	 slot;
+{
+uint32_t	i;
+
+	memmove(&l->ents[slot], &l->ents[slot + 1],
+		(l->n - slot - 1) * sizeof(*l->ents));
+	for (i = slot; i < l->n - 1; i++)
+		l->ents[i].pw->slot = i;
+
+	if (--l->n == 0) {
+		arena_release(&pwstore_arena, l->ents, l->size * sizeof(*l->ents));
+		l->ents = NULL;
+		l->size = 0;
+	} else
+		bzero(&l->ents[l->n], sizeof(*l->ents));
+}
+
+/*
+ * Move pw to the end of list, or out of any list if list is NULL.
+ */
+static void
+pwstore_move(pw, list)
+	password_t	*pw;
+	folder_t	*list;
+{
+pw_list_t	*to = list ? &list->list : &pwstore_unfiled;
+pw_entry_t	 e = *PW_ENT(pw);
+
+	list_remove(PW_LIST(pw), pw->slot);
+	list_grow(to);
+	pw->parent = list;
+	pw->slot = to->n++;
+	to->ents[pw->slot] = e;
+}
+
+/*
+ * Return a new entry with every field empty, which isn't in any list.
+ */
+password_t *
+pwstore_new()
+{
+password_t	*pw;
+
+	pw = arena_alloc(&pwstore_arena, sizeof(*pw));
+	pw->num = table_add(pw);
+
+	list_grow(&pwstore_unfiled);
+	pw->slot = pwstore_unfiled.n++;
+	pwstore_unfiled.ents[pw->slot].pw = pw;
+	return pw;
+}
+
+/*
+ * Set pw's string i to a copy of value, which may be NULL for an empty
+ * string.  With shared set, the copy is shared with any other string stored
+ * that way which has the same value.
+ */
+void
+pwstore_set(pw, i, value, shared)
+	password_t	*pw;
+	char const	*value;
+{
+uint32_t	off;
+
+	if (value == NULL)
+		off = 0;
+	else if (shared)
+		off = pool_intern(&pwstore_strings, value);
+	else
+		off = pool_add(&pwstore_strings, value);
+
+	pool_release(&pwstore_strings, PW_ENT(pw)->str[i]);
+	PW_ENT(pw)->str[i] = off;
+}
+
+/*
+ * Make pw's string to refer to the same copy as its string from.
+ */
+void
+pwstore_share(pw, to, from)
+	password_t	*pw;
+{
+pw_entry_t	*e = PW_ENT(pw);
+uint32_t	 off = e->str[from];
+
+	if (off)
+		POOL_REFS(&pwstore_strings, off)++;
+	pool_release(&pwstore_strings, e->str[to]);
+	e->str[to] = off;
+}
+
+/*
+ * Add pw to the end of list, taking it out of any list it was in.
+ */
+void
+pwstore_attach(list, pw)
+	folder_t	*list;
+	password_t	*pw;
+{
+	pwstore_move(pw, list);
+}
+
+void
+pwstore_detach(pw)
+	password_t	*pw;
+{
+	if (pw->parent)
+		pwstore_move(pw, NULL);
+}
+
+/*
+ * Swap two entries in the same list.
+ */
+void
+pwstore_swap(a, b)
+	password_t	*a, *b;
+{
+pw_entry_t	*ents = PW_LIST(a)->ents, e;
+uint32_t	 slot = a->slot;
+
+	e = ents[a->slot];
+	ents[a->slot] = ents[b->slot];
+	ents[b->slot] = e;
+
+	a->slot = b->slot;
+	b->slot = slot;
+}
+
+void
+pwstore_free(pw)
+	password_t	*pw;
+{
+pw_entry_t	*e = PW_ENT(pw);
+int		 i;
+
+	for (i = 0; i < PW_NSTRS; i++)
+		pool_release(&pwstore_strings, e->str[i]);
+
+	list_remove(PW_LIST(pw), pw->slot);
+	table_remove(pw->num);
+	arena_release(&pwstore_arena, pw, sizeof(*pw));
+}
+
+/*
+ * If enough of the pool has been released, copy what's left to a new one.
+ * Pointers into the pool are stale afterwards.
+ */
+void
+pwstore_compact()
+{
+pwstore_pool_t	 old = pwstore_strings;
+pw_entry_t	*e;
+uint32_t	 n;
+int		 i;
+
+	if (old.garbage < POOL_MIN || old.garbage * 2 < old.len)
+		return;
+
+	debug("pwstore_compact: %lu of %lu bytes released",
+	      (unsigned long) old.garbage, (unsigned long) old.len);
+
+	bzero(&pwstore_strings, sizeof(pwstore_strings));
+	pwstore_strings.buf = pool_empty;
+	for (n = 0; n < pwstore_ntable; n++) {
+		if (pwstore_table[n] == NULL)
+			continue;
+
+		e = PW_ENT(pwstore_table[n]);
+		for (i = 0; i < PW_NSTRS; i++)
+			e->str[i] = pool_move(&old, e->str[i]);
+	}
+
+	arena_release(&pwstore_arena, old.buf, old.size);
+	free(old.istrs);
+}
+
+/*
+ * Free every entry at once.
+ */
+void
+pwstore_clear()
+{
+	arena_free(&pwstore_arena);
+
+	free(pwstore_strings.istrs);
+	bzero(&pwstore_strings, sizeof(pwstore_strings));
+	pwstore_strings.buf = pool_empty;
+	bzero(&pwstore_unfiled, sizeof(pwstore_unfiled));
+
+	free(pwstore_table);
+	free(freenums);
+	pwstore_table = NULL;
+	freenums = NULL;
+	pwstore_ntable = tablesize = nfree = freesize = 0;
+}
@@ -0,0 +1,218 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include	<stdlib.h>
+#include	<pthread.h>
+
+#include	"pwman.h"
+#include	"gnupg.h"
+#include	"saver.h"
+
+typedef struct saver_slot {
+	saver_fn_t	 fn;
+	saver_job_t	 job;
+} saver_slot_t;
+
+static pthread_mutex_t	 lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 work = PTHREAD_COND_INITIALIZER;	/* something queued */
+static pthread_cond_t	 idle = PTHREAD_COND_INITIALIZER;	/* nothing left to do */
+static pthread_t	 worker;
+static int		 started;
+
+/* All protected by lock */
+static saver_slot_t	 pending[SAVER_NSLOTS];
+static int		 running;
+static int		 failed;
+
+/* The last gpg id we checked, so queuing a save doesn't look it up again */
+static char		*checked_id;
+
+static void
+saver_job_free(job)
+	saver_job_t	*job;
+{
+	if (job->buf) {
+		bzero(job->buf, job->len);
+		free(job->buf);
+	}
+	xfree(job->file);
+	xfree(job->id);
+	bzero(job, sizeof(*job));
+}
+
+static void
+saver_drop(slot)
+{
+	for (; slot < SAVER_NSLOTS; slot++) {
+		if (!pending[slot].fn)
+			continue;
+
+		saver_job_free(&pending[slot].job);
+		pending[slot].fn = NULL;
+	}
+}
+
+static void *
+saver_run(arg)
+	void	*arg;
+{
+saver_slot_t	s;
+int		i;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		for (i = 0; i < SAVER_NSLOTS; i++)
+			if (pending[i].fn)
+				break;
+
+		if (i == SAVER_NSLOTS) {
+			pthread_cond_broadcast(&idle);
+			pthread_cond_wait(&work, &lock);
+			continue;
+		}
+
+		s = pending[i];
+		pending[i].fn = NULL;
+		bzero(&pending[i].job, sizeof(pending[i].job));
+		running = 1;
+		pthread_mutex_unlock(&lock);
+
+		debug("saver_run: saving %s (%lu bytes)", s.job.file,
+		      (unsigned long) s.job.len);
+		if (s.fn(&s.job) != 0) {
+			/* Later saves depend on this one */
+			debug("saver_run: save of %s failed", s.job.file);
+			pthread_mutex_lock(&lock);
+			saver_drop(i + 1);
+			failed = 1;
+			pthread_mutex_unlock(&lock);
+		}
+		saver_job_free(&s.job);
+
+		pthread_mutex_lock(&lock);
+		running = 0;
+	}
+
+	/* NOTREACHED */
+	return NULL;
+}
+
+/*
+ * Queue buf to be saved to file by fn, taking ownership of buf.  Returns -1,
+ * without queuing anything, if the save can't be done in the background and
+ * the caller should save synchronously instead.
+ */
+int
+saver_queue(slot, fn, file, buf, len)
+	saver_fn_t	 fn;
+	char const	*file;
+	unsigned char	*buf;
+	size_t		 len;
+{
+	/* A bad id needs the user to choose another one */
+	if (!options->gpg_id)
+		return -1;
+
+	if (!checked_id || strcmp(checked_id, options->gpg_id) != 0) {
+		if (gnupg_check_id(options->gpg_id) != 0)
+			return -1;
+
+		xfree(checked_id);
+		checked_id = xstrdup(options->gpg_id);
+	}
+
+	if (!started) {
+		if (pthread_create(&worker, NULL, saver_run, NULL) != 0)
+			return -1;
+		started = 1;
+	}
+
+	pthread_mutex_lock(&lock);
+	saver_drop(slot);
+	pending[slot].fn = fn;
+	pending[slot].job.file = xstrdup(file);
+	pending[slot].job.id = xstrdup(options->gpg_id);
+	pending[slot].job.buf = buf;
+	pending[slot].job.len = len;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * Wait for everything queued to be written.
+ */
+void
+saver_flush()
+{
+int	i;
+
+	if (!started)
+		return;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		for (i = 0; i < SAVER_NSLOTS; i++)
+			if (pending[i].fn)
+				break;
+
+		if (i == SAVER_NSLOTS && !running)
+			break;
+
+		pthread_cond_wait(&idle, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Returns 1 if a save is waiting or in progress.
+ */
+int
+saver_busy()
+{
+int	i, ret;
+
+	pthread_mutex_lock(&lock);
+	ret = running;
+	for (i = 0; i < SAVER_NSLOTS; i++)
+		if (pending[i].fn)
+			ret = 1;
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+/*
+ * Returns 1 if a save has failed since the last call, in which case the
+ * caller should arrange for everything to be saved again.
+ */
+int
+saver_failed()
+{
+int	ret;
+
+	pthread_mutex_lock(&lock);
+	ret = failed;
+	failed = 0;
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
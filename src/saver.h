@@ -0,0 +1,58 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef	PWMAN_SAVER_H
+#define	PWMAN_SAVER_H
+
+/*
+ * The background saver.  The UI thread takes a plaintext snapshot of what
+ * needs saving and queues it; a worker thread encrypts and writes it, so the
+ * UI doesn't wait for gpg.
+ *
+ * Each kind of save has a slot.  Queuing a save replaces anything waiting in
+ * the same or a later slot, so a burst of changes is written once, and a
+ * full database write makes a pending journal write unnecessary.  Pending
+ * saves run in slot order, and if one fails, those after it are dropped.
+ */
+
+#define	SAVER_DB	0	/* the whole database */
+#define	SAVER_JOURNAL	1	/* the change journal */
+#define	SAVER_NSLOTS	2
+
+/* How often, in milliseconds, the UI checks whether a save has finished */
+#define	SAVER_POLL	250
+
+/* A snapshot to be saved.  buf is cleared and freed after the save. */
+typedef struct saver_job {
+	char		*file;
+	char		*id;
+	unsigned char	*buf;
+	size_t		 len;
+} saver_job_t;
+
+typedef int	(*saver_fn_t)(saver_job_t *);
+
+int	saver_queue(int slot, saver_fn_t, char const *file,
+		    unsigned char *buf, size_t len);
+void	saver_flush(void);
+int	saver_busy(void);
+int	saver_failed(void);
+
+#endif	/* !PWMAN_SAVER_H */
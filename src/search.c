@@ -21,11 +21,73 @@
 
 #include	<stdlib.h>
 #include	<string.h>
+#include	<ctype.h>
+#include	<unistd.h>
 
 #include	"pwman.h"
 #include	"ui.h"
-
-static search_result_t *_search_add_if_matches(search_result_t *, password_t *, folder_t *);
+#include	"trigram.h"
+#include	"workers.h"
+#include	"match.h"
+
+/* Searches smaller than this many items per thread aren't worth splitting */
+#define	SEARCH_MIN_SHARE	2048
+
+/* Fuzzy scoring; see search_fuzzy_score() */
+#define	FUZZY_MATCH		16	/* each character matched */
+#define	FUZZY_BOUNDARY		8	/* ... at the start of a word */
+#define	FUZZY_CONSECUTIVE	8	/* ... right after the previous one */
+#define	FUZZY_GAP_START		3	/* skipping characters between them */
+#define	FUZZY_GAP		1	/* ... per character skipped */
+#define	FUZZY_NAME		32	/* the match is in the name */
+#define	FUZZY_HOST		16	/* ... or the host */
+
+/* Only this many of the best fuzzy matches are shown */
+#define	FUZZY_MAX_RESULTS	256
+
+typedef struct search_hit {
+	int		 score;
+	password_t	*entry;
+	folder_t	*list;
+} search_hit_t;
+
+/* The best hits so far, as a heap with the worst at the top */
+typedef struct search_heap {
+	search_hit_t	*hits;
+	size_t		 n;
+	char		*term;		/* folded */
+} search_heap_t;
+
+/* Everything to be checked, in the order results are listed */
+typedef struct search_item {
+	folder_t	*list;
+	password_t	*entry;		/* NULL to check the list's name */
+	int		 match;
+} search_item_t;
+
+typedef struct search_state {
+	search_item_t	*items;
+	size_t		 n, size;
+	int		 use_index;
+	unsigned	 gen;		/* candidates are marked with this */
+} search_state_t;
+
+/* Each thread ranks its share of the entries in its own heap */
+typedef struct search_fuzzy {
+	password_t	**pws;
+	size_t		  n, size;
+	search_heap_t	  heaps[WORKERS_MAX];
+} search_fuzzy_t;
+
+/* The current search term, for substring searches */
+static match_t	search_match;
+
+/* Bumped for each indexed search, to mark its candidates */
+static unsigned	search_gen;
+
+static int	search_match_item(password_t *, folder_t *);
+static void	_search_alloc(size_t);
+static void	_search_append(password_t *, folder_t *);
 static void	_search_free(void);
 static int	search_active(search_t *srch);
 static int	search_apply(void);
@@ -40,82 +102,396 @@ search_t       *new;
 }
 
 /*
- * String checking only case insensitive using gnu glibc
+ * The fields searched are the ones in the trigram index; the password
+ * itself is never searched.
  */
-static char *
-search_strcasestr(haystack, needle)
-	char const     *haystack, *needle;
+static int
+search_match_pw(entry)
+	password_t	*entry;
 {
-	/* Never matches if null/empty string given */
-	if (haystack == NULL)
-		return 0;
+	return match_find(&search_match, PW_FIELD(entry, PW_NAME))
+	    || match_find(&search_match, PW_FIELD(entry, PW_HOST))
+	    || match_find(&search_match, PW_FIELD(entry, PW_USER))
+	    || match_find(&search_match, PW_FIELD(entry, PW_LAUNCH));
+}
 
-	if (strlen(haystack) == 0)
-		return 0;
+static int
+search_match_item(password_t *entry, folder_t *list)
+{
+	/* Did we get an entry of a list? */
+	if (entry != NULL)
+		return search_match_pw(entry);
+	else
+		return match_find(&search_match, list->name) != NULL;
+}
 
-#ifdef HAVE_STRCASESTR
-	return strcasestr(haystack, needle);
-#else
-	return strstr(haystack, needle);
-#endif
+/*
+ * Make room for n results, which are all allocated at once; with no results,
+ * search_results stays NULL.
+ */
+static void
+_search_alloc(size_t n)
+{
+	if (n > 0)
+		search_results = xcalloc(n, sizeof(*search_results));
+	nsearch_results = 0;
 }
 
+static void
+_search_append(password_t *entry, folder_t *list)
+{
+search_result_t *next = &search_results[nsearch_results++];
+
+	next->entry = entry;
+	next->sublist = list;
+}
 
-static search_result_t *
-_search_add_if_matches(search_result_t *current, password_t *entry, folder_t *list)
+/*
+ * Call fn for every list, starting with the top level, parents before their
+ * children.
+ */
+static void
+search_walk(fn, arg)
+	void	(*fn)(folder_t *, void *);
+	void	 *arg;
 {
-search_result_t *next = NULL;
+folder_iter_t	 it;
+folder_t	*list;
 
-	/* Did we get an entry of a list? */
-	if (entry != NULL) {
-		if (search_strcasestr(entry->name, options->search->search_term)
-		    || search_strcasestr(entry->host, options->search->search_term)
-		    || search_strcasestr(entry->user, options->search->search_term)
-		    || search_strcasestr(entry->passwd, options->search->search_term)
-		    || search_strcasestr(entry->launch, options->search->search_term)
-			) {
-			next = xcalloc(1, sizeof(*next));
-			next->entry = entry;
-			next->sublist = list;
-			debug("Matched entry on host '%s'", entry->host);
+	folder_iter_init(&it, folder, FOLDER_ENTER);
+	while ((list = folder_iter_next(&it)) != NULL)
+		fn(list, arg);
+}
+
+/*
+ * How many threads to search with: the configured number, or one per CPU.
+ */
+static int
+search_nthreads()
+{
+long	n = options->search_threads;
+
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n < 1)
+		return 1;
+	return n > WORKERS_MAX ? WORKERS_MAX : n;
+}
+
+static void
+search_add_item(st, list, entry)
+	search_state_t	*st;
+	folder_t	*list;
+	password_t	*entry;
+{
+	if (st->n == st->size) {
+		st->size = st->size ? st->size * 2 : 256;
+		st->items = realloc(st->items, st->size * sizeof(*st->items));
+	}
+
+	st->items[st->n].list = list;
+	st->items[st->n].entry = entry;
+	st->items[st->n].match = 0;
+	st->n++;
+}
+
+/*
+ * Queue everything to be checked, in the order results have always been
+ * listed: a list's name as it's entered, and its entries once its sublists
+ * are done.  With the index, only marked candidates are queued.
+ */
+static void
+search_queue_items(st)
+	search_state_t	*st;
+{
+folder_iter_t	 it;
+folder_t	*list;
+pw_entry_t	*e;
+uint32_t	 i;
+
+	folder_iter_init(&it, folder, FOLDER_ENTER | FOLDER_LEAVE);
+	while ((list = folder_iter_next(&it)) != NULL) {
+		if (it.event == FOLDER_ENTER) {
+			/* The top level has no name to match */
+			if (list->parent)
+				search_add_item(st, list, NULL);
+			continue;
 		}
-	} else {
-		if (search_strcasestr(list->name, options->search->search_term)) {
-			next = xcalloc(1, sizeof(*next));
-			next->sublist = list;
-			next->entry = NULL;
-			debug("Matched sublist '%s'", list->name);
+
+		if (st->use_index && list->search_gen != st->gen)
+			continue;
+
+		for (i = 0, e = list->list.ents; i < list->list.n; i++, e++)
+			if (!st->use_index || e->search_gen == st->gen)
+				search_add_item(st, list, e->pw);
+	}
+}
+
+static void
+search_check_items(arg, start, end, worker)
+	void	*arg;
+	size_t	 start, end;
+{
+search_state_t	*st = arg;
+size_t		 i;
+
+	for (i = start; i < end; i++)
+		st->items[i].match = search_match_item(st->items[i].entry,
+						       st->items[i].list);
+}
+
+/*
+ * fzf-style scoring of pat as a subsequence of text, both folded: -1 if it
+ * isn't one, otherwise higher the closer together its characters are and the
+ * more of them start words.  Only the shortest stretch of text ending where
+ * the first match ends is scored.
+ */
+static int
+search_fuzzy_score(text, pat)
+	char const	*text, *pat;
+{
+size_t	i, p, start, end, plen = strlen(pat);
+long	prev = -1;
+int	score = 0;
+
+	for (i = 0, p = 0; text[i] && p < plen; i++)
+		if (text[i] == pat[p])
+			p++;
+	if (p < plen)
+		return -1;
+	end = i - 1;
+
+	for (i = end, p = plen - 1;; i--) {
+		if (text[i] != pat[p])
+			continue;
+		if (p == 0)
+			break;
+		p--;
+	}
+	start = i;
+
+	for (i = start, p = 0; i <= end && p < plen; i++) {
+		if (text[i] != pat[p])
+			continue;
+
+		score += FUZZY_MATCH;
+		if (i == 0 || !isalnum((unsigned char) text[i - 1]))
+			score += FUZZY_BOUNDARY;
+
+		if (prev == (long) i - 1)
+			score += FUZZY_CONSECUTIVE;
+		else if (prev >= 0)
+			score -= FUZZY_GAP_START + FUZZY_GAP * (i - prev - 1);
+
+		prev = i;
+		p++;
+	}
+
+	return score;
+}
+
+/*
+ * > 0 if a should be listed before b.
+ */
+static int
+search_hit_cmp(a, b)
+	search_hit_t const	*a, *b;
+{
+int	ida, idb;
+
+	if (a->score != b->score)
+		return a->score - b->score;
+
+	/* Lists before entries, then in the order they were added */
+	if (!a->entry != !b->entry)
+		return a->entry ? -1 : 1;
+
+	ida = a->entry ? PW_ENT(a->entry)->id : a->list->id;
+	idb = b->entry ? PW_ENT(b->entry)->id : b->list->id;
+	return idb - ida;
+}
+
+static int
+search_hit_order(a, b)
+	void const	*a, *b;
+{
+	return search_hit_cmp(b, a);
+}
+
+static void
+search_heap_push(h, hit)
+	search_heap_t	*h;
+	search_hit_t	*hit;
+{
+size_t	i, c;
+
+	if (h->n < FUZZY_MAX_RESULTS) {
+		/* Not full yet; sift the new hit up */
+		for (i = h->n++; i > 0; i = (i - 1) / 2) {
+			if (search_hit_cmp(hit, &h->hits[(i - 1) / 2]) >= 0)
+				break;
+			h->hits[i] = h->hits[(i - 1) / 2];
 		}
+		h->hits[i] = *hit;
+		return;
 	}
 
-	/* If we matched, append */
-	if (next == NULL)
-		return current;
+	/* Full, so it has to beat the worst we have, then sift down */
+	if (search_hit_cmp(hit, &h->hits[0]) <= 0)
+		return;
 
-	if (current == NULL) {
-		/* First hit */
-		search_results = next;
-	} else {
-		/* Additional hit, append */
-		current->next = next;
+	for (i = 0; (c = i * 2 + 1) < h->n; i = c) {
+		if (c + 1 < h->n && search_hit_cmp(&h->hits[c + 1], &h->hits[c]) < 0)
+			c++;
+		if (search_hit_cmp(hit, &h->hits[c]) <= 0)
+			break;
+		h->hits[i] = h->hits[c];
 	}
+	h->hits[i] = *hit;
+}
+
+static void
+search_fuzzy_entry(h, pw)
+	search_heap_t	*h;
+	password_t	*pw;
+{
+search_hit_t	 hit;
+int		 i, s;
+
+	if (!pw->parent)
+		return;
+
+	hit.score = -1;
+	for (i = 0; i < TRIGRAM_NFIELDS; i++) {
+		if ((s = search_fuzzy_score(TRIGRAM_FIELD(pw, i), h->term)) < 0)
+			continue;
 
-	/* For now, nothing follows us */
-	next->next = NULL;
-	/* We are the new current entry */
-	return next;
+		if (i == TRIGRAM_NAME)
+			s += FUZZY_NAME;
+		else if (i == TRIGRAM_HOST)
+			s += FUZZY_HOST;
+
+		if (s > hit.score)
+			hit.score = s;
+	}
+
+	if (hit.score < 0)
+		return;
+
+	hit.entry = pw;
+	hit.list = pw->parent;
+	search_heap_push(h, &hit);
+}
+
+static void
+search_fuzzy_list(list, arg)
+	folder_t	*list;
+	void		*arg;
+{
+search_heap_t	*h = arg;
+search_hit_t	 hit;
+char		*name, *p;
+
+	if (!list->parent || !list->name)
+		return;
+
+	name = xstrdup(list->name);
+	for (p = name; *p; p++)
+		*p = TRIGRAM_FOLD(*(unsigned char *) p);
+
+	hit.score = search_fuzzy_score(name, h->term);
+	xfree(name);
+
+	if (hit.score < 0)
+		return;
+
+	hit.score += FUZZY_NAME;
+	hit.entry = NULL;
+	hit.list = list;
+	search_heap_push(h, &hit);
 }
 
+static void
+search_fuzzy_collect(pw, arg)
+	password_t	*pw;
+	void		*arg;
+{
+search_fuzzy_t	*fz = arg;
+
+	if (fz->n == fz->size) {
+		fz->size = fz->size ? fz->size * 2 : 1024;
+		fz->pws = realloc(fz->pws, fz->size * sizeof(*fz->pws));
+	}
+
+	fz->pws[fz->n++] = pw;
+}
+
+static void
+search_fuzzy_share(arg, start, end, worker)
+	void	*arg;
+	size_t	 start, end;
+{
+search_fuzzy_t	*fz = arg;
+size_t		 i;
+
+	for (i = start; i < end; i++)
+		search_fuzzy_entry(&fz->heaps[worker], fz->pws[i]);
+}
+
+/*
+ * Score everything against the term, keeping only the best, and list them
+ * best first.
+ */
 static int
-search_apply()
+search_apply_fuzzy()
 {
-folder_t       *stack[MAX_SEARCH_DEPTH];
-folder_t       *tmpList = NULL;
-password_t     *tmp = NULL;
-int		depth;
-int		stepping_back;
+search_fuzzy_t	 fz;
+search_heap_t	*h = &fz.heaps[0];
+char		*term, *p;
+int		 nthreads = search_nthreads(), t;
+size_t		 i;
+
+	term = xstrdup(options->search->search_term);
+	for (p = term; *p; p++)
+		*p = TRIGRAM_FOLD(*(unsigned char *) p);
+
+	bzero(&fz, sizeof(fz));
+	for (t = 0; t < nthreads; t++) {
+		fz.heaps[t].hits = xmalloc(FUZZY_MAX_RESULTS * sizeof(*h->hits));
+		fz.heaps[t].term = term;
+	}
+
+	trigram_foreach(search_fuzzy_collect, &fz);
+	workers_run(nthreads, fz.n, SEARCH_MIN_SHARE, search_fuzzy_share, &fz);
+
+	/* The best overall are among the best of each share */
+	for (t = 1; t < nthreads; t++) {
+		for (i = 0; i < fz.heaps[t].n; i++)
+			search_heap_push(h, &fz.heaps[t].hits[i]);
+		free(fz.heaps[t].hits);
+	}
+
+	search_walk(search_fuzzy_list, h);
 
-search_result_t *cur = NULL;
+	qsort(h->hits, h->n, sizeof(*h->hits), search_hit_order);
+	_search_alloc(h->n);
+	for (i = 0; i < h->n; i++)
+		_search_append(h->hits[i].entry, h->hits[i].list);
+
+	free(h->hits);
+	free(fz.pws);
+	xfree(term);
+	return 1;
+}
+
+static int
+search_apply()
+{
+search_state_t	 st;
+uint32_t const	*cands;
+password_t	*pw;
+size_t		 ncands, nhits, i;
 
 	/* Tidy up any existing search results */
 	if (search_results != NULL)
@@ -125,52 +501,48 @@ search_result_t *cur = NULL;
 	if (search_active(options->search) == 0)
 		return 1;
 
-	/* Make sure we have a clean search stack so we won't get confused */
-	for (depth = 0; depth < MAX_SEARCH_DEPTH; depth++)
-		stack[depth] = NULL;
+	if (options->search->fuzzy)
+		return search_apply_fuzzy();
+
+	match_set(&search_match, options->search->search_term);
+
+	/*
+	 * If the index can narrow it down, only the entries it gives us need
+	 * checking.  They and their lists are marked, so the walk only looks
+	 * at the entries of lists with candidates in them.
+	 */
+	bzero(&st, sizeof(st));
+	st.use_index = (trigram_candidates(options->search->search_term,
+					   &cands, &ncands) == 0);
+
+	if (st.use_index) {
+		if (++search_gen == 0)
+			search_gen = 1;
+		st.gen = search_gen;
+
+		for (i = 0; i < ncands; i++) {
+			pw = pwstore_table[cands[i]];
+			if (!pw->parent)
+				continue;
+			PW_ENT(pw)->search_gen = st.gen;
+			pw->parent->search_gen = st.gen;
+		}
+	}
 
-	/* Setup for start */
-	depth = 0;
-	tmpList = folder;
-	stepping_back = 0;
+	search_queue_items(&st);
 
-	/* Find anything we like the look of */
-	while (depth >= 0) {
-		/* Any sublists? */
-		if (!stepping_back && tmpList->sublists != NULL && depth < MAX_SEARCH_DEPTH) {
-			/* Prepare to descend */
-			stack[depth] = tmpList;
-			depth++;
-			tmpList = tmpList->sublists;
+	/* Check them in parallel, then list the matches in order */
+	workers_run(search_nthreads(), st.n, SEARCH_MIN_SHARE,
+		    search_check_items, &st);
 
-			/* Test first child */
-			cur = _search_add_if_matches(cur, NULL, tmpList);
+	for (i = 0, nhits = 0; i < st.n; i++)
+		nhits += st.items[i].match;
 
-			/* Descend into first child */
-			continue;
-		}
-		stepping_back = 0;
-
-		/* Any entries? */
-		PWLIST_FOREACH(tmp, &tmpList->list)
-			cur = _search_add_if_matches(cur, tmp, tmpList);
-
-		/* Next sibling if there is one */
-		if (tmpList->next != NULL) {
-			tmpList = tmpList->next;
-			/* Test sibling */
-			cur = _search_add_if_matches(cur, NULL, tmpList);
-			/* Process sibling */
-			continue;
-		}
-		/* Otherwise step up */
-		depth--;
-		stepping_back = 1;
-		if (depth >= 0) {
-			tmpList = stack[depth];
-			stack[depth] = NULL;
-		}
-	}
+	_search_alloc(nhits);
+	for (i = 0; i < st.n; i++)
+		if (st.items[i].match)
+			_search_append(st.items[i].entry, st.items[i].list);
+	free(st.items);
 
 	/* All done */
 	return 1;
@@ -196,39 +568,101 @@ search_remove()
 void
 _search_free()
 {
-search_result_t *cur;
-search_result_t *next;
-
 	/* Free the memory held by the search results */
-	cur = search_results;
-	while (cur != NULL) {
-		next = cur->next;
-		xfree(cur);
-		cur = next;
-	}
+	xfree(search_results);
 	search_results = NULL;
+	nsearch_results = 0;
+	filter_invalidate();
+}
+
+/*
+ * The term has grown to include the old one, so only entries already found
+ * can match; drop the ones that no longer do.
+ */
+static void
+search_refine()
+{
+size_t	i, n;
+
+	match_set(&search_match, options->search->search_term);
+
+	for (i = 0, n = 0; i < nsearch_results; i++)
+		if (search_match_item(search_results[i].entry,
+				      search_results[i].sublist))
+			search_results[n++] = search_results[i];
+
+	if ((nsearch_results = n) == 0) {
+		xfree(search_results);
+		search_results = NULL;
+	}
+	filter_invalidate();
+}
+
+/*
+ * Called as the search term is typed.
+ */
+static void
+search_update(term)
+	char const	*term;
+{
+char	*old = options->search->search_term;
+match_t	 m;
+
+	options->search->search_term = xstrdup(term);
+
+	bzero(&m, sizeof(m));
+	if (old && *old)
+		match_set(&m, old);
+
+	/* Fuzzy results are ranked, so can't just be trimmed */
+	if (old && *old && !options->search->fuzzy && match_find(&m, term))
+		search_refine();
+	else
+		search_apply();
+	match_clear(&m);
+	xfree(old);
+
+	current_pw_sublist->current_item = -1;
+	uilist_refresh();
 }
 
 void
-search_get()
+search_get(fuzzy)
 {
+char	*term;
+
 	if (options->search == NULL) {
 		debug("No options->search");
-	} else {
-		if (options->search->search_term == NULL) {
-			debug("No options->search->search_term");
-		} else {
-			debug("Len was %d", strlen(options->search->search_term));
-		}
+		return;
 	}
 
+	/* Start from nothing, so the first key searches the whole tree */
+	_search_free();
 	xfree(options->search->search_term);
-	options->search->search_term = ui_ask_str("String to search for:", NULL);
+	options->search->search_term = NULL;
+	options->search->fuzzy = fuzzy;
 
-	search_apply();
+	term = ui_ask_str_incremental(fuzzy ? "Fuzzy search for:"
+					    : "String to search for:",
+				      NULL, search_update);
 
-	current_pw_sublist->current_item = -1;
-	uilist_refresh();
+	/* Cancelling the prompt cancels the search */
+	search_update(term ? term : "");
+	xfree(term);
+}
+
+/*
+ * Search the whole tree for term without touching the screen, leaving the
+ * matches in search_results.
+ */
+void
+search_run(term)
+	char const	*term;
+{
+	xfree(options->search->search_term);
+	options->search->search_term = xstrdup(term);
+	options->search->fuzzy = 0;
+	search_apply();
 }
 
 void
@@ -240,9 +674,14 @@ char		alert[80];
 		return;
 
 	if (search_results == NULL)
-		sprintf(alert, " (No results found for '%s')", srch->search_term);
+		snprintf(alert, sizeof(alert), " (No results found for '%s')",
+			 srch->search_term);
+	else if (srch->fuzzy)
+		snprintf(alert, sizeof(alert), " (Best matches for '%s')",
+			 srch->search_term);
 	else
-		sprintf(alert, " (Search results for '%s')", srch->search_term);
+		snprintf(alert, sizeof(alert), " (Search results for '%s')",
+			 srch->search_term);
 
 	ui_statusline_clear();
 	ui_statusline_msg(alert);
@@ -0,0 +1,338 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The trigram index.  Each trigram (three case-folded bytes, packed into an
+ * integer) has a posting list of the entries containing it, by their number
+ * in pwstore_table.
+ *
+ * Posting lists are unordered and entries are removed by swapping in the
+ * last element.  A search takes the shortest posting list of the term's
+ * trigrams and checks each entry on it, so the index only has to narrow the
+ * search down, not answer it exactly.
+ *
+ * Each entry keeps a case-folded copy of its indexed fields in the string
+ * pool, which the fuzzy search scans instead of folding every field on every
+ * search.  They're also what the entry was indexed under, so it can be taken
+ * out again after its fields have changed.  A field with nothing to fold
+ * shares its folded copy with the field itself.
+ */
+
+#include	<stdlib.h>
+#include	<string.h>
+
+#include	"pwman.h"
+#include	"trigram.h"
+
+typedef struct trigram_posting {
+	uint32_t	 key;		/* 0 for an empty slot */
+	uint32_t	*nums;
+	size_t		 n, size;
+} trigram_posting_t;
+
+/* trigram -> entries, open addressed */
+static trigram_posting_t	*postings;
+static size_t			 npostings, postsize;
+
+static int const	trigram_fields[TRIGRAM_NFIELDS] = {
+	PW_NAME, PW_HOST, PW_USER, PW_LAUNCH
+};
+
+static trigram_posting_t *
+trigram_find(key, create)
+	uint32_t	key;
+{
+trigram_posting_t	*old;
+size_t			 i, oldsize;
+
+	if (create && (npostings + 1) * 2 > postsize) {
+		old = postings;
+		oldsize = postsize;
+
+		postsize = postsize ? postsize * 2 : 1024;
+		postings = xcalloc(postsize, sizeof(*postings));
+
+		for (i = 0; i < oldsize; i++) {
+		size_t	j;
+
+			if (!old[i].key)
+				continue;
+
+			for (j = (old[i].key * 2654435761U) & (postsize - 1);
+			     postings[j].key; j = (j + 1) & (postsize - 1))
+				;
+			postings[j] = old[i];
+		}
+		free(old);
+	}
+
+	if (!postsize)
+		return NULL;
+
+	for (i = (key * 2654435761U) & (postsize - 1); postings[i].key;
+	     i = (i + 1) & (postsize - 1))
+		if (postings[i].key == key)
+			return &postings[i];
+
+	if (!create)
+		return NULL;
+
+	postings[i].key = key;
+	npostings++;
+	return &postings[i];
+}
+
+static int
+trigram_cmp(a, b)
+	void const	*a, *b;
+{
+uint32_t	x = *(uint32_t const *) a, y = *(uint32_t const *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+trigram_extract_str(s, keys, n, size)
+	char const	 *s;
+	uint32_t	**keys;
+	size_t		 *n, *size;
+{
+unsigned char const	*p = (unsigned char const *) s;
+uint32_t		 k;
+
+	if (!s || !p[0] || !p[1])
+		return;
+
+	k = (TRIGRAM_FOLD(p[0]) << 8) | TRIGRAM_FOLD(p[1]);
+	for (p += 2; *p; p++) {
+		k = ((k << 8) | TRIGRAM_FOLD(*p)) & 0xFFFFFF;
+
+		if (*n == *size) {
+			*size = *size ? *size * 2 : 64;
+			*keys = realloc(*keys, *size * sizeof(**keys));
+		}
+		(*keys)[(*n)++] = k;
+	}
+}
+
+/*
+ * Return the distinct trigrams of the folded fields in folds, sorted.
+ */
+static size_t
+trigram_extract(folds, keys)
+	char const	 *folds[TRIGRAM_NFIELDS];
+	uint32_t	**keys;
+{
+size_t	n = 0, size = 0, i, j;
+
+	*keys = NULL;
+	for (i = 0; i < TRIGRAM_NFIELDS; i++)
+		trigram_extract_str(folds[i], keys, &n, &size);
+
+	if (n == 0)
+		return 0;
+
+	qsort(*keys, n, sizeof(**keys), trigram_cmp);
+	for (i = 1, j = 1; i < n; i++)
+		if ((*keys)[i] != (*keys)[j - 1])
+			(*keys)[j++] = (*keys)[i];
+	return j;
+}
+
+static void
+trigram_unpost(num, keys, nkeys)
+	uint32_t	 num;
+	uint32_t	*keys;
+	size_t		 nkeys;
+{
+trigram_posting_t	*p;
+size_t			 i, j;
+
+	for (i = 0; i < nkeys; i++) {
+		if ((p = trigram_find(keys[i], 0)) == NULL)
+			continue;
+
+		for (j = 0; j < p->n; j++) {
+			if (p->nums[j] != num)
+				continue;
+
+			p->nums[j] = p->nums[--p->n];
+			break;
+		}
+	}
+}
+
+static void
+trigram_post(num, keys, nkeys)
+	uint32_t	 num;
+	uint32_t	*keys;
+	size_t		 nkeys;
+{
+trigram_posting_t	*p;
+size_t			 i;
+
+	for (i = 0; i < nkeys; i++) {
+		p = trigram_find(keys[i], 1);
+
+		if (p->n == p->size) {
+			p->size = p->size ? p->size * 2 : 4;
+			p->nums = realloc(p->nums, p->size * sizeof(*p->nums));
+		}
+		p->nums[p->n++] = num;
+	}
+}
+
+/*
+ * Index pw, or re-index it if its fields have changed since it was added.
+ */
+void
+trigram_add(pw)
+	password_t	*pw;
+{
+char		*folds[TRIGRAM_NFIELDS], *p;
+uint32_t	*keys;
+size_t		 nkeys, i;
+int		 same = 1;
+
+	for (i = 0; i < TRIGRAM_NFIELDS; i++) {
+		folds[i] = xstrdup(PW_FIELD(pw, trigram_fields[i]));
+		for (p = folds[i]; *p; p++)
+			*p = TRIGRAM_FOLD(*(unsigned char *) p);
+
+		if (strcmp(folds[i], TRIGRAM_FIELD(pw, i)) != 0)
+			same = 0;
+	}
+
+	/* Moving an entry doesn't change what it contains */
+	if (same)
+		goto done;
+
+	trigram_remove(pw);
+
+	for (i = 0; i < TRIGRAM_NFIELDS; i++) {
+		if (strcmp(folds[i], PW_FIELD(pw, trigram_fields[i])) == 0)
+			pwstore_share(pw, PW_FOLD + i, trigram_fields[i]);
+		else
+			pwstore_set(pw, PW_FOLD + i, folds[i],
+				    trigram_fields[i] != PW_NAME);
+	}
+
+	nkeys = trigram_extract((char const **) folds, &keys);
+	trigram_post(pw->num, keys, nkeys);
+	free(keys);
+
+done:
+	for (i = 0; i < TRIGRAM_NFIELDS; i++)
+		xfree(folds[i]);
+}
+
+void
+trigram_remove(pw)
+	password_t	*pw;
+{
+char const	*folds[TRIGRAM_NFIELDS];
+uint32_t	*keys;
+size_t		 nkeys, i;
+
+	for (i = 0; i < TRIGRAM_NFIELDS; i++)
+		folds[i] = TRIGRAM_FIELD(pw, i);
+
+	nkeys = trigram_extract(folds, &keys);
+	trigram_unpost(pw->num, keys, nkeys);
+	free(keys);
+
+	for (i = 0; i < TRIGRAM_NFIELDS; i++)
+		pwstore_set(pw, PW_FOLD + i, NULL, 0);
+}
+
+/*
+ * Forget the posting lists.  The folded fields go with the entries.
+ */
+void
+trigram_clear()
+{
+size_t	i;
+
+	for (i = 0; i < postsize; i++)
+		free(postings[i].nums);
+	free(postings);
+	postings = NULL;
+	npostings = postsize = 0;
+}
+
+/*
+ * Find the entries that might contain term: every entry containing it is
+ * in the returned list of numbers in pwstore_table, which stays valid until
+ * the index is next changed.
+ * Returns -1 if the term is too short for the index to help.
+ */
+int
+trigram_candidates(term, nums, n)
+	char const	  *term;
+	uint32_t const	 **nums;
+	size_t		  *n;
+{
+trigram_posting_t	*p, *best = NULL;
+uint32_t		*keys = NULL;
+size_t			 nkeys = 0, size = 0, i;
+
+	*nums = NULL;
+	*n = 0;
+
+	if (strlen(term) < TRIGRAM_MIN_TERM)
+		return -1;
+
+	trigram_extract_str(term, &keys, &nkeys, &size);
+
+	for (i = 0; i < nkeys; i++) {
+		/* A trigram no entry has means nothing can match */
+		if ((p = trigram_find(keys[i], 0)) == NULL || p->n == 0) {
+			best = NULL;
+			break;
+		}
+
+		if (!best || p->n < best->n)
+			best = p;
+	}
+	free(keys);
+
+	if (best) {
+		*nums = best->nums;
+		*n = best->n;
+	}
+
+	return 0;
+}
+
+/*
+ * Call fn for every entry in a list, in no particular order.  Its folded
+ * fields are TRIGRAM_FIELD().
+ */
+void
+trigram_foreach(fn, arg)
+	trigram_visit_t	 fn;
+	void		*arg;
+{
+uint32_t	i;
+
+	for (i = 0; i < pwstore_ntable; i++)
+		if (pwstore_table[i] && pwstore_table[i]->parent)
+			fn(pwstore_table[i], arg);
+}
@@ -0,0 +1,53 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef	PWMAN_TRIGRAM_H
+#define	PWMAN_TRIGRAM_H
+
+/*
+ * An index of the case-folded trigrams in each entry's name, host, user and
+ * launch command, so a substring search only has to look at the entries
+ * containing every trigram of the search term.
+ */
+
+/* Terms shorter than this can't use the index */
+#define	TRIGRAM_MIN_TERM	3
+
+#define	TRIGRAM_FOLD(c)	((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+
+/* The indexed fields, in the order trigram_foreach passes them */
+#define	TRIGRAM_NAME		0
+#define	TRIGRAM_HOST		1
+#define	TRIGRAM_USER		2
+#define	TRIGRAM_LAUNCH		3
+#define	TRIGRAM_NFIELDS		4
+
+/* An entry's folded copy of indexed field i */
+#define	TRIGRAM_FIELD(pw, i)	PW_STR((pw), PW_FOLD + (i))
+
+typedef void	(*trigram_visit_t)(password_t *, void *);
+
+void	trigram_add(password_t *);
+void	trigram_remove(password_t *);
+void	trigram_clear(void);
+int	trigram_candidates(char const *, uint32_t const **, size_t *);
+void	trigram_foreach(trigram_visit_t, void *);
+
+#endif	/* !PWMAN_TRIGRAM_H */
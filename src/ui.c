@@ -24,12 +24,16 @@
 
 #include	<time.h>
 #include	<stdlib.h>
+#include	<stdio.h>
+#include	<termios.h>
+#include	<unistd.h>
 #include	<assert.h>
 
 #include	"pwman.h"
 #include	"ui.h"
 #include	"actions.h"
 #include	"gnupg.h"
+#include	"saver.h"
 
 static void	ui_draw_top(void);
 static void	ui_draw_bottom(void);
@@ -39,10 +43,12 @@ static void	ui_display_help(void);
 static void	ui_resize_windows(void);
 
 static char	*ui_statusline_prompt(char const *, char const *, int,
-		     char *(*) (void), int);
+		     char *(*) (void), int, void (*) (char const *));
 
 static int	should_resize = FALSE;
 static int	can_resize = FALSE;
+static int	shown_saving = FALSE;	/* top line says we're saving */
+static int	started = FALSE;	/* curses is running */
 
 static WINDOW  *top = NULL, *bottom = NULL;
 
@@ -60,6 +66,8 @@ char	text[128];
 		strlcat(text, " | " READONLY_MSG, sizeof(text));
 	if (options->safemode)
 		strlcat(text, " | " SAFE_MSG, sizeof(text));
+	if ((shown_saving = saver_busy()))
+		strlcat(text, " | " SAVING_MSG, sizeof(text));
 
 	strlcat(text, " | " MAIN_HELPLINE, sizeof(text));
 	mvwprintw(top, 0, 0, "%s", text);
@@ -191,6 +199,7 @@ ui_init()
 	signal(SIGWINCH, ui_win_changed);
 #endif
 
+	started = TRUE;
 	ui_init_windows();
 	ui_refresh_windows();
 	return 0;
@@ -217,6 +226,7 @@ static char    *help[] = {
 	"",
 	"	f		enable / disable filtering",
 	"	/		enable / disable searching",
+	"	F		fuzzy search, best matches first",
 	"",
 	"       B               copy username",
 	"       C               copy password",
@@ -286,7 +296,18 @@ int		debug_i = 0;
 		if (should_resize) {
 			ui_resize();
 		}
+
+		/* Wake up now and then to notice a background save finishing */
+		timeout(SAVER_POLL);
 		ch = getch();
+		timeout(-1);
+
+		if (ch == ERR) {
+			if (saver_busy() != shown_saving)
+				ui_draw_top();
+			continue;
+		}
+
 		ui_statusline_clear();
 		can_resize = FALSE;
 
@@ -352,21 +373,17 @@ int		debug_i = 0;
 			break;
 
 		case 'r':
-			if (!options->readonly) {
+			if (!options->readonly)
 				action_list_rename();
-				folder_write_file();
-			} else {
+			else
 				statusline_readonly();
-			}
 			break;
 
 		case 'a':
-			if (!options->readonly) {
+			if (!options->readonly)
 				action_list_add_pw();
-				folder_write_file();
-			} else {
+			else
 				statusline_readonly();
-			}
 			break;
 
 		case 'e':
@@ -408,7 +425,7 @@ int		debug_i = 0;
 
 		case 0x17:	/* control-w */
 			if (!options->readonly)
-				folder_write_file();
+				folder_save();
 			else
 				statusline_readonly();
 			break;
@@ -430,8 +447,11 @@ int		debug_i = 0;
 			break;
 
 		case '/':
+			search_get(0);
+			break;
+
 		case 'F':
-			search_get();
+			search_get(1);
 			break;
 
 		case 'f':
@@ -482,6 +502,11 @@ int		debug_i = 0;
 		default:
 			break;
 		}
+
+		/* Make whatever was just changed durable */
+		folder_write_changes();
+		if (saver_busy() != shown_saving)
+			ui_draw_top();
 	}
 	return 0;
 }
@@ -489,6 +514,7 @@ int		debug_i = 0;
 int
 ui_end()
 {
+	started = FALSE;
 	ui_free_windows();
 	clear();
 	refresh();
@@ -500,6 +526,12 @@ ui_end()
 int
 ui_statusline_msg(char const *msg)
 {
+	/* Without the screen, e.g. when run from a script */
+	if (!started) {
+		fprintf(stderr, "pwman: %s\n", msg);
+		return 0;
+	}
+
 	ui_statusline_clear();
 	mvwaddstr(bottom, 0, 0, msg);
 	refresh();
@@ -510,6 +542,9 @@ ui_statusline_msg(char const *msg)
 int
 ui_statusline_clear()
 {
+	if (!started)
+		return 0;
+
 	wmove(bottom, 0, 0);
 	wclrtoeol(bottom);
 	wrefresh(bottom);
@@ -523,7 +558,7 @@ ui_ask_num(char const *msg)
 char           *line;
 int		ret;
 
-	line = ui_statusline_prompt(msg, NULL, 0, NULL, 0);
+	line = ui_statusline_prompt(msg, NULL, 0, NULL, 0, NULL);
 	if (!line)
 		return 0;
 
@@ -565,7 +600,7 @@ char           *
 ui_ask_str(msg, def)
 	char const     *msg, *def;
 {
-	return ui_statusline_prompt(msg, def, 0, NULL, 0);
+	return ui_statusline_prompt(msg, def, 0, NULL, 0, NULL);
 }
 
 char           *
@@ -576,14 +611,25 @@ ui_ask_str_with_autogen(msg, def, autogen, ch)
 char		prompt    [128];
 
 	snprintf(prompt, sizeof(prompt), "Password (^%c for autogen): ", 0x40 + ch);
-	return ui_statusline_prompt(prompt, def, 0, autogen, ch);
+	return ui_statusline_prompt(prompt, def, 0, autogen, ch, NULL);
+}
+
+/*
+ * As ui_ask_str(), but call changed with the input each time it's edited.
+ */
+char           *
+ui_ask_str_incremental(msg, def, changed)
+	char const     *msg, *def;
+	void		(*changed) (char const *);
+{
+	return ui_statusline_prompt(msg, def, 0, NULL, 0, changed);
 }
 
 char           *
 ui_ask_passwd(msg, def)
 	char const     *msg, *def;
 {
-	return ui_statusline_prompt(msg, def, 1, NULL, 0);
+	return ui_statusline_prompt(msg, def, 1, NULL, 0, NULL);
 }
 
 int
@@ -628,21 +674,76 @@ int		ch;
 	return ret;
 }
 
+/*
+ * Prompt on the terminal without curses, falling back to reading a line from
+ * standard input if there isn't one.  Returns NULL at end of file.
+ */
+static char    *
+ui_line_prompt(msg, secret)
+	char const     *msg;
+{
+FILE	       *in, *out;
+struct termios	old, new;
+char		input[256], *ret = NULL;
+int		noecho = 0;
+
+	if ((in = fopen("/dev/tty", "r")) == NULL ||
+	    (out = fopen("/dev/tty", "w")) == NULL) {
+		if (in)
+			fclose(in);
+		in = stdin;
+		out = stderr;
+	}
+
+	if (isatty(fileno(in))) {
+		fprintf(out, "%s ", msg);
+		fflush(out);
+	}
+
+	if (secret && tcgetattr(fileno(in), &old) == 0) {
+		new = old;
+		new.c_lflag &= ~ECHO;
+		noecho = (tcsetattr(fileno(in), TCSAFLUSH, &new) == 0);
+	}
+
+	if (fgets(input, sizeof(input), in) != NULL) {
+		input[strcspn(input, "\r\n")] = '\0';
+		ret = xstrdup(input);
+	}
+
+	if (noecho) {
+		tcsetattr(fileno(in), TCSAFLUSH, &old);
+		fputc('\n', out);
+	}
+
+	bzero(input, sizeof(input));
+	if (in != stdin) {
+		fclose(in);
+		fclose(out);
+	}
+	return ret;
+}
+
 static char    *
-ui_statusline_prompt(msg, def, secret, gen, genc)
+ui_statusline_prompt(msg, def, secret, gen, genc, changed)
 	char const     *msg, *def;
 	char           *(*gen) (void);
+	void		(*changed) (char const *);
 {
 WINDOW         *pwin;
-char		input[256];
+char		input[256], last[256];
 size_t		pos = 0;
 int		old_curs;
 
+	if (!started)
+		return ui_line_prompt(msg, secret);
+
 	bzero(input, sizeof(input));
 	if (def) {
 		strlcpy(input, def, sizeof(input));
 		pos = strlen(input);
 	}
+	strlcpy(last, input, sizeof(last));
 	pwin = newwin(1, COLS, LINES - 1, 0);
 	keypad(pwin, TRUE);
 
@@ -762,6 +863,13 @@ int		old_curs;
 
 			break;
 		}
+
+		/* Let the caller act on the input as it's typed */
+		if (changed && strcmp(input, last) != 0) {
+			strlcpy(last, input, sizeof(last));
+			changed(input);
+			touchwin(pwin);
+		}
 	}
 end:	;
 
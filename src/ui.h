@@ -91,6 +91,7 @@ int		ui_ask_yes_no(char const *, int);
 int		ui_ask_num (char const *);
 int		ui_ask_char(char const *, char *);
 char           *ui_ask_str(char const *, char const *);
+char           *ui_ask_str_incremental(char const *, char const *, void (*) (char const *));
 char           *ui_ask_passwd(char const *, char const *);
 char           *ui_ask_str_with_autogen(char const *msg, char const *, char *(*autogen) (void), int ch);
 
@@ -24,19 +24,36 @@
 #include	"ui.h"
 #include	"pwman.h"
 
+/*
+ * One row of the list, in display order.  The rows are built once each time
+ * what the list shows changes, so drawing and moving the cursor only ever
+ * look at the rows on screen.
+ */
+typedef struct uilist_row {
+	LIST_ITEM_TYPE	 type;
+	folder_t	*sublist;
+	password_t	*entry;
+	search_result_t	*result;
+} uilist_row_t;
+
 static void	uilist_highlight_line(int line);
-static int	_uilist_render_sublist(folder_t *sublist, int i, int num_shown);
-static int	_uilist_render_entry(password_t *entry, int i, int num_shown);
+static void	uilist_draw(void);
 
 static WINDOW  *list;
-static int	lines = 0;
 static int	first_list_item = 0;
 
+static uilist_row_t	*rows;
+static int		 nrows, rowsize;
+static folder_t		*rows_list;	/* what the rows were built for */
+static search_result_t	*rows_search;
+static unsigned		 rows_gen;
+
 void
 uilist_init()
 {
 	list = newwin(LIST_LINES, COLS, LIST_TOP, 0);
 	scrollok(list, TRUE);
+	idlok(list, TRUE);
 }
 
 /*
@@ -68,234 +85,223 @@ int		i;
 	scrollok(list, TRUE);
 }
 
-search_result_t *
-uilist_get_highlighted_searchresult()
+static uilist_row_t *
+uilist_add_row(type)
+	LIST_ITEM_TYPE	type;
 {
-search_result_t *srchiter;
-int		i = -1;
-
-	for (srchiter = search_results; (srchiter != NULL); srchiter = srchiter->next) {
-		i++;
-		if (i == current_pw_sublist->current_item)
-			break;
+	if (nrows == rowsize) {
+		rowsize = rowsize ? rowsize * 2 : 64;
+		rows = realloc(rows, rowsize * sizeof(*rows));
 	}
-	return srchiter;
+
+	bzero(&rows[nrows], sizeof(*rows));
+	rows[nrows].type = type;
+	return &rows[nrows++];
 }
 
-folder_t       *
-uilist_get_highlighted_sublist()
+static void
+uilist_build()
 {
-folder_t       *iter;
-int		i = -1;
+search_result_t	*sr;
+folder_t	*listiter;
+password_t     **visible;
+uilist_row_t	*row;
+size_t		 nvisible, i;
 
-	if (!current_pw_sublist)
-		return NULL;
+	/* A different list or search starts at the top of the screen */
+	if (rows_list != current_pw_sublist || rows_search != search_results)
+		first_list_item = 0;
 
-	if (current_pw_sublist->parent)
-		i++;
+	nrows = 0;
+	rows_list = current_pw_sublist;
+	rows_search = search_results;
+	rows_gen = filter_generation();
 
-	for (iter = current_pw_sublist->sublists; iter != NULL; iter = iter->next) {
-		i++;
-		if (i == current_pw_sublist->current_item)
-			break;
+	if (current_pw_sublist == NULL)
+		return;
 
+	if (search_results != NULL) {
+		for (i = 0; i < nsearch_results; i++) {
+			sr = &search_results[i];
+			row = uilist_add_row(sr->entry ? PW_ITEM : PW_SUBLIST);
+			row->entry = sr->entry;
+			row->sublist = sr->sublist;
+			row->result = sr;
+		}
+		return;
 	}
 
-	return iter;
+	if (current_pw_sublist->parent)
+		uilist_add_row(PW_UPLEVEL);
+
+	for (listiter = current_pw_sublist->sublists; listiter; listiter = listiter->next)
+		uilist_add_row(PW_SUBLIST)->sublist = listiter;
+
+	visible = filter_visible(current_pw_sublist, &nvisible);
+	for (i = 0; i < nvisible; i++)
+		uilist_add_row(PW_ITEM)->entry = visible[i];
 }
 
-password_t     *
-uilist_get_highlighted_item()
+static int
+uilist_stale()
 {
-password_t     *iter;
-folder_t       *listiter;
-int		i = -1;
-
-	if (current_pw_sublist->parent)
-		i++;
+	return rows_list != current_pw_sublist || rows_search != search_results ||
+	       rows_gen != filter_generation();
+}
 
-	for (listiter = current_pw_sublist->sublists; listiter != NULL; listiter = listiter->next)
-		i++;
+/*
+ * Return the highlighted row, rebuilding the rows first if they're stale.
+ */
+static uilist_row_t *
+uilist_current_row()
+{
+	if (current_pw_sublist == NULL)
+		return NULL;
 
+	if (uilist_stale())
+		uilist_build();
 
-	PWLIST_FOREACH(iter, &current_pw_sublist->list) {
-		if (filter_apply(iter, options->filter))
-			i++;
+	if (current_pw_sublist->current_item < 0 ||
+	    current_pw_sublist->current_item >= nrows)
+		return NULL;
 
-		if (i == current_pw_sublist->current_item) {
-			debug("get_highlighted_item: found %d, break now", i);
-			return iter;
-		}
-	}
-	debug("get_highlighted_item: nothing found, return NULL");
-	return NULL;
+	return &rows[current_pw_sublist->current_item];
 }
 
-LIST_ITEM_TYPE
-uilist_get_highlighted_type()
+search_result_t *
+uilist_get_highlighted_searchresult()
 {
-password_t     *iter;
-folder_t       *listiter;
-int		i = -1;
+uilist_row_t	*row;
 
-	if (current_pw_sublist->parent) {
-		if (current_pw_sublist->current_item == 0)
-			return PW_UPLEVEL;
+	if ((row = uilist_current_row()) == NULL)
+		return NULL;
+	return row->result;
+}
 
-		i++;
-	}
+folder_t       *
+uilist_get_highlighted_sublist()
+{
+uilist_row_t	*row;
 
-	for (listiter = current_pw_sublist->sublists; listiter != NULL; listiter = listiter->next) {
-		i++;
-		if (i == current_pw_sublist->current_item)
-			return PW_SUBLIST;
-	}
+	if ((row = uilist_current_row()) == NULL || row->type != PW_SUBLIST)
+		return NULL;
+	return row->sublist;
+}
 
-	PWLIST_FOREACH(iter, &current_pw_sublist->list) {
-		if (filter_apply(iter, options->filter))
-			i++;
+password_t     *
+uilist_get_highlighted_item()
+{
+uilist_row_t	*row;
 
-		if (i == current_pw_sublist->current_item)
-			return PW_ITEM;
+	if ((row = uilist_current_row()) == NULL || row->type != PW_ITEM) {
+		debug("get_highlighted_item: nothing found, return NULL");
+		return NULL;
 	}
-	return PW_NULL;
+	return row->entry;
 }
 
-/* Draw a sublist on the screen */
-static int
-_uilist_render_sublist(folder_t *sublist, int i, int num_shown)
+LIST_ITEM_TYPE
+uilist_get_highlighted_type()
 {
-	if ((i >= first_list_item) && (i <= LAST_LIST_ITEM)) {
-		if (lines == current_pw_sublist->current_item)
-			uilist_highlight_line(num_shown);
-		else
-			wattrset(list, A_BOLD);
+uilist_row_t	*row;
 
-		if (sublist->marked)
-			mvwaddstr(list, num_shown, 1, "x");
+	if ((row = uilist_current_row()) == NULL)
+		return PW_NULL;
+	return row->type;
+}
 
-		mvwprintw(list, num_shown, NAMEPOS, "%s ->", sublist->name);
-		wattrset(list, A_NORMAL);
-		wstandend(list);
-		num_shown++;
+/* Draw row n on screen line line */
+static void
+uilist_draw_row(line, n)
+{
+uilist_row_t	*row = &rows[n];
+
+	if (n == current_pw_sublist->current_item)
+		uilist_highlight_line(line);
+	else if (row->type != PW_ITEM)
+		wattrset(list, A_BOLD);
+
+	switch (row->type) {
+	case PW_UPLEVEL:
+		mvwprintw(list, line, NAMEPOS, "<Up One Level - \"%s\">",
+			  current_pw_sublist->parent->name);
+		break;
+
+	case PW_SUBLIST:
+		if (row->sublist->marked)
+			mvwaddstr(list, line, 1, "x");
+		mvwprintw(list, line, NAMEPOS, "%s ->", row->sublist->name);
+		break;
+
+	case PW_ITEM:
+		if (PW_ENT(row->entry)->marked)
+			mvwaddstr(list, line, 1, "x");
+		mvwaddnstr(list, line, NAMEPOS, PW_FIELD(row->entry, PW_NAME), NAMELEN);
+		mvwaddnstr(list, line, HOSTPOS, PW_FIELD(row->entry, PW_HOST), HOSTLEN);
+		mvwaddnstr(list, line, USERPOS, PW_FIELD(row->entry, PW_USER), USERLEN);
+		break;
+
+	default:
+		break;
 	}
 
-	return num_shown;
+	wattrset(list, A_NORMAL);
+	wstandend(list);
 }
 
-/* Draw an entry summary on the screen */
-static int
-_uilist_render_entry(password_t *entry, int i, int num_shown)
+/* Draw row n again, if it's on screen */
+static void
+uilist_redraw_row(n)
 {
-	if ((i >= first_list_item) && (i <= LAST_LIST_ITEM)) {
-		if (lines == current_pw_sublist->current_item)
-			uilist_highlight_line(num_shown);
-
-		if (entry->marked)
-			mvwaddstr(list, num_shown, 1, "x");
-
-		mvwaddnstr(list, num_shown, NAMEPOS, entry->name, NAMELEN);
-		mvwaddnstr(list, num_shown, HOSTPOS, entry->host, HOSTLEN);
-		mvwaddnstr(list, num_shown, USERPOS, entry->user, USERLEN);
-		wstandend(list);
-		num_shown++;
-	}
-	return num_shown;
+	if (n < first_list_item || n > LAST_LIST_ITEM || n >= nrows)
+		return;
+
+	wmove(list, n - first_list_item, 0);
+	wclrtoeol(list);
+	uilist_draw_row(n - first_list_item, n);
 }
 
-void
-uilist_refresh()
+/*
+ * Draw the rows on screen, scrolling only if the cursor has left it.
+ */
+static void
+uilist_draw()
 {
-password_t     *iter;
-folder_t       *listiter;
-search_result_t *srchiter;
-int		i = 0;
-int		num_shown = 0;
+int	i;
 
-	debug("refresh_list: refreshing list");
 	if (list == NULL)
 		uilist_init();
 
 	if (current_pw_sublist == NULL)
 		return;
 
-	uilist_clear();
-	first_list_item = 0;
-	lines = 0;
+	uilist_current_row();
 
+	uilist_clear();
 	uilist_headerline();
 
 	/* Ensure we don't end up off the screen */
+	if (current_pw_sublist->current_item >= nrows)
+		current_pw_sublist->current_item = nrows - 1;
 	if (current_pw_sublist->current_item < 0)
 		current_pw_sublist->current_item = 0;
 
+	if (first_list_item > nrows - LIST_LINES)
+		first_list_item = nrows - LIST_LINES;
+	if (first_list_item < 0)
+		first_list_item = 0;
+
 	if (current_pw_sublist->current_item < first_list_item)
 		first_list_item = current_pw_sublist->current_item;
-	else if ((current_pw_sublist->current_item > LAST_LIST_ITEM))
+	else if (current_pw_sublist->current_item > LAST_LIST_ITEM)
 		first_list_item = current_pw_sublist->current_item - (LIST_LINES - 1);
 
-	if (search_results == NULL) {
-		/* If we aren't at the top level, off the "Up One Level" item */
-		if (current_pw_sublist->parent && search_results == NULL) {
-			if ((i >= first_list_item) && (i <= LAST_LIST_ITEM)) {
-				if (lines == current_pw_sublist->current_item)
-					uilist_highlight_line(num_shown);
-				else
-					wattrset(list, A_BOLD);
-
-				mvwprintw(list, num_shown, NAMEPOS, "<Up One Level - \"%s\">", current_pw_sublist->parent->name);
-				wattrset(list, A_NORMAL);
-				wstandend(list);
-				num_shown++;
-			}
-			i++;
-			lines++;
-		}
-		/* Draw our sublists */
-		for (listiter = current_pw_sublist->sublists; listiter != NULL; listiter = listiter->next) {
-			num_shown = _uilist_render_sublist(listiter, i, num_shown);
-			lines++;
-			i++;
-		}
-		/* Draw our entries, if the filter says it's ok */
-		PWLIST_FOREACH(iter, &current_pw_sublist->list) {
-			/*
-			 * if line satifies filter criteria increment i and
-			 * lines
-			 */
-			if (filter_apply(iter, options->filter)) {
-				num_shown = _uilist_render_entry(iter, i, num_shown);
-				lines++;
-				i++;
-			}
-		}
-	} else {
-		for (srchiter = search_results; (srchiter != NULL); srchiter = srchiter->next) {
-			if (srchiter->entry != NULL)
-				num_shown = _uilist_render_entry(srchiter->entry, i, num_shown);
-			else
-				num_shown = _uilist_render_sublist(srchiter->sublist, i, num_shown);
-
-			lines++;
-			i++;
-		}
-	}
+	for (i = first_list_item; i < nrows && i <= LAST_LIST_ITEM; i++)
+		uilist_draw_row(i - first_list_item, i);
 
 	wrefresh(list);
 	hide_cursor();
 
-	/*
-	 * Is the cursor off the screen, after moving up or down the tree?
-	 * (Don't trigger this if we have no entries yet)
-	 */
-	if (current_pw_sublist->current_item) {
-		if ((lines - 1) < current_pw_sublist->current_item) {
-			/* Just adjust, then redraw */
-			current_pw_sublist->current_item = lines - 1;
-			uilist_refresh();
-		}
-	}
-
 	/* If we have filtering turned on, then warn the user of that */
 	if (options->filter)
 		filter_alert(options->filter);
@@ -303,6 +309,16 @@ int		num_shown = 0;
 	/* If we have searching active, then warn the user of that */
 	if (options->search)
 		search_alert(options->search);
+}
+
+void
+uilist_refresh()
+{
+	debug("refresh_list: refreshing list");
+
+	/* Something may have changed in place, so always start again */
+	uilist_build();
+	uilist_draw();
 
 	debug("refresh_list: done refreshing list");
 }
@@ -345,46 +361,93 @@ int	i;
 	hide_cursor();
 }
 
+/*
+ * Move the cursor to row item.  If nothing else has changed, only the rows
+ * whose highlighting changed, and any scrolled onto the screen, are drawn.
+ */
+static void
+uilist_move(item)
+{
+int	old, first, shift, i;
+
+	if (current_pw_sublist == NULL)
+		return;
+
+	if (list == NULL || uilist_stale()) {
+		current_pw_sublist->current_item = item;
+		uilist_draw();
+		return;
+	}
+
+	if (item >= nrows)
+		item = nrows - 1;
+	if (item < 0)
+		item = 0;
+
+	if ((old = current_pw_sublist->current_item) == item)
+		return;
+	current_pw_sublist->current_item = item;
+
+	first = first_list_item;
+	if (item < first)
+		first = item;
+	else if (item > LAST_LIST_ITEM)
+		first = item - (LIST_LINES - 1);
+
+	if ((shift = first - first_list_item) != 0) {
+		if (shift >= LIST_LINES || shift <= -LIST_LINES) {
+			uilist_draw();
+			return;
+		}
+
+		wscrl(list, shift);
+		first_list_item = first;
+
+		if (shift > 0)
+			for (i = LAST_LIST_ITEM - shift + 1; i <= LAST_LIST_ITEM; i++)
+				uilist_redraw_row(i);
+		else
+			for (i = first; i < first - shift; i++)
+				uilist_redraw_row(i);
+	}
+
+	uilist_redraw_row(old);
+	uilist_redraw_row(item);
+	wrefresh(list);
+}
+
 void
 uilist_page_up()
 {
-	current_pw_sublist->current_item -= (LIST_LINES - 1);
-
-	if (current_pw_sublist->current_item < 1)
-		current_pw_sublist->current_item = 0;
+	if (current_pw_sublist == NULL)
+		return;
 
-	uilist_refresh();
+	uilist_move(current_pw_sublist->current_item - (LIST_LINES - 1));
 }
 
 void
 uilist_page_down()
 {
-	current_pw_sublist->current_item += (LIST_LINES - 1);
-
-	if (current_pw_sublist->current_item >= (lines - 1))
-		current_pw_sublist->current_item = lines - 1;
+	if (current_pw_sublist == NULL)
+		return;
 
-	uilist_refresh();
+	uilist_move(current_pw_sublist->current_item + (LIST_LINES - 1));
 }
 
 void
 uilist_up()
 {
-	if (current_pw_sublist->current_item < 1)
+	if (current_pw_sublist == NULL)
 		return;
 
-	current_pw_sublist->current_item--;
-
-	uilist_refresh();
+	uilist_move(current_pw_sublist->current_item - 1);
 }
 
 void
 uilist_down()
 {
-	if (current_pw_sublist->current_item >= (lines - 1))
+	if (current_pw_sublist == NULL)
 		return;
 
-	current_pw_sublist->current_item++;
-
-	uilist_refresh();
+	uilist_move(current_pw_sublist->current_item + 1);
 }
@@ -0,0 +1,129 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include	<stdlib.h>
+#include	<pthread.h>
+
+#include	"pwman.h"
+#include	"workers.h"
+
+static pthread_mutex_t	 lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 work = PTHREAD_COND_INITIALIZER;	/* a job was posted */
+static pthread_cond_t	 done = PTHREAD_COND_INITIALIZER;	/* a share finished */
+static pthread_t	 threads[WORKERS_MAX];
+static int		 nstarted = 1;		/* the caller is worker 0 */
+
+/* The current job; all protected by lock */
+static workers_fn_t	 job_fn;
+static void		*job_arg;
+static size_t		 job_n;
+static int		 job_shares;
+static int		 job_left;
+static unsigned		 job_gen;
+static unsigned		 seen[WORKERS_MAX];
+
+static void *
+workers_loop(arg)
+	void	*arg;
+{
+int	id = (int) (intptr_t) arg;
+size_t	start, end;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (seen[id] == job_gen)
+			pthread_cond_wait(&work, &lock);
+		seen[id] = job_gen;
+
+		if (id >= job_shares)
+			continue;
+
+		start = job_n * id / job_shares;
+		end = job_n * (id + 1) / job_shares;
+		pthread_mutex_unlock(&lock);
+
+		job_fn(job_arg, start, end, id);
+
+		pthread_mutex_lock(&lock);
+		if (--job_left == 0)
+			pthread_cond_signal(&done);
+	}
+
+	/* NOTREACHED */
+	return NULL;
+}
+
+/*
+ * Call fn over n items, split between up to nthreads threads, giving each at
+ * least min items.
+ */
+void
+workers_run(nthreads, n, min, fn, arg)
+	size_t		 n, min;
+	workers_fn_t	 fn;
+	void		*arg;
+{
+int	shares = nthreads;
+
+	if (shares > WORKERS_MAX)
+		shares = WORKERS_MAX;
+	if (min && n / min < (size_t) shares)
+		shares = n / min;
+
+	if (shares <= 1) {
+		fn(arg, 0, n, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	for (; nstarted < shares; nstarted++) {
+		seen[nstarted] = job_gen;
+		if (pthread_create(&threads[nstarted], NULL, workers_loop,
+				   (void *) (intptr_t) nstarted) != 0)
+			break;
+	}
+
+	/* Make do with the threads we could start */
+	if (shares > nstarted)
+		shares = nstarted;
+
+	if (shares <= 1) {
+		pthread_mutex_unlock(&lock);
+		fn(arg, 0, n, 0);
+		return;
+	}
+
+	job_fn = fn;
+	job_arg = arg;
+	job_n = n;
+	job_shares = shares;
+	job_left = shares - 1;
+	job_gen++;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+
+	fn(arg, 0, n / shares, 0);
+
+	pthread_mutex_lock(&lock);
+	while (job_left > 0)
+		pthread_cond_wait(&done, &lock);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,39 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef	PWMAN_WORKERS_H
+#define	PWMAN_WORKERS_H
+
+/*
+ * A pool of threads to split a loop over n items between.  The calling thread
+ * does the first share itself, and workers_run() returns when every share is
+ * done.  Threads are started the first time they're needed and then kept.
+ * Only one thread may use the pool at a time.
+ */
+
+#define	WORKERS_MAX	16
+
+/* Handles items [start, end); worker is 0 .. nthreads - 1 */
+typedef void	(*workers_fn_t)(void *arg, size_t start, size_t end, int worker);
+
+void	workers_run(int nthreads, size_t n, size_t min, workers_fn_t, void *);
+
+#endif	/* !PWMAN_WORKERS_H */
@@ -0,0 +1,197 @@
+#! /bin/sh
+#
+# Exercise pwman --agent with a throwaway gpg home and database.
+#
+# usage: agent.sh [path to pwman]
+#
+# Needs gpg 2.1 or later.  The early disconnect test needs python3, and the
+# foreign agent test python3 and root; they're skipped without them.  The
+# timeout test takes a little over a minute.
+
+PWMAN=${1:-src/pwman}
+case $PWMAN in
+/*)	;;
+*)	PWMAN=$(pwd)/$PWMAN ;;
+esac
+
+GPG=$(command -v gpg2 || command -v gpg)
+if [ -z "$GPG" ]; then
+	echo "gpg not found" >&2
+	exit 1
+fi
+
+T=$(mktemp -d "${TMPDIR:-/tmp}/pwman.XXXXXX") || exit 1
+HOME=$T
+GNUPGHOME=$T/gnupg
+export HOME GNUPGHOME
+DB=$T/db
+ID=pwman-test@example.invalid
+
+failed=0
+
+cleanup() {
+	pid=$(agent_pid)
+	[ -n "$pid" ] && kill $pid
+	gpgconf --kill gpg-agent 2>/dev/null
+	rm -rf "$T"
+}
+trap cleanup EXIT
+
+ok() {
+	echo "ok - $1"
+}
+
+fail() {
+	echo "not ok - $1"
+	failed=1
+}
+
+agent_pid() {
+	pgrep -f "pwman -f $DB --agent"
+}
+
+# Wait up to $2 seconds for process $1 to exit
+wait_gone() {
+	n=0
+	while kill -0 $1 2>/dev/null; do
+		[ $n -ge $(($2 * 10)) ] && return 1
+		sleep 0.1
+		n=$((n + 1))
+	done
+	return 0
+}
+
+# Write the database with $1 as the IMAP password
+write_db() {
+	cat >$T/db.xml <<EOF
+<?xml version="1.0"?>
+<PWMan_PasswordList version="3">
+  <PwList name="Main">
+    <PwItem>
+      <name>web</name>
+      <host>www.example.com</host>
+      <user>admin</user>
+      <passwd>web-secret</passwd>
+      <launch></launch>
+    </PwItem>
+    <PwList name="mail">
+      <PwItem>
+        <name>imap</name>
+        <host>imap.example.com</host>
+        <user>alice</user>
+        <passwd>$1</passwd>
+        <launch></launch>
+      </PwItem>
+    </PwList>
+  </PwList>
+</PWMan_PasswordList>
+EOF
+	"$GPG" -q --batch --yes -e -r $ID -o $DB.new $T/db.xml && mv $DB.new $DB
+}
+
+# Run a command as a client that can't decrypt the database itself, so only
+# the agent can answer
+client() {
+	GNUPGHOME=$T/nokeys "$PWMAN" -f $DB "$@" </dev/null 2>/dev/null
+}
+
+start_agent() {
+	echo | setsid "$PWMAN" -f $DB --agent "$@" >/dev/null 2>&1
+}
+
+mkdir -m 700 $GNUPGHOME $T/nokeys
+"$GPG" -q --batch --pinentry-mode loopback --passphrase '' \
+	--quick-generate-key "pwman test <$ID>" default default never \
+	2>/dev/null || exit 1
+
+cat >$HOME/.pwmanrc <<EOF
+<?xml version="1.0"?>
+<pwm_config>
+  <gpg_id>$ID</gpg_id>
+  <gpg_path>$GPG</gpg_path>
+  <password_file>$DB</password_file>
+  <passphrase_timeout>180</passphrase_timeout>
+</pwm_config>
+EOF
+
+write_db imap-secret || exit 1
+
+# Queries through the agent
+start_agent
+[ -S $DB.agent ] && ok "agent started" || fail "agent started"
+
+[ "$(client get /mail/imap password)" = imap-secret ] &&
+    ok "get through the agent" || fail "get through the agent"
+[ "$(client ls /)" = "$(printf '/mail/\n/web')" ] &&
+    ok "ls through the agent" || fail "ls through the agent"
+[ "$(client search example)" = "$(printf '/mail/imap\n/web')" ] &&
+    ok "search through the agent" || fail "search through the agent"
+client get /nope
+[ $? -eq 1 ] && ok "missing entry fails" || fail "missing entry fails"
+
+# Reload after the database is saved
+write_db imap-changed
+[ "$(client get /mail/imap password)" = imap-changed ] &&
+    ok "reload after re-encrypting" || fail "reload after re-encrypting"
+
+# A client going away without reading the reply, just after a reload
+if command -v python3 >/dev/null; then
+	write_db imap-again
+	python3 - $DB.agent <<'EOF'
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(b'ls\0/\0')
+s.close()
+EOF
+	sleep 0.5
+	[ "$(client get /mail/imap password)" = imap-again ] &&
+	    ok "early disconnect" || fail "early disconnect"
+else
+	echo "ok - early disconnect # SKIP no python3"
+fi
+
+# Exit on SIGTERM
+pid=$(agent_pid)
+if [ -n "$pid" ] && kill $pid && wait_gone $pid 5 && [ ! -e $DB.agent ]; then
+	ok "exit on SIGTERM"
+else
+	fail "exit on SIGTERM"
+fi
+
+# Ignore an agent socket that belongs to someone else
+if command -v python3 >/dev/null && [ "$(id -u)" -eq 0 ]; then
+	python3 - $DB.agent <<'EOF' &
+import os, socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.bind(sys.argv[1])
+os.chown(sys.argv[1], 65534, -1)
+s.listen(1)
+s.settimeout(5)
+try:
+	c, _ = s.accept()
+	c.recv(4096)
+	c.sendall(b'0 5 0\nfake\n')
+	c.close()
+except socket.timeout:
+	pass
+os.unlink(sys.argv[1])
+EOF
+	sleep 0.5
+	[ "$(client get /mail/imap password)" != fake ] &&
+	    ok "foreign agent ignored" || fail "foreign agent ignored"
+	wait
+else
+	echo "ok - foreign agent ignored # SKIP needs python3 and root"
+fi
+
+# Exit when the passphrase times out
+start_agent -t 1
+pid=$(agent_pid)
+if [ -n "$pid" ] && wait_gone $pid 75 && [ ! -e $DB.agent ]; then
+	ok "exit on timeout"
+else
+	fail "exit on timeout"
+fi
+
+exit $failed
@@ -0,0 +1,156 @@
+#! /bin/sh
+#
+# Check that a database or export with a DTD is refused, so an external
+# entity can't pull a local file into the vault.
+#
+# usage: entities.sh [path to pwman]
+#
+# Needs gpg 2.1 or later.  The database is read by pwman --agent, which
+# exits without listening if it can't load it.
+
+PWMAN=${1:-src/pwman}
+case $PWMAN in
+/*)	;;
+*)	PWMAN=$(pwd)/$PWMAN ;;
+esac
+
+GPG=$(command -v gpg2 || command -v gpg)
+if [ -z "$GPG" ]; then
+	echo "gpg not found" >&2
+	exit 1
+fi
+
+T=$(mktemp -d "${TMPDIR:-/tmp}/pwman.XXXXXX") || exit 1
+HOME=$T
+GNUPGHOME=$T/gnupg
+export HOME GNUPGHOME
+DB=$T/db
+ID=pwman-test@example.invalid
+
+failed=0
+
+cleanup() {
+	stop_agent
+	gpgconf --kill gpg-agent 2>/dev/null
+	rm -rf "$T"
+}
+trap cleanup EXIT
+
+ok() {
+	echo "ok - $1"
+}
+
+fail() {
+	echo "not ok - $1"
+	failed=1
+}
+
+agent_pid() {
+	pgrep -f "pwman -f $DB --agent"
+}
+
+start_agent() {
+	echo | setsid "$PWMAN" -f $DB --agent >/dev/null 2>&1
+}
+
+stop_agent() {
+	pid=$(agent_pid)
+	[ -n "$pid" ] && kill $pid
+	n=0
+	while [ -e $DB.agent ] && [ $n -lt 50 ]; do
+		sleep 0.1
+		n=$((n + 1))
+	done
+}
+
+client() {
+	GNUPGHOME=$T/nokeys "$PWMAN" -f $DB "$@" </dev/null 2>/dev/null
+}
+
+# Encrypt stdin as the database
+write_db() {
+	"$GPG" -q --batch --yes -e -r $ID -o $DB.new && mv $DB.new $DB
+}
+
+mkdir -m 700 $GNUPGHOME $T/nokeys
+"$GPG" -q --batch --pinentry-mode loopback --passphrase '' \
+	--quick-generate-key "pwman test <$ID>" default default never \
+	2>/dev/null || exit 1
+
+cat >$HOME/.pwmanrc <<EOF
+<?xml version="1.0"?>
+<pwm_config>
+  <gpg_id>$ID</gpg_id>
+  <gpg_path>$GPG</gpg_path>
+  <password_file>$DB</password_file>
+  <passphrase_timeout>180</passphrase_timeout>
+</pwm_config>
+EOF
+
+echo leaked-secret >$T/leak.txt
+
+# Without a DTD, escaped list names still read back as they were written
+write_db <<EOF
+<?xml version="1.0"?>
+<PWMan_PasswordList version="3">
+  <PwList name="Main">
+    <PwItem>
+      <name>web</name>
+      <passwd>web-secret</passwd>
+    </PwItem>
+    <PwList name="a &amp; b &#38; &lt;c&gt;"/>
+  </PwList>
+</PWMan_PasswordList>
+EOF
+
+start_agent
+[ "$(client get /web password)" = web-secret ] &&
+    ok "read without a DTD" || fail "read without a DTD"
+[ "$(client ls /)" = "$(printf '/a & b & <c>/\n/web')" ] &&
+    ok "entities in attributes" || fail "entities in attributes"
+stop_agent
+
+# An external entity in a field
+write_db <<EOF
+<?xml version="1.0"?>
+<!DOCTYPE PWMan_PasswordList [
+  <!ENTITY x SYSTEM "file://$T/leak.txt">
+]>
+<PWMan_PasswordList version="3">
+  <PwList name="Main">
+    <PwItem>
+      <name>web</name>
+      <passwd>&x;</passwd>
+    </PwItem>
+  </PwList>
+</PWMan_PasswordList>
+EOF
+
+start_agent
+out=$(client get /web password)
+case $out in
+*leaked-secret*)	fail "external entity in a field" ;;
+*)	[ ! -S $DB.agent ] && ok "external entity in a field" ||
+	    fail "external entity in a field" ;;
+esac
+stop_agent
+
+# An external DTD
+write_db <<EOF
+<?xml version="1.0"?>
+<!DOCTYPE PWMan_PasswordList SYSTEM "file://$T/leak.txt">
+<PWMan_PasswordList version="3">
+  <PwList name="Main">
+    <PwItem>
+      <name>web</name>
+      <passwd>web-secret</passwd>
+    </PwItem>
+  </PwList>
+</PWMan_PasswordList>
+EOF
+
+start_agent
+[ ! -S $DB.agent ] && ok "external DTD" || fail "external DTD"
+stop_agent
+
+exit $failed
@@ -0,0 +1,123 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Time the scalar, SSE2 and AVX2 matchers over the fields of a generated
+ * database, the way search_apply() walks them.  Prints the nanoseconds per
+ * field for each pattern, and how much faster than the scalar loop each
+ * version is.
+ *
+ * usage: match_bench [entries] [runs]
+ */
+
+#include	<time.h>
+
+#include	"match.c"
+
+static char const	*patterns[] = {
+	"xq", "db1", "admin", "example.com", "zzzzzzzzzzzzzzzzzzzz"
+};
+
+static double
+bench_now()
+{
+struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(argc, argv)
+	char	**argv;
+{
+struct {
+	char const	*name;
+	match_fn_t	 fn;
+} impls[3];
+match_t		  m;
+char		**fields, buf[128];
+size_t		 *lens;
+double		  start, t, scalar = 0;
+long		  n, nfields, runs, r, i, found;
+int		  nimpls = 0, j;
+size_t		  p;
+
+	n = argc > 1 ? atol(argv[1]) : 100000;
+	runs = argc > 2 ? atol(argv[2]) : 20;
+
+	impls[nimpls].name = "scalar";
+	impls[nimpls++].fn = match_find_scalar;
+#ifdef	MATCH_SIMD
+	impls[nimpls].name = "sse2";
+	impls[nimpls++].fn = match_find_sse2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		impls[nimpls].name = "avx2";
+		impls[nimpls++].fn = match_find_avx2;
+	}
+#endif
+
+	/* The searchable fields of entries like search_bench.sh makes */
+	nfields = n * 3;
+	fields = xcalloc(nfields, sizeof(*fields));
+	lens = xcalloc(nfields, sizeof(*lens));
+	for (i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "Entry %ld for the %s service", i,
+			 i % 2 ? "Staging" : "Production");
+		fields[i * 3] = xstrdup(buf);
+		snprintf(buf, sizeof(buf), "db%ld.example.com", i % 97);
+		fields[i * 3 + 1] = xstrdup(buf);
+		fields[i * 3 + 2] = xstrdup(i % 3 ? "Administrator" : "root");
+	}
+	for (i = 0; i < nfields; i++)
+		lens[i] = strlen(fields[i]);
+
+	bzero(&m, sizeof(m));
+	for (p = 0; p < sizeof(patterns) / sizeof(*patterns); p++) {
+		match_set(&m, patterns[p]);
+		printf("%-22s", patterns[p]);
+
+		for (j = 0; j < nimpls; j++) {
+			found = 0;
+			start = bench_now();
+			for (r = 0; r < runs; r++)
+				for (i = 0; i < nfields; i++)
+					if (lens[i] >= m.len &&
+					    impls[j].fn(&m, fields[i], lens[i], 0))
+						found++;
+			t = (bench_now() - start) / runs / nfields;
+
+			if (j == 0)
+				scalar = t;
+			printf("  %s %5.2f ns", impls[j].name, t);
+			if (j > 0)
+				printf(" (%.1fx)", scalar / t);
+		}
+		printf("  [%ld found]\n", found / runs);
+	}
+	match_clear(&m);
+
+	for (i = 0; i < nfields; i++)
+		free(fields[i]);
+	free(fields);
+	free(lens);
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Compare the scalar, SSE2 and AVX2 matchers against a plain reference on
+ * random fields of 0-80 bytes and patterns of 1-40 bytes.  Half the fields
+ * end at the end of a page, so a read past the page faults; the rest are
+ * followed by random bytes, which a read past the NUL mustn't match.
+ *
+ * usage: match_test [cases] [seed]
+ */
+
+#include	<sys/mman.h>
+
+#include	<ctype.h>
+#include	<unistd.h>
+
+#include	"match.c"
+
+/* Letters either side of the capitals, and bytes with the top bit set */
+static char const	alphabet[] = "aAbBzZ@[`{\x80\xc1\xe1\xfa";
+
+static char const *
+ref_find(pat, s)
+	char const	*pat, *s;
+{
+size_t	i, j, plen = strlen(pat), slen = strlen(s);
+
+	for (i = 0; i + plen <= slen; i++) {
+		for (j = 0; j < plen; j++)
+			if (MATCH_FOLD((unsigned char) s[i + j]) !=
+			    MATCH_FOLD((unsigned char) pat[j]))
+				break;
+		if (j == plen)
+			return s + i;
+	}
+	return NULL;
+}
+
+static void
+random_str(buf, len)
+	char	*buf;
+	size_t	 len;
+{
+size_t	i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = alphabet[random() % (sizeof(alphabet) - 1)];
+	buf[len] = '\0';
+}
+
+int
+main(argc, argv)
+	char	**argv;
+{
+struct {
+	char const	*name;
+	match_fn_t	 fn;
+	int		 failed;
+} impls[3];
+match_t		 m;
+char		*page, *field, pat[41];
+char const	*want, *got;
+long		 ncases, c, psize;
+size_t		 flen, plen, off;
+int		 nimpls = 0, failed = 0, i;
+
+	ncases = argc > 1 ? atol(argv[1]) : 1000000;
+	srandom(argc > 2 ? atol(argv[2]) : getpid());
+
+	bzero(impls, sizeof(impls));
+	impls[nimpls].name = "scalar";
+	impls[nimpls++].fn = match_find_scalar;
+#ifdef	MATCH_SIMD
+	impls[nimpls].name = "sse2";
+	impls[nimpls++].fn = match_find_sse2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		impls[nimpls].name = "avx2";
+		impls[nimpls++].fn = match_find_avx2;
+	} else
+		printf("ok - avx2 # SKIP not supported by this CPU\n");
+#endif
+
+	psize = sysconf(_SC_PAGESIZE);
+	page = mmap(NULL, psize * 2, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (page == MAP_FAILED || mprotect(page + psize, psize, PROT_NONE) == -1) {
+		perror("match_test: mmap");
+		return 1;
+	}
+
+	bzero(&m, sizeof(m));
+	for (c = 0; c < ncases; c++) {
+		flen = random() % 81;
+		if (random() % 2)
+			field = page + psize - flen - 1;
+		else {
+			field = page + random() % (psize - flen - 1 - 64);
+			random_str(field + flen + 1, 63);
+		}
+		random_str(field, flen);
+
+		/* Usually take the pattern from the field, with its case changed */
+		plen = 1 + random() % 40;
+		if (flen >= plen && random() % 4) {
+			off = random() % (flen - plen + 1);
+			memcpy(pat, field + off, plen);
+			pat[plen] = '\0';
+			for (off = 0; off < plen; off++)
+				if (random() % 2 && isalpha((unsigned char) pat[off]))
+					pat[off] ^= 0x20;
+		} else
+			random_str(pat, plen);
+
+		match_set(&m, pat);
+		want = ref_find(pat, field);
+
+		/* Report only the first failure of each */
+		for (i = 0; i < nimpls; i++) {
+			if (impls[i].failed)
+				continue;
+
+			got = flen >= plen ? impls[i].fn(&m, field, flen, 0) : NULL;
+			if (got == want)
+				continue;
+
+			printf("not ok - %s: \"%s\" in \"%s\" at %ld, want %ld\n",
+			       impls[i].name, pat, field,
+			       got ? (long) (got - field) : -1L,
+			       want ? (long) (want - field) : -1L);
+			impls[i].failed = 1;
+			failed = 1;
+		}
+	}
+	match_clear(&m);
+
+	for (i = 0; i < nimpls; i++)
+		if (!impls[i].failed)
+			printf("ok - %s, %ld cases\n", impls[i].name, ncases);
+	return failed;
+}
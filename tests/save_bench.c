@@ -0,0 +1,205 @@
+/*
+ *  PWMan - password management application
+ *
+ *  Copyright (c) 2014	Felicity Tarnell.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Time saving a generated database both ways pwman does it: serialised
+ * first and then encrypted, as the background saver does, or serialised by
+ * the writer thread while gpg encrypts, as a save from the UI does.  Run by
+ * save_bench.sh.
+ */
+
+#include	<stdlib.h>
+#include	<time.h>
+
+#include	"pwman.h"
+#include	"gnupg.h"
+#include	"pwdb.h"
+#include	"ui.h"
+#include	"actions.h"
+
+Options	*options;
+int	 write_options;
+time_t	 time_base;
+
+/* Only asked for if something goes wrong, which fails the benchmark */
+int
+ui_statusline_msg(msg)
+	char const	*msg;
+{
+	fprintf(stderr, "save_bench: %s\n", msg);
+	exit(1);
+}
+
+char *
+ui_ask_str(msg, def)
+	char const	*msg, *def;
+{
+	ui_statusline_msg(msg);
+	return NULL;
+}
+
+char *
+ui_ask_passwd(msg, def)
+	char const	*msg, *def;
+{
+	ui_statusline_msg(msg);
+	return NULL;
+}
+
+void
+action_input_gpgid_dialog(fields, num_fields, title)
+	InputField	*fields;
+	char const	*title;
+{
+	ui_statusline_msg(title);
+}
+
+typedef struct bench_buf {
+	char	*buf;
+	size_t	 len;
+} bench_buf_t;
+
+static int
+bench_write_db(fp, arg)
+	FILE	*fp;
+	void	*arg;
+{
+	return pwdb_write(fp, arg);
+}
+
+static int
+bench_write_buf(fp, arg)
+	FILE	*fp;
+	void	*arg;
+{
+bench_buf_t	*b = arg;
+
+	fwrite(b->buf, 1, b->len, fp);
+	return ferror(fp) ? -1 : 0;
+}
+
+static double
+bench_now()
+{
+struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* 100 lists of n / 100 entries, like search_bench.sh */
+static folder_t *
+bench_make_db(n)
+{
+folder_t	*top, *list = NULL;
+password_t	*pw;
+char		 buf[64];
+int		 i, per = n / 100 ? n / 100 : 1;
+
+	top = xcalloc(1, sizeof(*top));
+	top->name = xstrdup("Main");
+
+	for (i = 0; i < n; i++) {
+		if (i % per == 0) {
+			list = xcalloc(1, sizeof(*list));
+			snprintf(buf, sizeof(buf), "list %d", i / per);
+			list->name = xstrdup(buf);
+			list->parent = top;
+			list->prev = top->lastsub;
+			if (top->lastsub)
+				top->lastsub->next = list;
+			else
+				top->sublists = list;
+			top->lastsub = list;
+		}
+
+		pw = pwstore_new();
+		snprintf(buf, sizeof(buf), "entry %d", i);
+		pwstore_set(pw, PW_NAME, buf, 0);
+		snprintf(buf, sizeof(buf), "db%d.example.com", i % 97);
+		pwstore_set(pw, PW_HOST, buf, 1);
+		pwstore_set(pw, PW_USER, i % 3 ? "admin" : "root", 1);
+		snprintf(buf, sizeof(buf), "%08x%08x", i * 2654435761U, i ^ 0x5bd1e995);
+		pwstore_set(pw, PW_PASSWD, buf, 0);
+		pwstore_set(pw, PW_LAUNCH, i % 5 ? NULL : "ssh %u@%h", 1);
+		pwstore_attach(list, pw);
+	}
+
+	return top;
+}
+
+int
+main(argc, argv)
+	char	**argv;
+{
+Options		 opts;
+folder_t	*top;
+bench_buf_t	 b;
+FILE		*fp;
+double		 start, ser = 0, enc = 0, pipe = 0;
+int		 n, runs, i;
+
+	if (argc < 4) {
+		fprintf(stderr, "usage: save_bench <gpg> <id> <file> [entries] [runs]\n");
+		return 1;
+	}
+
+	bzero(&opts, sizeof(opts));
+	opts.gpg_path = argv[1];
+	opts.gpg_id = argv[2];
+	options = &opts;
+	n = argc > 4 ? atoi(argv[4]) : 50000;
+	runs = argc > 5 ? atoi(argv[5]) : 5;
+
+	top = bench_make_db(n);
+
+	for (i = 0; i < runs; i++) {
+		b.buf = NULL;
+		b.len = 0;
+		start = bench_now();
+		if ((fp = open_memstream(&b.buf, &b.len)) == NULL ||
+		    pwdb_write(fp, top) != 0 || fclose(fp) == EOF) {
+			fprintf(stderr, "save_bench: serialising failed\n");
+			return 1;
+		}
+		ser += bench_now() - start;
+
+		start = bench_now();
+		if (gnupg_write_batch(bench_write_buf, &b, argv[2], argv[3]) != 0) {
+			fprintf(stderr, "save_bench: serial save failed\n");
+			return 1;
+		}
+		enc += bench_now() - start;
+		free(b.buf);
+
+		start = bench_now();
+		if (gnupg_write_batch(bench_write_db, top, argv[2], argv[3]) != 0) {
+			fprintf(stderr, "save_bench: pipelined save failed\n");
+			return 1;
+		}
+		pipe += bench_now() - start;
+	}
+
+	printf("entries %d, plaintext %zu bytes, %d runs\n", n, b.len, runs);
+	printf("serialise %.1f ms\n", ser / runs);
+	printf("serial %.1f ms (encrypt %.1f ms)\n", (ser + enc) / runs, enc / runs);
+	printf("pipelined %.1f ms\n", pipe / runs);
+	return 0;
+}
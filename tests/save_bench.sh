@@ -0,0 +1,43 @@
+#! /bin/sh
+#
+# Time saving a large generated database serialised first and then
+# encrypted, as the background saver does, against serialising in the writer
+# thread while gpg encrypts.
+#
+# usage: save_bench.sh [path to save_bench] [entries] [runs]
+#
+# Build save_bench first with "make -C tests save_bench".  Prints the mean
+# milliseconds for each way of saving.  Needs gpg 2.1 or later.
+
+BENCH=${1:-tests/save_bench}
+case $BENCH in
+/*)	;;
+*)	BENCH=$(pwd)/$BENCH ;;
+esac
+N=${2:-50000}
+RUNS=${3:-5}
+
+GPG=$(command -v gpg2 || command -v gpg)
+if [ -z "$GPG" ]; then
+	echo "gpg not found" >&2
+	exit 1
+fi
+
+T=$(mktemp -d "${TMPDIR:-/tmp}/pwman.XXXXXX") || exit 1
+HOME=$T
+GNUPGHOME=$T/gnupg
+export HOME GNUPGHOME
+ID=pwman-test@example.invalid
+
+cleanup() {
+	gpgconf --kill gpg-agent 2>/dev/null
+	rm -rf "$T"
+}
+trap cleanup EXIT
+
+mkdir -m 700 $GNUPGHOME
+"$GPG" -q --batch --pinentry-mode loopback --passphrase '' \
+	--quick-generate-key "pwman test <$ID>" default default never \
+	2>/dev/null || exit 1
+
+"$BENCH" "$GPG" $ID $T/db $N $RUNS
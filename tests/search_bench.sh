@@ -0,0 +1,99 @@
+#! /bin/sh
+#
+# Time searches of a large generated database with different numbers of
+# search threads, by asking an agent so decrypting isn't counted.
+#
+# usage: search_bench.sh [path to pwman] [entries] [thread counts...]
+#
+# Each line of output is a thread count, a term and the mean milliseconds per
+# search, including the round trip to the agent.  Needs gpg 2.1 or later and
+# date +%N.
+
+PWMAN=${1:-src/pwman}
+case $PWMAN in
+/*)	;;
+*)	PWMAN=$(pwd)/$PWMAN ;;
+esac
+N=${2:-100000}
+[ $# -gt 2 ] && shift 2 || set -- 1 2 4
+
+RUNS=20
+TERMS="xq db1 admin"
+
+GPG=$(command -v gpg2 || command -v gpg)
+if [ -z "$GPG" ]; then
+	echo "gpg not found" >&2
+	exit 1
+fi
+
+T=$(mktemp -d "${TMPDIR:-/tmp}/pwman.XXXXXX") || exit 1
+HOME=$T
+GNUPGHOME=$T/gnupg
+export HOME GNUPGHOME
+DB=$T/db
+ID=pwman-test@example.invalid
+
+cleanup() {
+	pid=$(pgrep -f "pwman -f $DB --agent")
+	[ -n "$pid" ] && kill $pid
+	gpgconf --kill gpg-agent 2>/dev/null
+	rm -rf "$T"
+}
+trap cleanup EXIT
+
+mkdir -m 700 $GNUPGHOME
+"$GPG" -q --batch --pinentry-mode loopback --passphrase '' \
+	--quick-generate-key "pwman test <$ID>" default default never \
+	2>/dev/null || exit 1
+
+# 100 lists of N / 100 entries
+awk -v n=$N 'BEGIN {
+	print "<?xml version=\"1.0\"?>"
+	print "<PWMan_PasswordList version=\"3\">"
+	print "<PwList name=\"Main\">"
+	for (i = 0; i < n; i++) {
+		if (i % (n / 100) == 0) {
+			if (i)
+				print "</PwList>"
+			printf "<PwList name=\"list %d\">\n", i / (n / 100)
+		}
+		printf "<PwItem><name>entry %d</name><host>db%d.example.com</host>", i, i % 97
+		printf "<user>%s</user><passwd>p%d</passwd><launch>ssh %%u@%%h</launch></PwItem>\n", \
+			(i % 3 ? "svc_" i % 50 : "admin"), i
+	}
+	print "</PwList>"
+	print "</PwList>"
+	print "</PWMan_PasswordList>"
+}' | "$GPG" -q --batch --yes -e -r $ID -o $DB || exit 1
+
+for threads in "$@"; do
+	cat >$HOME/.pwmanrc <<EOF
+<?xml version="1.0"?>
+<pwm_config>
+  <gpg_id>$ID</gpg_id>
+  <gpg_path>$GPG</gpg_path>
+  <password_file>$DB</password_file>
+  <passphrase_timeout>180</passphrase_timeout>
+  <search_threads>$threads</search_threads>
+</pwm_config>
+EOF
+	echo | setsid "$PWMAN" -f $DB --agent >/dev/null 2>&1 || exit 1
+
+	for term in $TERMS; do
+		start=$(date +%s%N)
+		i=0
+		while [ $i -lt $RUNS ]; do
+			"$PWMAN" -f $DB search "$term" </dev/null >/dev/null 2>&1
+			i=$((i + 1))
+		done
+		end=$(date +%s%N)
+		echo "$threads $term $(( (end - start) / RUNS / 1000 ))" |
+		    awk '{ printf "%2d threads  %-6s %8.2f ms\n", $1, $2, $3 / 1000 }'
+	done
+
+	pid=$(pgrep -f "pwman -f $DB --agent")
+	kill $pid
+	while kill -0 $pid 2>/dev/null; do
+		sleep 0.1
+	done
+done